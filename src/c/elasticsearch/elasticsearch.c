@@ -15,9 +15,12 @@
  */
 
 #include "elasticsearch.h"
+#include "elasticsearch/group_commit.h"
 #include "elasticsearch/mapping.h"
 #include "elasticsearch/querygen.h"
+#include "elasticsearch/refresh_coordinator.h"
 #include "highlighting/highlighting.h"
+#include "json/smile.h"
 #include "rest/rest.h"
 #include "indexam/zdbam.h"
 
@@ -28,12 +31,38 @@
 #include "commands/dbcommands.h"
 #include "utils/formatting.h"
 #include "utils/lsyscache.h"
+#include "utils/resowner.h"
 
 /* an ES limit introduced around Elasticsearch v5 */
 #define MAX_DOCS_PER_REQUEST 10000
 
+/* how many hits we read between nudging a scroll's prefetch request along */
+#define SCROLL_PREFETCH_POLL_INTERVAL 256
+
+/* the most slices we'll split a scroll into */
+#define MAX_SCROLL_SLICES 16
+
+/* limits for adapt_to_backpressure() */
+#define BULK_MIN_BATCH_SIZE      (64 * 1024)
+#define BULK_SLOW_LATENCY_FACTOR 2.0
+
+/*
+ * UPDATE/DELETE statements stamping at least this many rows with the same xmax do it with one
+ * _update_by_query over their zdb_ctids rather than an update action per row
+ */
+#define XMAX_BY_QUERY_THRESHOLD 5000
+
+/* how many times _update_by_query gets to run into version conflicts before we give up */
+#define XMAX_BY_QUERY_MAX_ATTEMPTS 10
+
+/* Elasticsearch's default index.max_terms_count */
+#define MAX_PENDING_XMAX 65536
+
 #define ES_BULK_RESPONSE_FILTER "errors,items.*.error"
+#define ES_BULK_STATUS_RESPONSE_FILTER ES_BULK_RESPONSE_FILTER ",items.*.status"
 #define ES_SEARCH_RESPONSE_FILTER "_scroll_id,_shards.failed,hits.total,hits.hits.fields.*,hits.hits._id,hits.hits._score,hits.hits.highlight.*"
+#define ES_SEARCH_AFTER_RESPONSE_FILTER ES_SEARCH_RESPONSE_FILTER ",hits.hits.sort"
+#define ES_SEARCH_AFTER_SKIP_FILTER "_shards.failed,hits.total,hits.hits.sort"
 
 #define validate_alias(indexRel) \
     do { \
@@ -47,13 +76,10 @@ static PostDataEntry *checkout_batch_pool(ElasticsearchBulkContext *context) {
 
 	for (i = 0; i < context->rest->nhandles + 1; i++) {
 		if (context->pool[i] != NULL) {
-			PostDataEntry *entry = palloc(sizeof(PostDataEntry));
-
-			entry->buff            = context->pool[i];
-			entry->pool_idx        = i;
-			entry->compressed_data = NULL;
+			PostDataEntry *entry = context->pool[i];
 
-			context->pool[i] = NULL;
+			context->pool[i]    = NULL;
+			context->smileStart = 0;
 			return entry;
 		}
 	}
@@ -96,6 +122,30 @@ static char *generate_uuid_index_name(Relation indexRel) {
 	return name;
 }
 
+/*
+ * The _id of the document that holds the in-progress/aborted xids for the partition.  The first
+ * partition keeps the name of the single document indices used to have
+ */
+char *aborted_xids_doc_id(int partition) {
+	if (partition == 0)
+		return pstrdup("zdb_aborted_xids");
+	return psprintf("zdb_aborted_xids_%d", partition);
+}
+
+char *aborted_xids_doc_ids_json(void) {
+	StringInfo ids = makeStringInfo();
+	int        i;
+
+	appendStringInfoChar(ids, '[');
+	for (i = 0; i < ZDB_ABORTED_XIDS_PARTITIONS; i++) {
+		if (i > 0) appendStringInfoChar(ids, ',');
+		appendStringInfo(ids, "\"%s\"", aborted_xids_doc_id(i));
+	}
+	appendStringInfoChar(ids, ']');
+
+	return ids->data;
+}
+
 char *ElasticsearchArbitraryRequest(Relation indexRel, char *method, char *endpoint, StringInfo postData) {
 	StringInfo request = makeStringInfo();
 
@@ -119,6 +169,7 @@ char *ElasticsearchCreateIndex(Relation heapRel, Relation indexRel, TupleDesc tu
 	StringInfo settings   = makeStringInfo();
 	StringInfo mapping    = generate_mapping(heapRel, tupdesc);
 	StringInfo response;
+	int        i;
 
 	if (ZDBIndexOptionsGetIndexName(indexRel) != NULL) {
 		elog(LOG, "[zombodb] Reusing index with name '%s'", ZDBIndexOptionsGetIndexName(indexRel));
@@ -192,6 +243,30 @@ char *ElasticsearchCreateIndex(Relation heapRel, Relation indexRel, TupleDesc tu
 
 	/* secondly, create the new index */
 	response = rest_call("PUT", request, settings, ZDBIndexOptionsGetCompressionLevel(indexRel));
+	freeStringInfo(response);
+
+	/*
+	 * and finally, the (empty) documents that track its in-progress/aborted xids, so writers
+	 * only ever need to update them
+	 */
+	resetStringInfo(settings);
+	for (i = 0; i < ZDB_ABORTED_XIDS_PARTITIONS; i++) {
+		appendStringInfo(settings, "{\"create\":{\"_id\":\"%s\"}}\n", aborted_xids_doc_id(i));
+		appendStringInfo(settings, "{\"zdb_aborted_xids\":[]}\n");
+	}
+
+	resetStringInfo(request);
+	appendStringInfo(request, "%s%s/%s/_bulk?filter_path=%s", ZDBIndexOptionsGetUrl(indexRel), indexName,
+					 ZDBIndexOptionsGetTypeName(indexRel), ES_BULK_RESPONSE_FILTER);
+	response = rest_call("POST", request, settings, ZDBIndexOptionsGetCompressionLevel(indexRel));
+
+	/* every one of them has to exist, or writers' updates to them will fail */
+	if (strstr(response->data, "\"errors\":false") == NULL) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+						errmsg("[zombodb] unable to create the aborted xids documents for %s: %s",
+							   RelationGetRelationName(indexRel), response->data)));
+	}
 
 	freeStringInfo(mapping);
 	freeStringInfo(settings);
@@ -247,6 +322,17 @@ void ElasticsearchFinalizeIndexCreation(Relation indexRel) {
 	freeStringInfo(response);
 }
 
+void ElasticsearchRefreshIndex(Relation indexRel) {
+	StringInfo request = makeStringInfo();
+	StringInfo response;
+
+	appendStringInfo(request, "%s%s/_refresh", ZDBIndexOptionsGetUrl(indexRel), ZDBIndexOptionsGetIndexName(indexRel));
+	response = rest_call("GET", request, NULL, ZDBIndexOptionsGetCompressionLevel(indexRel));
+
+	freeStringInfo(request);
+	freeStringInfo(response);
+}
+
 void ElasticsearchUpdateSettings(Relation indexRel, char *oldAlias, char *newAlias) {
 	if (oldAlias == NULL)
 		oldAlias = make_alias_name(indexRel, true);
@@ -302,6 +388,40 @@ void ElasticsearchPutMapping(Relation heapRel, Relation indexRel, TupleDesc tupd
 	freeStringInfo(response);
 }
 
+/*
+ * The type 'fieldname' is mapped as in the index, or NULL if the index doesn't map it
+ */
+char *ElasticsearchGetFieldType(Relation indexRel, char *fieldname) {
+	StringInfo request;
+	StringInfo response;
+	char       *type = NULL;
+	char       *start;
+
+	/* it goes into the url and the filter_path as-is */
+	if (fieldname[strspn(fieldname, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_")] != '\0')
+		return NULL;
+
+	request = makeStringInfo();
+	appendStringInfo(request, "%s%s/_mapping/%s/field/%s?filter_path=*.mappings.*.*.mapping.*.type",
+					 ZDBIndexOptionsGetUrl(indexRel), ZDBIndexOptionsGetIndexName(indexRel),
+					 ZDBIndexOptionsGetTypeName(indexRel), fieldname);
+	response = rest_call("GET", request, NULL, ZDBIndexOptionsGetCompressionLevel(indexRel));
+
+	start = strstr(response->data, "\"type\":\"");
+	if (start != NULL) {
+		char *end;
+
+		start += strlen("\"type\":\"");
+		end = strchr(start, '"');
+		if (end != NULL)
+			type = pnstrdup(start, end - start);
+	}
+
+	freeStringInfo(request);
+	freeStringInfo(response);
+	return type;
+}
+
 
 ElasticsearchBulkContext *ElasticsearchStartBulkProcess(Relation indexRel, char *indexName, TupleDesc tupdesc, bool ignore_version_conflicts) {
 	ElasticsearchBulkContext *context = palloc0(sizeof(ElasticsearchBulkContext));
@@ -317,18 +437,31 @@ ElasticsearchBulkContext *ElasticsearchStartBulkProcess(Relation indexRel, char
 	}
 
 	context->url                    = pstrdup(ZDBIndexOptionsGetUrl(indexRel));
+	context->urlSpec                = pstrdup(ZDBIndexOptionsGetUrlSpec(indexRel));
 	context->pgIndexName            = pstrdup(RelationGetRelationName(indexRel));
 	context->esIndexName            = pstrdup(indexName);
 	context->typeName               = pstrdup(ZDBIndexOptionsGetTypeName(indexRel));
 	context->batchSize              = ZDBIndexOptionsGetBatchSize(indexRel);
+	context->maxBatchSize           = context->batchSize;
+	context->minBatchSize           = Min(context->batchSize, BULK_MIN_BATCH_SIZE);
 	context->bulkConcurrency        = ZDBIndexOptionsGetBulkConcurrency(indexRel);
+	context->concurrency            = context->bulkConcurrency;
 	context->compressionLevel       = ZDBIndexOptionsGetCompressionLevel(indexRel);
 	context->shouldRefresh          = strcmp("-1", ZDBIndexOptionsGetRefreshInterval(indexRel)) == 0;
 	context->ignoreVersionConflicts = ignore_version_conflicts;
+	context->trackTransactions      = true;
+	context->smile                  = strcmp("smile", ZDBIndexOptionsGetBulkFormat(indexRel)) == 0;
+	context->memcxt                 = CurrentMemoryContext;
 	context->rest                   = rest_multi_init(context->bulkConcurrency, ignore_version_conflicts);
 
-	for (i = 0; i < context->bulkConcurrency + 1; i++)
-		context->pool[i] = makeStringInfo();
+	for (i = 0; i < context->bulkConcurrency + 1; i++) {
+		context->pool[i] = rest_postdata_create(i, context->compressionLevel);
+
+		if (context->smile) {
+			context->pool[i]->contentType = "application/smile";
+			context->pool[i]->separator   = (char) SMILE_END_OF_CONTENT;
+		}
+	}
 
 	context->rest->pool          = context->pool;
 	context->current             = checkout_batch_pool(context);
@@ -352,10 +485,11 @@ static inline void mark_transaction_in_progress(ElasticsearchBulkContext *contex
 	uint64 xid = convert_xid(curr_xid);
 
 	appendStringInfo(context->current->buff,
-					 "{\"update\":{\"_id\":\"zdb_aborted_xids\",\"_retry_on_conflict\":128}}\n");
+					 "{\"update\":{\"_id\":\"%s\",\"_retry_on_conflict\":128}}\n",
+					 aborted_xids_doc_id(ZDB_ABORTED_XIDS_PARTITION(xid)));
 	appendStringInfo(context->current->buff,
 					 "{\"upsert\":{\"zdb_aborted_xids\":[%lu]},"
-					 "\"script\":{\"source\":\"ctx._source.zdb_aborted_xids.add(params.XID);\",\"lang\":\"painless\",\"params\":{\"XID\":%lu}}}\n",
+					 "\"script\":{\"source\":\"if (!ctx._source.zdb_aborted_xids.contains(params.XID)) { ctx._source.zdb_aborted_xids.add(params.XID); } else { ctx.op='none'; }\",\"lang\":\"painless\",\"params\":{\"XID\":%lu}}}\n",
 					 xid, xid);
 
 	context->nxid++;
@@ -382,50 +516,261 @@ static inline void remember_curr_xid(ElasticsearchBulkContext *context) {
 	}
 }
 
+/*
+ * Additive-increase/multiplicative-decrease control of our batch size and concurrency.
+ *
+ * Whenever Elasticsearch rejects a request (or items in one) because it's too busy, or a
+ * request takes much longer than they have been, we halve both.  Otherwise they grow back
+ * towards the index's configured batch_size and bulk_concurrency, one step per request
+ */
+static void adapt_to_backpressure(ElasticsearchBulkContext *context) {
+	MultiRestState *rest       = context->rest;
+	uint64         ncompleted = rest->ncompleted - context->lastCompleted;
+	uint64         nrejected  = rest->nrejected - context->lastRejected;
+	double         latency;
+
+	if (ncompleted == 0)
+		return;
+
+	latency = (rest->total_seconds - context->lastSeconds) / ncompleted;
+	context->lastCompleted = rest->ncompleted;
+	context->lastRejected  = rest->nrejected;
+	context->lastSeconds   = rest->total_seconds;
+
+	if (nrejected > 0 || (context->avgLatency > 0 && latency > context->avgLatency * BULK_SLOW_LATENCY_FACTOR)) {
+		/*
+		 * only back off once for requests that were already in flight when we last did,
+		 * as they couldn't have benefited from it
+		 */
+		if (rest->ncompleted >= context->nextBackoff) {
+			context->batchSize   = Max(context->batchSize / 2, context->minBatchSize);
+			context->concurrency = Max(context->concurrency / 2, 1);
+			context->nextBackoff = rest->ncompleted + (rest->nhandles - rest->available);
+
+			elog(ZDB_LOG_LEVEL, "[zombodb] backing off %s:  batch_size=%d, concurrency=%d, rejected=%lu, latency=%.3fs",
+				 context->pgIndexName, context->batchSize, context->concurrency, nrejected, latency);
+		}
+	} else {
+		context->batchSize   = Min(context->batchSize + Max(context->maxBatchSize / 8, 1), context->maxBatchSize);
+		context->concurrency = Min(context->concurrency + 1, context->bulkConcurrency);
+	}
+
+	rest->limit = context->concurrency;
+	context->avgLatency = context->avgLatency == 0 ? latency : context->avgLatency * 0.8 + latency * 0.2;
+}
+
+/*
+ * When sending SMILE, the action lines (and the documents of anything other than
+ * ElasticsearchBulkInsertRecord()) are still written as json, and get transcoded here
+ */
+static void transcode_pending_lines(ElasticsearchBulkContext *context) {
+	StringInfo buff = context->current->buff;
+
+	if (context->smile && buff->len > context->smileStart) {
+		int  len  = buff->len - context->smileStart;
+		char *json = palloc(len);
+
+		memcpy(json, buff->data + context->smileStart, len);
+		buff->len = context->smileStart;
+		smile_append_json_lines(buff, json, len);
+		pfree(json);
+	}
+
+	context->smileStart = buff->len;
+}
+
+/*
+ * Send what's in context->current as a _bulk request.  Unless it's the final request, a new
+ * PostDataEntry is checked out for the rows that come after it
+ */
+static void send_current_batch(ElasticsearchBulkContext *context, bool is_final) {
+	StringInfo request = makeStringInfo();
+
+	/*
+	 * once Elasticsearch has rejected some of our items, we ask for every item's status, so
+	 * that only the rejected ones need to be sent again
+	 */
+	appendStringInfo(request, "%s%s/%s/_bulk?filter_path=%s", context->url, context->esIndexName, context->typeName,
+					 context->rest->nrejected > 0 ? ES_BULK_STATUS_RESPONSE_FILTER : ES_BULK_RESPONSE_FILTER);
+	if (context->waitForActiveShards)
+		appendStringInfo(request, "&wait_for_active_shards=all");
+
+	/* with the refresh coordinator, even a single request's refresh is shared with other backends */
+	if (is_final && context->shouldRefresh && context->nrequests == 0 && !refresh_coordinator_enabled() &&
+		!context->xmaxByQueryRefresh)
+		appendStringInfo(request, "&refresh=true");
+
+	transcode_pending_lines(context);
+	rest_multi_call(context->rest, "POST", request, context->current, context->compressionLevel);
+	freeStringInfo(request);
+
+	context->nrows = 0;
+	context->nrequests++;
+
+	if (!is_final) {
+		context->current = checkout_batch_pool(context);
+	}
+}
+
 static inline void bulk_prologue(ElasticsearchBulkContext *context, bool is_final) {
 	if (rest_multi_perform(context->rest))
 		rest_multi_partial_cleanup(context->rest, false, true);
 
-	if (!is_final)
-		remember_curr_xid(context);
+	adapt_to_backpressure(context);
 
-	if (context->current->buff->len >= context->batchSize || context->nrows == MAX_DOCS_PER_REQUEST || is_final) {
-		StringInfo request = makeStringInfo();
+	if (!is_final && context->trackTransactions)
+		remember_curr_xid(context);
 
+	if (PostDataEntryLength(context->current) >= context->batchSize || context->nrows == MAX_DOCS_PER_REQUEST || is_final) {
 		if (!is_final) {
 			elog(ZDB_LOG_LEVEL,
-				 "[zombodb] processed %d rows in %s (nbytes=%d, nrows=%d, active=%d of %d)",
+				 "[zombodb] processed %d rows in %s (nbytes=%ld, nrows=%d, active=%d of %d)",
 				 context->ntotal,
 				 context->pgIndexName,
-				 context->current->buff->len,
+				 PostDataEntryLength(context->current),
 				 context->nrows,
 				 context->bulkConcurrency - context->rest->available,
-				 context->bulkConcurrency);
+				 context->concurrency);
 		}
 
-		appendStringInfo(request, "%s%s/%s/_bulk?filter_path=%s", context->url, context->esIndexName, context->typeName,
-						 ES_BULK_RESPONSE_FILTER);
-		if (context->waitForActiveShards)
-			appendStringInfo(request, "&wait_for_active_shards=all");
+		send_current_batch(context, is_final);
+	}
+}
 
-		if (is_final && context->shouldRefresh && context->nrequests == 0)
-			appendStringInfo(request, "&refresh=true");
+static inline void bulk_epilogue(ElasticsearchBulkContext *context) {
+	transcode_pending_lines(context);
+	rest_postdata_compress(context->current);
+	context->smileStart = context->current->buff->len;
 
-		rest_multi_call(context->rest, "POST", request, context->current, context->compressionLevel);
-		freeStringInfo(request);
+	context->nrows++;
+	context->ntotal++;
+}
 
-		context->nrows = 0;
-		context->nrequests++;
+/*
+ * The first line is telling Elasticsearch that we intend to index a document.
+ *
+ * We don't specify _index or _type because they're already in our request URL.
+ * We use the ctid as the _id, and if we don't have one (via the low-level API) we let
+ * Elasticsearch autogenerate one for us
+ */
+static inline void append_index_action(ElasticsearchBulkContext *context, ItemPointerData *ctid) {
+	if (ctid != NULL) {
+		appendStringInfo(context->current->buff, "{\"index\":{\"_id\":\"%lu\"}}\n", ItemPointerToUint64(ctid));
+	} else {
+		/* Elasticsearch makes up a new _id each time this is sent */
+		appendStringInfo(context->current->buff, "{\"index\":{}}\n");
+		context->current->replayable = false;
+	}
+}
 
-		if (!is_final) {
-			context->current = checkout_batch_pool(context);
-		}
+static inline void append_index_action_smile(ElasticsearchBulkContext *context, ItemPointerData *ctid) {
+	StringInfo buff = context->current->buff;
+
+	smile_append_header(buff);
+	smile_append_token(buff, SMILE_START_OBJECT);
+	smile_append_key(buff, "index", 5);
+	smile_append_token(buff, SMILE_START_OBJECT);
+	if (ctid != NULL) {
+		char id[32];
+
+		snprintf(id, sizeof(id), "%lu", ItemPointerToUint64(ctid));
+		smile_append_key(buff, "_id", 3);
+		smile_append_string(buff, id, (int) strlen(id));
+	} else {
+		context->current->replayable = false;
 	}
+	smile_append_token(buff, SMILE_END_OBJECT);
+	smile_append_token(buff, SMILE_END_OBJECT);
+	smile_append_token(buff, SMILE_END_OF_CONTENT);
 }
 
-static inline void bulk_epilogue(ElasticsearchBulkContext *context) {
-	context->nrows++;
-	context->ntotal++;
+/*
+ * the document itself has been written, less its closing brace, and now we tack on
+ * our zdb_ctid, cmin/cmax, and xmin/xmax properties and finish off the line
+ */
+static inline void append_zdb_properties(ElasticsearchBulkContext *context, bool needsep, ItemPointerData *ctid, CommandId cmin, CommandId cmax, uint64 xmin, uint64 xmax) {
+	if (needsep)
+		appendStringInfoChar(context->current->buff, ',');
+
+	if (ctid != NULL)
+		appendStringInfo(context->current->buff, "\"zdb_ctid\":%lu,", ItemPointerToUint64(ctid));
+
+	/* ...and cmin/cmax */
+	appendStringInfo(context->current->buff, "\"zdb_cmin\":%u", cmin);
+	if (cmax != InvalidCommandId)
+		appendStringInfo(context->current->buff, ",\"zdb_cmax\":%u", cmax);
+
+	/* ...and xmin/xmax */
+	appendStringInfo(context->current->buff, ",\"zdb_xmin\":%lu", xmin);
+	if (xmax != InvalidTransactionId)
+		appendStringInfo(context->current->buff, ",\"zdb_xmax\":%lu", xmax);
+
+	appendStringInfo(context->current->buff, "}\n");
+}
+
+static inline void append_zdb_properties_smile(ElasticsearchBulkContext *context, ItemPointerData *ctid, CommandId cmin, CommandId cmax, uint64 xmin, uint64 xmax) {
+	StringInfo buff = context->current->buff;
+
+	if (ctid != NULL) {
+		smile_append_key(buff, "zdb_ctid", 8);
+		smile_append_int64(buff, (int64) ItemPointerToUint64(ctid));
+	}
+
+	smile_append_key(buff, "zdb_cmin", 8);
+	smile_append_int64(buff, (int64) cmin);
+	if (cmax != InvalidCommandId) {
+		smile_append_key(buff, "zdb_cmax", 8);
+		smile_append_int64(buff, (int64) cmax);
+	}
+
+	smile_append_key(buff, "zdb_xmin", 8);
+	smile_append_int64(buff, (int64) xmin);
+	if (xmax != InvalidTransactionId) {
+		smile_append_key(buff, "zdb_xmax", 8);
+		smile_append_int64(buff, (int64) xmax);
+	}
+
+	smile_append_token(buff, SMILE_END_OBJECT);
+	smile_append_token(buff, SMILE_END_OF_CONTENT);
+}
+
+/*
+ * Index a record (a composite Datum) by encoding it as json directly into the current
+ * batch buffer.  Any garbage left behind by the encoding process is allocated in 'scratch',
+ * which the caller should reset when convenient
+ */
+void ElasticsearchBulkInsertRecord(ElasticsearchBulkContext *context, MemoryContext scratch, ItemPointerData *ctid, Datum record, CommandId cmin, CommandId cmax, uint64 xmin, uint64 xmax) {
+	MemoryContext oldContext;
+	bool          needsep;
+
+	bulk_prologue(context, false);
+
+	oldContext = MemoryContextSwitchTo(scratch);
+
+	/* the plan is built once and lives as long as we do */
+	if (context->encoderPlan == NULL || !row_encoder_plan_matches(context->encoderPlan, record))
+		context->encoderPlan = row_encoder_create_plan(record, context->memcxt);
+
+	if (context->smile) {
+		/* anything prologue wrote is json, so deal with that before we write SMILE directly */
+		transcode_pending_lines(context);
+
+		append_index_action_smile(context, ctid);
+		smile_append_header(context->current->buff);
+		(void) row_encoder_encode_smile(context->encoderPlan, context->current->buff, record);
+		append_zdb_properties_smile(context, ctid, cmin, cmax, xmin, xmax);
+
+		context->smileStart = context->current->buff->len;
+	} else {
+		append_index_action(context, ctid);
+		needsep = row_encoder_encode(context->encoderPlan, context->current->buff, record);
+		append_zdb_properties(context, needsep, ctid, cmin, cmax, xmin, xmax);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	context->nindex++;
+	bulk_epilogue(context);
 }
 
 void ElasticsearchBulkInsertRow(ElasticsearchBulkContext *context, ItemPointerData *ctid, text *json, CommandId cmin, CommandId cmax, uint64 xmin, uint64 xmax) {
@@ -447,38 +792,11 @@ void ElasticsearchBulkInsertRow(ElasticsearchBulkContext *context, ItemPointerDa
 	if (context->containsJson)
 		replace_line_breaks(as_string, len, ' ');
 
-	/*
-	 * The first line is telling Elasticsearch that we intend to index a document.
-	 *
-	 * We don't specify _index or _type because they're already in our request URL,
-	 * and we don't specify an _id because we let Elasticsearch autogenerate one for us --
-	 * we'll never use the _id for ourselves, so we don't care what it is
-	 */
-	if (ctid != NULL) {
-		appendStringInfo(context->current->buff, "{\"index\":{\"_id\":\"%lu\"}}\n", ItemPointerToUint64(ctid));
-	} else {
-		appendStringInfo(context->current->buff, "{\"index\":{}}\n");
-	}
+	append_index_action(context, ctid);
 
 	/* the second line is the json form of the document... */
 	appendBinaryStringInfo(context->current->buff, strip_json_ending(as_string, len), len);
-
-	if (ctid != NULL) {
-		/* ...but we tack on our zdb_ctid property */
-		appendStringInfo(context->current->buff, ",\"zdb_ctid\":%lu", ItemPointerToUint64(ctid));
-	}
-
-	/* ...and cmin/cmax */
-	appendStringInfo(context->current->buff, ",\"zdb_cmin\":%u", cmin);
-	if (cmax != InvalidCommandId)
-		appendStringInfo(context->current->buff, ",\"zdb_cmax\":%u", cmax);
-
-	/* ...and xmin/xmax */
-	appendStringInfo(context->current->buff, ",\"zdb_xmin\":%lu", xmin);
-	if (xmax != InvalidTransactionId)
-		appendStringInfo(context->current->buff, ",\"zdb_xmax\":%lu", xmax);
-
-	appendStringInfo(context->current->buff, "}\n");
+	append_zdb_properties(context, true, ctid, cmin, cmax, xmin, xmax);
 
 	if (possible_copy != json)
 		pfree(possible_copy);
@@ -488,23 +806,197 @@ void ElasticsearchBulkInsertRow(ElasticsearchBulkContext *context, ItemPointerDa
 	bulk_epilogue(context);
 }
 
-void ElasticsearchBulkUpdateTuple(ElasticsearchBulkContext *context, ItemPointer ctid, char *llapi_id, CommandId cmax, uint64 xmax) {
-	bulk_prologue(context, false);
+/*
+ * the second line of an update action that sets a document's cmax/xmax.  It's a partial document
+ * rather than a script so that Elasticsearch doesn't need to compile and run anything
+ */
+static inline void append_xmax_doc(ElasticsearchBulkContext *context, CommandId cmax, uint64 xmax) {
+	appendStringInfo(context->current->buff, "{\"doc\":{\"zdb_cmax\":%u,\"zdb_xmax\":%lu}}\n", cmax, xmax);
+}
+
+/*
+ * The value of a top-level integer property in a json response
+ */
+static uint64 json_uint64_field(StringInfo response, char *field) {
+	Datum value = DirectFunctionCall2(json_object_field_text, CStringGetTextDatum(response->data),
+									  CStringGetTextDatum(field));
+
+	return DatumGetUInt64(DirectFunctionCall1(int8in, PointerGetDatum(TextDatumGetCString(value))));
+}
+
+/*
+ * Stamp a large set of pending ctids with their xmax in one _update_by_query request.
+ *
+ * It can only find documents that are searchable, so everything we've queued before them
+ * is sent and, if any of it hasn't been refreshed yet, the index is refreshed first.  The
+ * refresh that makes the stamps themselves visible is left to ElasticsearchFinishBulkProcess().
+ *
+ * Documents something else changed while the query ran are version conflicts, and those that
+ * still aren't stamped are found and updated again by the next attempt
+ */
+static void update_xmax_by_query(ElasticsearchBulkContext *context, int nctids) {
+	StringInfo request  = makeStringInfo();
+	StringInfo postData = makeStringInfo();
+	StringInfo refresh  = makeStringInfo();
+	uint64     updated  = 0;
+	int        attempts = 0;
+	int        i;
+
+	/* send what's queued, without finishing this bulk process, and wait for all of it */
+	if (PostDataEntryLength(context->current) > 0)
+		send_current_batch(context, false);
+	if (context->rest->available < context->rest->nhandles) {
+		rest_multi_wait_for_all_done(context->rest);
+		rest_multi_partial_cleanup(context->rest, false, false);
+	}
+
+	appendStringInfo(refresh, "%s%s/_refresh", context->url, context->esIndexName);
+	if (context->nrequests > 0 || context->xmaxByQueryRefresh || !context->shouldRefresh) {
+		freeStringInfo(rest_call("GET", refresh, NULL, context->compressionLevel));
+
+		/* what we've sent is refreshed, so the final refresh only needs to be for what's sent after it */
+		context->nrequests          = 0;
+		context->xmaxByQueryRefresh = false;
+	}
+
+	/* the documents with these ctids that aren't already stamped with this cmax/xmax */
+	appendStringInfo(postData, "{\"query\":{\"bool\":{\"filter\":{\"terms\":{\"zdb_ctid\":[");
+	for (i = 0; i < nctids; i++) {
+		if (i > 0)
+			appendStringInfoChar(postData, ',');
+		appendStringInfo(postData, "%lu", context->xmaxCtids[i]);
+	}
+	appendStringInfo(postData, "]}},"
+							   "\"must_not\":{\"bool\":{\"filter\":["
+							   "{\"term\":{\"zdb_cmax\":%u}},"
+							   "{\"term\":{\"zdb_xmax\":%lu}}"
+							   "]}}}},"
+							   "\"script\":{\"source\":\""
+							   "ctx._source.zdb_cmax=params.CMAX;"
+							   "ctx._source.zdb_xmax=params.XMAX;\",\"lang\":\"painless\",\"params\":{\"CMAX\":%u,\"XMAX\":%lu}}}",
+					 context->xmaxCmax, context->xmaxXid, context->xmaxCmax, context->xmaxXid);
+
+	appendStringInfo(request, "%s%s/%s/_update_by_query?conflicts=proceed", context->url, context->esIndexName, context->typeName);
+
+	while (true) {
+		StringInfo response = rest_call("POST", request, postData, context->compressionLevel);
+		uint64     conflicts;
+
+		if (strstr(response->data, "\"failures\":[]") == NULL)
+			elog(ERROR, "[zombodb] _update_by_query failed: %s", response->data);
+
+		updated += json_uint64_field(response, "updated");
+		conflicts = json_uint64_field(response, "version_conflicts");
+		freeStringInfo(response);
+
+		if (conflicts == 0)
+			break;
+		else if (++attempts == XMAX_BY_QUERY_MAX_ATTEMPTS)
+			ereport(ERROR,
+					(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
+							errmsg("[zombodb] _update_by_query still had %lu version conflicts in %s after %d attempts",
+								   conflicts, context->pgIndexName, attempts)));
+
+		/* the documents we did update are refreshed so that the next attempt doesn't find them again */
+		freeStringInfo(rest_call("GET", refresh, NULL, context->compressionLevel));
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (updated != (uint64) nctids) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+						errmsg("[zombodb] expected to update %d documents in %s but updated %lu", nctids,
+							   context->pgIndexName, updated)));
+	}
+
+	context->xmaxByQueryRefresh = true;
+	elog(ZDB_LOG_LEVEL, "[zombodb] updated xmax of %d rows in %s via _update_by_query", nctids, context->pgIndexName);
+
+	freeStringInfo(refresh);
+	freeStringInfo(postData);
+	freeStringInfo(request);
+}
+
+/*
+ * Send the xmax stamps ElasticsearchBulkUpdateTuple() has accumulated
+ */
+static void flush_pending_xmax(ElasticsearchBulkContext *context) {
+	int nctids = context->nxmaxCtids;
+	int i;
+
+	if (nctids == 0)
+		return;
+
+	context->nxmaxCtids = 0;
+	context->nupdate += nctids;
+
+	if (nctids >= XMAX_BY_QUERY_THRESHOLD) {
+		update_xmax_by_query(context, nctids);
+		return;
+	}
+
+	for (i = 0; i < nctids; i++) {
+		bulk_prologue(context, false);
 
-	if (ctid != NULL) {
 		appendStringInfo(context->current->buff, "{\"update\":{\"_id\":\"%lu\",\"_retry_on_conflict\":1}}\n",
-						 ItemPointerToUint64(ctid));
-	} else {
+						 context->xmaxCtids[i]);
+		append_xmax_doc(context, context->xmaxCmax, context->xmaxXid);
+
+		bulk_epilogue(context);
+	}
+}
+
+/*
+ * Mark the current transaction as in-progress in the index, ahead of a document
+ * being stamped with its xid later on, once it might no longer be the current one
+ */
+void ElasticsearchBulkMarkCurrentXid(ElasticsearchBulkContext *context) {
+	if (context->trackTransactions)
+		remember_curr_xid(context);
+}
+
+/*
+ * Set the cmax/xmax of the document for a row being UPDATEd or DELETEd.
+ *
+ * Rows identified by ctid aren't sent right away.  They're accumulated for as long as the
+ * cmax/xmax stays the same, which is at least the remainder of the statement, and sent
+ * when that changes or the bulk process is finished
+ */
+void ElasticsearchBulkUpdateTuple(ElasticsearchBulkContext *context, ItemPointer ctid, char *llapi_id, CommandId cmax, uint64 xmax) {
+	if (ctid == NULL) {
+		bulk_prologue(context, false);
+
 		appendStringInfo(context->current->buff, "{\"update\":{\"_id\":\"%s\",\"_retry_on_conflict\":1}}\n", llapi_id);
+		append_xmax_doc(context, cmax, xmax);
+
+		context->nupdate++;
+		bulk_epilogue(context);
+		return;
 	}
-	appendStringInfo(context->current->buff,
-					 "{\"script\":{\"source\":\""
-					 "ctx._source.zdb_cmax=params.CMAX;"
-					 "ctx._source.zdb_xmax=params.XMAX;\",\"lang\":\"painless\",\"params\":{\"CMAX\":%u,\"XMAX\":%lu}}}\n",
-					 cmax, xmax);
 
-	context->nupdate++;
-	bulk_epilogue(context);
+	if (context->nxmaxCtids > 0 && (context->xmaxCmax != cmax || context->xmaxXid != xmax))
+		flush_pending_xmax(context);
+
+	/* the xid we're stamping must be marked in-progress now, while it's still the current one */
+	if (context->trackTransactions)
+		remember_curr_xid(context);
+
+	if (context->nxmaxCtids == context->maxXmaxCtids) {
+		MemoryContext oldContext = MemoryContextSwitchTo(context->memcxt);
+
+		context->maxXmaxCtids = context->maxXmaxCtids == 0 ? 1024 : context->maxXmaxCtids * 2;
+		context->xmaxCtids    = context->xmaxCtids == NULL ? palloc(sizeof(uint64) * context->maxXmaxCtids)
+															: repalloc(context->xmaxCtids,
+																	   sizeof(uint64) * context->maxXmaxCtids);
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	context->xmaxCtids[context->nxmaxCtids++] = ItemPointerToUint64(ctid);
+	context->xmaxCmax = cmax;
+	context->xmaxXid  = xmax;
+
+	if (context->nxmaxCtids == MAX_PENDING_XMAX)
+		flush_pending_xmax(context);
 }
 
 void ElasticsearchBulkVacuumXmax(ElasticsearchBulkContext *context, char *_id, uint64 expected_xmax) {
@@ -564,15 +1056,36 @@ void ElasticsearchBulkDeleteRowByXmax(ElasticsearchBulkContext *context, char *_
 	bulk_epilogue(context);
 }
 
+/*
+ * Delete the document with the specified ctid, if it exists.  It's a scripted upsert so that
+ * a document that doesn't exist is a noop rather than an error
+ */
+void ElasticsearchBulkDeleteRow(ElasticsearchBulkContext *context, ItemPointer ctid) {
+	bulk_prologue(context, false);
+
+	appendStringInfo(context->current->buff, "{\"update\":{\"_id\":\"%lu\"}}\n", ItemPointerToUint64(ctid));
+	appendStringInfo(context->current->buff,
+					 "{\"scripted_upsert\":true,\"upsert\":{},\"script\":{\"source\":\""
+					 "if (ctx._source.isEmpty()) {"
+					 "   ctx.op='none';"
+					 "} else {"
+					 "   ctx.op='delete';"
+					 "}\",\"lang\":\"painless\"}}\n");
+
+	context->ndelete++;
+	bulk_epilogue(context);
+}
+
 static void mark_transaction_committed(ElasticsearchBulkContext *context, TransactionId which_xid) {
 	uint64 xid = convert_xid(which_xid);
 
 	appendStringInfo(context->current->buff,
-					 "{\"update\":{\"_id\":\"zdb_aborted_xids\",\"_retry_on_conflict\":128}}\n");
+					 "{\"update\":{\"_id\":\"%s\",\"_retry_on_conflict\":128}}\n",
+					 aborted_xids_doc_id(ZDB_ABORTED_XIDS_PARTITION(xid)));
 	appendStringInfo(context->current->buff, ""
 											 "{"
 											 "\"script\":{"
-											 "\"source\":\"ctx._source.zdb_aborted_xids.remove(ctx._source.zdb_aborted_xids.indexOf(params.XID));\","
+											 "\"source\":\"int idx = ctx._source.zdb_aborted_xids.indexOf(params.XID); if (idx >= 0) { ctx._source.zdb_aborted_xids.remove(idx); } else { ctx.op='none'; }\","
 											 "\"params\":{\"XID\":%lu},"
 											 "\"lang\":\"painless\""
 											 "}"
@@ -581,9 +1094,13 @@ static void mark_transaction_committed(ElasticsearchBulkContext *context, Transa
 }
 
 void ElasticsearchFinishBulkProcess(ElasticsearchBulkContext *context, bool is_commit) {
-	StringInfo request  = makeStringInfo();
+	StringInfo request;
 	bool       did_xids = false;
+	bool       did_send = false;
+
+	flush_pending_xmax(context);
 
+	request = makeStringInfo();
 	if (is_commit) {
 		if (context->rest->available == context->rest->nhandles) {
 			/*
@@ -609,9 +1126,10 @@ void ElasticsearchFinishBulkProcess(ElasticsearchBulkContext *context, bool is_c
 		}
 	}
 
-	if (context->current->buff->len > 0) {
+	if (PostDataEntryLength(context->current) > 0) {
 		/* we have more data to send to ES via curl */
 		bulk_prologue(context, true);
+		did_send = true;
 
 		/* we only want to log if we required more than 1 batch */
 		if (context->nrequests > 1) {
@@ -638,14 +1156,26 @@ void ElasticsearchFinishBulkProcess(ElasticsearchBulkContext *context, bool is_c
 
 	if (!is_commit) {
 		/* reset the context->rest struct so that this bulk process can still be used again */
-		context->rest       = rest_multi_init(context->bulkConcurrency, context->ignoreVersionConflicts);
-		context->rest->pool = context->pool;
+		context->rest        = rest_multi_init(context->bulkConcurrency, context->ignoreVersionConflicts);
+		context->rest->pool  = context->pool;
+		context->rest->limit = context->concurrency;
+		context->lastCompleted = context->lastRejected = context->nextBackoff = 0;
+		context->lastSeconds   = 0;
+
+		/* what we've sent is refreshed, so the next flush only needs to refresh for what's sent after it */
+		context->nrequests = 0;
+
+		/* the final request took our current PostDataEntry, which is now back in the pool */
+		if (did_send)
+			context->current = checkout_batch_pool(context);
 	}
 
-	if (is_commit && !did_xids) {
+	if (is_commit && !did_xids && context->usedXids != NIL &&
+		!group_commit_mark_committed(context->urlSpec, context->esIndexName, context->typeName,
+									 context->compressionLevel, context->usedXids)) {
 		/*
 		 * we couldn't mark transactions as committed above, so do it now that all outstanding
-		 * multi-rest calls are finished
+		 * multi-rest calls are finished, and without the help of other committing backends
 		 */
 		StringInfo endpoint = makeStringInfo();
 		ListCell   *lc;
@@ -660,12 +1190,19 @@ void ElasticsearchFinishBulkProcess(ElasticsearchBulkContext *context, bool is_c
 		rest_call("POST", endpoint, context->current->buff, context->compressionLevel);
 	}
 
-	if (context->shouldRefresh && context->nrequests > 1) {
-		/* we did more than 1 request, so force a full refresh across the entire index */
+	if (context->shouldRefresh &&
+		(context->nrequests > 1 || (context->nrequests == 1 && refresh_coordinator_enabled()) || context->xmaxByQueryRefresh) &&
+		!refresh_coordinator_refresh(context->urlSpec, context->esIndexName, context->compressionLevel)) {
+		/*
+		 * we did more than 1 request (or didn't ask the only one to refresh, or stamped xmaxes
+		 * with _update_by_query), so force a full refresh across the entire index, and do it
+		 * ourselves if it can't be shared with other backends
+		 */
 		resetStringInfo(request);
 		appendStringInfo(request, "%s%s/_refresh", context->url, context->esIndexName);
 		rest_call("GET", request, NULL, context->compressionLevel);
 	}
+	context->xmaxByQueryRefresh = false;
 
 	freeStringInfo(request);
 
@@ -714,40 +1251,415 @@ uint64 ElasticsearchEstimateSelectivity(Relation indexRel, ZDBQueryType *query)
 	return DatumGetUInt64(DirectFunctionCall1(int8in, PointerGetDatum(TextDatumGetCString(count))));
 }
 
+/*
+ * A scroll context Elasticsearch is keeping for us.  These are kept in TopMemoryContext so we
+ * can still clear them after an abort has taken the ElasticsearchScrollContexts with it
+ */
+typedef struct ScrollId {
+	char *urlSpec;  /* the 'url' option of its index, which identifies the cluster */
+	char *id;
+} ScrollId;
+
+static List *openScrolls    = NIL;  /* the scroll contexts our scans are still using */
+static List *scrollsToClear = NIL;  /* those they're finished with */
+
+/*
+ * Tell Elasticsearch to free the scroll contexts we're done with, with one request per cluster.
+ *
+ * This only happens as the transaction commits.  Each request is made in its own subtransaction
+ * so that its failure can be reported without failing the commit, except in a parallel worker,
+ * which can't start one
+ */
+static void send_scroll_clears(void) {
+	MemoryContext oldContext = CurrentMemoryContext;
+	ResourceOwner oldOwner   = CurrentResourceOwner;
+	List          *clears    = scrollsToClear;
+
+	scrollsToClear = NIL;
+
+	while (clears != NIL) {
+		ScrollId   *first   = linitial(clears);
+		char       *urlSpec = pstrdup(first->urlSpec);
+		StringInfo request  = makeStringInfo();
+		StringInfo postData = makeStringInfo();
+		StringInfo response;
+		List       *others  = NIL;
+		ListCell   *lc;
+
+		appendStringInfoString(postData, "{\"scroll_id\":[");
+		foreach (lc, clears) {
+			ScrollId *scroll = lfirst(lc);
+
+			if (strcmp(scroll->urlSpec, urlSpec) == 0) {
+				if (postData->data[postData->len - 1] != '[')
+					appendStringInfoChar(postData, ',');
+				appendStringInfo(postData, "\"%s\"", scroll->id);
+
+				pfree(scroll->urlSpec);
+				pfree(scroll->id);
+				pfree(scroll);
+			} else {
+				others = lappend(others, scroll);
+			}
+		}
+		appendStringInfoString(postData, "]}");
+		list_free(clears);
+		clears = others;
+
+		/* scrolls that have already expired come back as a 404, which is fine */
+		appendStringInfo(request, "%s_search/scroll", rest_nodes_base_url(urlSpec));
+
+		if (IsInParallelMode()) {
+			response = rest_call("DELETE", request, postData, 0);
+			freeStringInfo(response);
+		} else {
+			/*
+			 * Elasticsearch will expire them on its own anyways, so failing to clear them
+			 * isn't worth failing the transaction over
+			 */
+			BeginInternalSubTransaction(NULL);
+			MemoryContextSwitchTo(oldContext);
+
+			PG_TRY();
+					{
+						response = rest_call("DELETE", request, postData, 0);
+						freeStringInfo(response);
+
+						ReleaseCurrentSubTransaction();
+						MemoryContextSwitchTo(oldContext);
+						CurrentResourceOwner = oldOwner;
+					}
+				PG_CATCH();
+					{
+						ErrorData *edata;
+
+						MemoryContextSwitchTo(oldContext);
+						edata = CopyErrorData();
+						FlushErrorState();
+
+						RollbackAndReleaseCurrentSubTransaction();
+						MemoryContextSwitchTo(oldContext);
+						CurrentResourceOwner = oldOwner;
+
+						elog(WARNING, "[zombodb] unable to clear scroll contexts: %s", edata->message);
+						FreeErrorData(edata);
+					}
+			PG_END_TRY();
+		}
+
+		freeStringInfo(postData);
+		freeStringInfo(request);
+		pfree(urlSpec);
+	}
+}
+
+/* we're done with a scroll context, so queue it to be cleared when the transaction commits */
+static void clear_scroll(ScrollId *scroll) {
+	MemoryContext oldContext;
+
+	if (!list_member_ptr(openScrolls, scroll))
+		return; /* the transaction that opened it already took care of it */
+
+	oldContext     = MemoryContextSwitchTo(TopMemoryContext);
+	openScrolls    = list_delete_ptr(openScrolls, scroll);
+	scrollsToClear = lappend(scrollsToClear, scroll);
+	MemoryContextSwitchTo(oldContext);
+}
+
+/*
+ * Keep track of the Elasticsearch scroll context behind a page we've just received.  Once we
+ * have its last page, it can be cleared
+ */
+static void track_scroll(ElasticsearchScrollContext *context) {
+	ScrollId *scroll = (ScrollId *) context->openScroll;
+
+	if (context->scrollId == NULL)
+		return; /* it wasn't a scroll */
+
+	if (scroll != NULL && !list_member_ptr(openScrolls, scroll))
+		scroll = NULL;  /* the transaction that opened it already took care of it */
+
+	if (scroll == NULL) {
+		MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+		scroll              = palloc(sizeof(ScrollId));
+		scroll->urlSpec     = pstrdup(context->urlSpec);
+		scroll->id          = pstrdup(context->scrollId);
+		openScrolls         = lappend(openScrolls, scroll);
+		context->openScroll = scroll;
+		MemoryContextSwitchTo(oldContext);
+	} else if (strcmp(scroll->id, context->scrollId) != 0) {
+		pfree(scroll->id);
+		scroll->id = MemoryContextStrdup(TopMemoryContext, context->scrollId);
+	}
+
+	if (context->cnt + context->nhits >= context->total) {
+		context->openScroll = NULL;
+		clear_scroll(scroll);
+	}
+}
+
+/*
+ * Called before the transaction commits to clear every scroll context we've finished with,
+ * including any whose scans didn't run to completion
+ */
+void ElasticsearchClearScrolls(void) {
+	ElasticsearchAbandonScrolls();
+
+	if (scrollsToClear != NIL)
+		send_scroll_clears();
+}
+
+/*
+ * Called when the transaction aborts.  The scroll contexts our scans were using are queued
+ * to be cleared, which happens when we next commit
+ */
+void ElasticsearchAbandonScrolls(void) {
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	scrollsToClear = list_concat(scrollsToClear, openScrolls);
+	openScrolls    = NIL;
+	MemoryContextSwitchTo(oldContext);
+}
+
+/*
+ * The request for the page of a search_after paged search that follows the hits we have
+ */
+static StringInfo make_search_after_request(ElasticsearchScrollContext *context, char *url, uint64 size, StringInfo postData) {
+	StringInfo           request = makeStringInfo();
+	SearchResponseParser *parser = context->parser;
+	char                 *sort   = parser->nhits > 0 ? parser->hits[parser->nhits - 1].sort : NULL;
+
+	if (parser->nhits > 0 && sort == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+						errmsg("No sort values found for the last hit of a search_after page")));
+
+	appendStringInfoString(postData, context->searchBody);
+	if (sort != NULL)
+		appendStringInfo(postData, ",\"search_after\":%s", sort);
+	appendStringInfoCharMacro(postData, '}');
+	appendStringInfo(request, "%s&size=%lu", url, size);
+	return request;
+}
+
+static StringInfo make_scroll_request(ElasticsearchScrollContext *context, StringInfo postData) {
+	StringInfo request;
+
+	if (context->searchUrl != NULL) {
+		uint64 remaining = context->total - (context->cnt + context->nhits - context->currpos);
+
+		return make_search_after_request(context, context->searchUrl, Min(MAX_DOCS_PER_REQUEST, remaining),
+										 postData);
+	}
+
+	request = makeStringInfo();
+	appendStringInfo(postData, "{\"scroll\":\"%ds\",\"scroll_id\":\"%s\"}", zdb_scroll_keep_alive_guc,
+					 context->scrollId);
+	appendStringInfo(request, "%s_search/scroll?filter_path=%s", context->url, ES_SEARCH_RESPONSE_FILTER);
+	return request;
+}
+
+/*
+ * Now that we have a page of hits, ask for the next one, if there is one, so it can download
+ * while the caller works through this one.  Scroll requests have to be made one after the
+ * other, so there's only ever one page of lookahead.
+ *
+ * Not inside a subtransaction though, as the request would be abandoned if it rolled back,
+ * taking with it a page that a cursor fetching from the scroll afterwards still needs
+ */
+static void start_prefetch(ElasticsearchScrollContext *context) {
+	StringInfo request;
+	StringInfo postData;
+
+	if (!zdb_scroll_prefetch_guc || context->prefetchParser == NULL || IsSubTransaction() ||
+		context->cnt + context->nhits >= context->total || (context->scrollId == NULL && context->searchUrl == NULL))
+		return;
+
+	MemoryContextReset(context->prefetchMemoryContext);
+	search_response_reset(context->prefetchParser);
+
+	postData = makeStringInfo();
+	request  = make_scroll_request(context, postData);
+
+	context->prefetch = rest_async_call_streaming("POST", request, postData, context->compressionLevel,
+												  search_response_consume, context->prefetchParser);
+
+	freeStringInfo(request);
+	freeStringInfo(postData);
+}
+
+/*
+ * Replace the current page of hits with the next one, from the prefetch if there is one
+ */
+static void fetch_next_page(ElasticsearchScrollContext *context) {
+	StringInfo response;
+
+	if (context->prefetch != NULL) {
+		SearchResponseParser *parser       = context->parser;
+		MemoryContext        memoryContext = context->jsonMemoryContext;
+
+		response = rest_await(context->prefetch);
+		context->prefetch = NULL;
+		search_response_finish(context->prefetchParser, response);
+
+		/*
+		 * swap the buffers, so the next prefetch reuses what we had for the page we're done with,
+		 * keeping the prefetch's context a child of the current page's
+		 */
+		context->parser                = context->prefetchParser;
+		context->jsonMemoryContext     = context->prefetchMemoryContext;
+		context->prefetchParser        = parser;
+		context->prefetchMemoryContext = memoryContext;
+		MemoryContextSetParent(context->jsonMemoryContext, MemoryContextGetParent(memoryContext));
+		MemoryContextSetParent(memoryContext, context->jsonMemoryContext);
+	} else {
+		StringInfo postData = makeStringInfo();
+		StringInfo request  = make_scroll_request(context, postData);
+
+		/* make sure we don't leak the hits from the previous request, but keep the prefetch's context */
+		MemoryContextResetOnly(context->jsonMemoryContext);
+		search_response_reset(context->parser);
+
+		response = rest_call_streaming("POST", request, postData, context->compressionLevel,
+									   search_response_consume, context->parser);
+		search_response_finish(context->parser, response);
+
+		freeStringInfo(request);
+		freeStringInfo(postData);
+	}
+
+	context->scrollId = context->parser->scrollId;
+	context->currpos  = 0;
+	context->hits     = context->parser->hits;
+	context->nhits    = context->parser->nhits;
+	freeStringInfo(response);
+
+	track_scroll(context);
+	start_prefetch(context);
+}
+
+/*
+ * Replace the hits we have with the page of a search_after paged search that follows them
+ */
+static void fetch_search_after_page(ElasticsearchScrollContext *context, char *url, uint64 size) {
+	StringInfo postData = makeStringInfo();
+	StringInfo request  = make_search_after_request(context, url, size, postData);
+	StringInfo response;
+
+	MemoryContextResetOnly(context->jsonMemoryContext);
+	search_response_reset(context->parser);
+
+	response = rest_call_streaming("POST", request, postData, context->compressionLevel, search_response_consume,
+								   context->parser);
+	search_response_finish(context->parser, response);
+
+	freeStringInfo(request);
+	freeStringInfo(postData);
+	freeStringInfo(response);
+}
+
+/*
+ * Step over the first 'offset' hits of a search_after paged search and get the first page of
+ * hits after them.  Elasticsearch can't jump straight there, but the pages we step over only
+ * carry each hit's sort values, and each one only needs the sort values of the last hit of the
+ * page before it
+ */
+static void skip_to_offset(ElasticsearchScrollContext *context) {
+	uint64 skipped = context->parser->nhits;
+
+	while (skipped < context->offset && context->parser->nhits > 0) {
+		fetch_search_after_page(context, context->skipUrl, Min(MAX_DOCS_PER_REQUEST, context->offset - skipped));
+		skipped += context->parser->nhits;
+	}
+
+	if (skipped < context->offset) {
+		/* the hits ran out before we got there */
+		context->total = 0;
+		return;
+	}
+
+	fetch_search_after_page(context, context->searchUrl, Min(MAX_DOCS_PER_REQUEST, context->total));
+}
+
+/*
+ * search_after needs a sort that's unique for every hit, so break ties with the row's ctid
+ */
+static char *make_stable_sort(char *sortJson) {
+	char *end;
+
+	if (sortJson == NULL)
+		return pstrdup("[{\"_score\":\"desc\"},{\"zdb_ctid\":\"asc\"}]");
+
+	end = strrchr(sortJson, ']');
+	if (sortJson[0] == '[' && end != NULL)
+		return psprintf("%.*s,{\"zdb_ctid\":\"asc\"}]", (int) (end - sortJson), sortJson);
+	return psprintf("[%s,{\"zdb_ctid\":\"asc\"}]", sortJson);
+}
+
 ElasticsearchScrollContext *ElasticsearchOpenScroll(Relation indexRel, ZDBQueryType *userQuery, bool use_id, uint64 limit, List *highlights, char **extraFields, int nextraFields) {
+	ElasticsearchScrollContext *context;
+
+	context = ElasticsearchStartScroll(indexRel, userQuery, use_id, limit, highlights, extraFields, nextraFields, false);
+	ElasticsearchAwaitScroll(context);
+
+	return context;
+}
+
+/*
+ * ElasticsearchOpenScroll() for callers that want every hit, in no particular order, so the
+ * scroll can be sliced
+ */
+ElasticsearchScrollContext *ElasticsearchOpenSlicedScroll(Relation indexRel, ZDBQueryType *userQuery, bool use_id, List *highlights, char **extraFields, int nextraFields) {
+	ElasticsearchScrollContext *context;
+
+	context = ElasticsearchStartScroll(indexRel, userQuery, use_id, 0, highlights, extraFields, nextraFields, true);
+	ElasticsearchAwaitScroll(context);
+
+	return context;
+}
+
+/*
+ * Send the request for the first page of one scroll, or, if 'nslices' isn't zero, of one
+ * slice of a sliced scroll
+ */
+static ElasticsearchScrollContext *start_scroll(Relation indexRel, ZDBQueryType *userQuery, char *queryDSL, bool use_id, uint64 limit, List *highlights, char **extraFields, int nextraFields, int slice, int nslices) {
 	ElasticsearchScrollContext *context       = palloc0(sizeof(ElasticsearchScrollContext));
-    char                       *queryDSL;
 	StringInfo                 request        = makeStringInfo();
 	StringInfo                 postData       = makeStringInfo();
 	StringInfo                 docvalueFields = makeStringInfo();
-	StringInfo                 response;
+	StringInfo                 scrollParam    = makeStringInfo();
 	char                       *sortJson;
-	uint64                     queryLimit     = zdbquery_get_limit(userQuery);
 	bool                       needScore;
+	bool                       searchAfter;
 	uint64                     offset;
 	double                     min_score;
-	void                       *jsonResponse, *hitsObject;
-	char                       *error;
 	int                        i;
 
-	finish_inserts(false);
-
-	limit     = queryLimit != 0 ? queryLimit : limit; /* prefer to use the limit specified in the query */
 	needScore = zdbquery_get_wants_score(userQuery);
 	offset    = zdbquery_get_offset(userQuery);
 	sortJson  = zdbquery_get_sort_json(userQuery);
 	min_score = zdbquery_get_min_score(userQuery);
 
-    queryDSL = convert_to_query_dsl(indexRel, userQuery, limit > 0);
-
     /* we'll assume we want scoring if we have a limit w/o a sort, so that we get the top scoring docs when the limit is applied */
 	needScore = needScore || (limit > 0 && sortJson == NULL);
 
+	/*
+	 * an offset that, with its limit, fits in Elasticsearch's result window is just the "from" of
+	 * a single request.  Beyond that, we page through with "search_after" rather than a scroll
+	 */
+	searchAfter = nslices == 0 && limit > 0 && offset > 0 && limit + offset > MAX_DOCS_PER_REQUEST;
+
 	appendStringInfo(postData, "{\"track_scores\":%s,", needScore ? "true" : "false");
 	if (min_score > 0) {
 		appendStringInfo(postData, "\"min_score\":%f,", min_score);
 	}
-	if (sortJson != NULL) {
+	if (nslices > 0) {
+		appendStringInfo(postData, "\"slice\":{\"id\":%d,\"max\":%d},", slice, nslices);
+	}
+	if (searchAfter) {
+		appendStringInfo(postData, "\"sort\":%s,", make_stable_sort(sortJson));
+	} else if (sortJson != NULL) {
 		appendStringInfo(postData, "\"sort\":%s,", sortJson);
 	} else {
 		appendStringInfo(postData, "\"sort\":[{\"%s\":\"%s\"}],", needScore ? "_score" : "_doc",
@@ -770,6 +1682,8 @@ ElasticsearchScrollContext *ElasticsearchOpenScroll(Relation indexRel, ZDBQueryT
 		appendStringInfo(postData, "}}");
 	}
 
+	if (searchAfter)
+		context->searchBody = pstrdup(postData->data);
 	appendStringInfoCharMacro(postData, '}');
 
 	appendStringInfo(docvalueFields, "zdb_ctid");
@@ -777,47 +1691,206 @@ ElasticsearchScrollContext *ElasticsearchOpenScroll(Relation indexRel, ZDBQueryT
 		appendStringInfo(docvalueFields, ",%s", extraFields[i]);
 	}
 
-	appendStringInfo(request,
-					 "%s%s/%s/_search?_source=false&size=%lu&scroll=10m&filter_path=%s&stored_fields=%s&docvalue_fields=%s",
-					 ZDBIndexOptionsGetUrl(indexRel), ZDBIndexOptionsGetIndexName(indexRel),
-					 ZDBIndexOptionsGetTypeName(indexRel),
-					 limit == 0 ? MAX_DOCS_PER_REQUEST : Min(MAX_DOCS_PER_REQUEST, limit + offset),
-					 ES_SEARCH_RESPONSE_FILTER,
-					 highlights ? "type" : use_id ? "_id" : "_none_",
-					 docvalueFields->data);
-
-	response = rest_call("POST", request, postData, ZDBIndexOptionsGetCompressionLevel(indexRel));
+	if (searchAfter) {
+		context->searchUrl = psprintf("%s%s/%s/_search?_source=false&filter_path=%s&stored_fields=%s&docvalue_fields=%s",
+									  ZDBIndexOptionsGetUrl(indexRel), ZDBIndexOptionsGetIndexName(indexRel),
+									  ZDBIndexOptionsGetTypeName(indexRel),
+									  ES_SEARCH_AFTER_RESPONSE_FILTER,
+									  highlights ? "type" : use_id ? "_id" : "_none_",
+									  docvalueFields->data);
+		context->skipUrl   = psprintf("%s%s/%s/_search?_source=false&filter_path=%s&stored_fields=_none_",
+									  ZDBIndexOptionsGetUrl(indexRel), ZDBIndexOptionsGetIndexName(indexRel),
+									  ZDBIndexOptionsGetTypeName(indexRel),
+									  ES_SEARCH_AFTER_SKIP_FILTER);
+
+		/* the first request only steps over hits before our 'offset' */
+		appendStringInfo(request, "%s&size=%lu", context->skipUrl, Min(MAX_DOCS_PER_REQUEST, offset));
+	} else {
+		/* if every hit we want fits in the one response there's no need for a scroll */
+		if (nslices > 0 || limit == 0 || limit + offset > MAX_DOCS_PER_REQUEST)
+			appendStringInfo(scrollParam, "&scroll=%ds", zdb_scroll_keep_alive_guc);
+		else if (offset > 0)
+			appendStringInfo(scrollParam, "&from=%lu", offset);
+
+		appendStringInfo(request,
+						 "%s%s/%s/_search?_source=false&size=%lu%s&filter_path=%s&stored_fields=%s&docvalue_fields=%s",
+						 ZDBIndexOptionsGetUrl(indexRel), ZDBIndexOptionsGetIndexName(indexRel),
+						 ZDBIndexOptionsGetTypeName(indexRel),
+						 limit == 0 ? MAX_DOCS_PER_REQUEST : Min(MAX_DOCS_PER_REQUEST, limit),
+						 scrollParam->data,
+						 ES_SEARCH_RESPONSE_FILTER,
+						 highlights ? "type" : use_id ? "_id" : "_none_",
+						 docvalueFields->data);
+	}
 
-	/* create a memory context in which to allocate json data */
+	/* create a memory context in which to allocate the decoded hits */
 	context->jsonMemoryContext = AllocSetContextCreate(CurTransactionContext, "scroll", ALLOCSET_DEFAULT_MINSIZE,
 													   4 * 1024 * 1024, ALLOCSET_DEFAULT_MAXSIZE);
+	context->parser            = search_response_create(context->jsonMemoryContext, use_id, nextraFields > 0);
+
+	/* and one for the next page, while we work through this one, which goes when the scroll does */
+	if (zdb_scroll_prefetch_guc) {
+		context->prefetchMemoryContext = AllocSetContextCreate(context->jsonMemoryContext, "scroll prefetch",
+															   ALLOCSET_DEFAULT_MINSIZE, 4 * 1024 * 1024,
+															   ALLOCSET_DEFAULT_MAXSIZE);
+		context->prefetchParser        = search_response_create(context->prefetchMemoryContext, use_id,
+																nextraFields > 0);
+	}
 
-	jsonResponse = parse_json_object(response, context->jsonMemoryContext);
-	error        = get_json_object_object(jsonResponse, "error", true);
-	if (error != NULL)
-		ereport(ERROR,
-				(errcode(ERRCODE_INTERNAL_ERROR),
-						errmsg("%s", response->data)));
-
-	hitsObject = get_json_object_object(jsonResponse, "hits", false);
+	/* the hits are decoded as the response arrives */
+	context->pending = rest_async_call_streaming("POST", request, postData,
+												 ZDBIndexOptionsGetCompressionLevel(indexRel),
+												 search_response_consume, context->parser);
 
 	context->url              = ZDBIndexOptionsGetUrl(indexRel);
+	context->urlSpec          = pstrdup(ZDBIndexOptionsGetUrlSpec(indexRel));
 	context->compressionLevel = ZDBIndexOptionsGetCompressionLevel(indexRel);
 
 	context->usingId       = use_id;
-	context->scrollId      = get_json_object_string(jsonResponse, "_scroll_id", false);
 	context->hasHighlights = highlights != NULL;
-	context->cnt           = 0;
-	context->currpos       = 0;
-	context->total         =
-			limit > 0 ? Min(limit, get_json_object_uint64(hitsObject, "total", false)) : get_json_object_uint64(
-					hitsObject, "total", false);
+	context->limit         = limit;
+	context->offset        = offset;
 	context->extraFields   = extraFields;
 	context->nextraFields  = nextraFields;
 
+	freeStringInfo(request);
+	freeStringInfo(postData);
+	freeStringInfo(docvalueFields);
+	freeStringInfo(scrollParam);
+	return context;
+}
+
+/*
+ * How many slices a scroll of 'userQuery' can be split into.  Only one, unless the hits can
+ * come back in any order
+ */
+static int scroll_slices(Relation indexRel, ZDBQueryType *userQuery, uint64 limit) {
+	if (limit == 0 && zdbquery_get_offset(userQuery) == 0 && zdbquery_get_sort_json(userQuery) == NULL)
+		return Max(Min(ZDBIndexOptionsGetNumberOfShards(indexRel), MAX_SCROLL_SLICES), 1);
+	return 1;
+}
+
+/*
+ * Send the request for the first page of a scroll, but don't wait for it.  The context
+ * can't be used until it's been given to ElasticsearchAwaitScroll(), and in the meantime
+ * the request is in flight alongside whatever else we're doing.
+ *
+ * If 'sliced', and the hits can come back in any order, the scroll is split into a slice per
+ * shard (up to MAX_SCROLL_SLICES) that Elasticsearch runs concurrently, and whose pages we
+ * take turns reading
+ */
+ElasticsearchScrollContext *ElasticsearchStartScroll(Relation indexRel, ZDBQueryType *userQuery, bool use_id, uint64 limit, List *highlights, char **extraFields, int nextraFields, bool sliced) {
+	ElasticsearchScrollContext *context;
+	uint64                     queryLimit = zdbquery_get_limit(userQuery);
+	int                        nslices;
+	char                       *queryDSL;
+
+	finish_inserts_for_index(indexRel);
+
+	limit    = queryLimit != 0 ? queryLimit : limit; /* prefer to use the limit specified in the query */
+	queryDSL = convert_to_query_dsl(indexRel, userQuery, limit > 0);
+	nslices  = scroll_slices(indexRel, userQuery, limit);
+
+	if (sliced && nslices > 1) {
+		int i;
+
+		context = palloc0(sizeof(ElasticsearchScrollContext));
+		context->slices  = palloc(sizeof(ElasticsearchScrollContext *) * nslices);
+		context->nslices = nslices;
+		for (i = 0; i < nslices; i++)
+			context->slices[i] = start_scroll(indexRel, userQuery, queryDSL, use_id, limit, highlights, extraFields,
+											  nextraFields, i, nslices);
+
+		context->usingId       = use_id;
+		context->hasHighlights = highlights != NULL;
+		context->extraFields   = extraFields;
+		context->nextraFields  = nextraFields;
+	} else {
+		context = start_scroll(indexRel, userQuery, queryDSL, use_id, limit, highlights, extraFields, nextraFields, 0,
+							   0);
+	}
+
+	pfree(queryDSL);
+	return context;
+}
+
+/*
+ * The first half of a scroll that's shared by the participants of a parallel index scan.  Our
+ * changes to the index are sent to Elasticsearch, and the query DSL every participant is to run
+ * is returned, along with how many slices its scroll can be split into
+ */
+char *ElasticsearchPrepareParallelScroll(Relation indexRel, ZDBQueryType *userQuery, uint64 limit, int *nslices) {
+	uint64 queryLimit = zdbquery_get_limit(userQuery);
+
+	finish_inserts_for_index(indexRel);
+
+	limit    = queryLimit != 0 ? queryLimit : limit; /* prefer to use the limit specified in the query */
+	*nslices = scroll_slices(indexRel, userQuery, limit);
+	return convert_to_query_dsl(indexRel, userQuery, limit > 0);
+}
+
+/*
+ * Start one slice of the scroll for 'queryDSL' from ElasticsearchPrepareParallelScroll().  It's
+ * waited for with ElasticsearchAwaitScroll(), like any other
+ */
+ElasticsearchScrollContext *ElasticsearchStartScrollSlice(Relation indexRel, ZDBQueryType *userQuery, char *queryDSL, uint64 limit, List *highlights, int slice, int nslices) {
+	uint64 queryLimit = zdbquery_get_limit(userQuery);
+
+	limit = queryLimit != 0 ? queryLimit : limit;
+	if (nslices > 1)
+		return start_scroll(indexRel, userQuery, queryDSL, false, limit, highlights, NULL, 0, slice, nslices);
+	return start_scroll(indexRel, userQuery, queryDSL, false, limit, highlights, NULL, 0, 0, 0);
+}
+
+/*
+ * Wait for the first page of a scroll from ElasticsearchStartScroll()
+ */
+void ElasticsearchAwaitScroll(ElasticsearchScrollContext *context) {
+	StringInfo response;
+	uint64     offset = context->offset;
+
+	if (context->slices != NULL) {
+		int i;
+
+		for (i = 0; i < context->nslices; i++) {
+			if (context->slices[i]->pending != NULL) {
+				ElasticsearchAwaitScroll(context->slices[i]);
+				context->total += context->slices[i]->total;
+			}
+		}
+		return;
+	}
+
+	if (context->pending == NULL)
+		return;
+
+	response = rest_await(context->pending);
+	context->pending = NULL;
+	search_response_finish(context->parser, response);
+
+	context->cnt     = 0;
+	context->currpos = 0;
+
+	if (context->limit > 0 && offset > 0) {
+		/*
+		 * Elasticsearch has already stepped over the hits before our 'offset' (with "from"), or
+		 * we do that now, a search_after page at a time
+		 */
+		context->total = offset < context->parser->total ? Min(context->limit, context->parser->total - offset) : 0;
+		if (context->total > 0 && context->searchUrl != NULL)
+			skip_to_offset(context);
+		offset = 0;
+	} else {
+		context->total = context->limit > 0 ? Min(context->limit, context->parser->total) : context->parser->total;
+	}
+	context->scrollId = context->parser->scrollId;
+
 	if (offset < context->total) {
-		context->hits  = get_json_object_array(hitsObject, "hits", false);
-		context->nhits = context->hits == NULL ? 0 : get_json_array_length(context->hits);
+		context->hits  = context->parser->hits;
+		context->nhits = context->parser->nhits;
+
+		track_scroll(context);
+		start_prefetch(context);
 
 		/* fast-forward to our 'offset' -- using the ?from= ES request parameter doesn't work with scroll requests */
 		if (offset > 0) {
@@ -835,15 +1908,60 @@ ElasticsearchScrollContext *ElasticsearchOpenScroll(Relation indexRel, ZDBQueryT
 		context->nhits = 0;
 	}
 
-	pfree(queryDSL);
-	freeStringInfo(request);
-	freeStringInfo(postData);
 	freeStringInfo(response);
-	return context;
+}
+
+/*
+ * The next hit of a sliced scroll.  We read a page from one slice, then a page from the
+ * next, so each slice's next page can download while we're busy with the others
+ */
+static bool get_next_from_slices(ElasticsearchScrollContext *context, ItemPointer ctid, char **_id, float4 *score, zdb_json_object *highlights) {
+	ElasticsearchScrollContext *slice = context->slices[context->currslice];
+	uint64                     cnt;
+	bool                       found;
+
+	if (slice->currpos == slice->nhits || slice->cnt >= slice->total) {
+		int i;
+
+		for (i = 1; i <= context->nslices; i++) {
+			int next = (context->currslice + i) % context->nslices;
+
+			if (context->slices[next]->cnt < context->slices[next]->total) {
+				context->currslice = next;
+				break;
+			}
+		}
+
+		if (i > context->nslices)
+			return false;   /* every slice is finished */
+		slice = context->slices[context->currslice];
+	}
+
+	cnt   = slice->cnt;
+	found = ElasticsearchGetNextItemPointer(slice, ctid, _id, score, highlights);
+	context->cnt += slice->cnt - cnt;
+
+	if (!found) {
+		/* the slice skipped over hits that weren't rows and ran out, so try another one */
+		return get_next_from_slices(context, ctid, _id, score, highlights);
+	}
+
+	context->fields            = slice->fields;
+	context->jsonMemoryContext = slice->jsonMemoryContext;
+	return true;
 }
 
 bool ElasticsearchGetNextItemPointer(ElasticsearchScrollContext *context, ItemPointer ctid, char **_id, float4 *score, zdb_json_object *highlights) {
-	char *es_id = NULL;
+	ElasticsearchHit *hit;
+	char             *es_id = NULL;
+
+	if (context->slices != NULL) {
+		ElasticsearchAwaitScroll(context);
+		return get_next_from_slices(context, ctid, _id, score, highlights);
+	}
+
+	if (context->pending != NULL)
+		ElasticsearchAwaitScroll(context);
 
 start_over:
 
@@ -860,37 +1978,10 @@ start_over:
 
 	if (context->currpos == context->nhits) {
 		/* we exhausted the current set of hits, so go get more */
-		StringInfo request  = makeStringInfo();
-		StringInfo postData = makeStringInfo();
-		StringInfo response;
-		void       *jsonResponse, *hitsObject;
-		char       *error;
-
-		appendStringInfo(postData, "{\"scroll\":\"10m\",\"scroll_id\":\"%s\"}", context->scrollId);
-		appendStringInfo(request, "%s_search/scroll?filter_path=%s", context->url, ES_SEARCH_RESPONSE_FILTER);
-		response = rest_call("POST", request, postData, context->compressionLevel);
-
-		/* make sure we don't leak the hits json from the previous request */
-		if (context->hits != NULL)
-			MemoryContextReset(context->jsonMemoryContext);
-
-		jsonResponse = parse_json_object(response, context->jsonMemoryContext);
-		error        = get_json_object_object(jsonResponse, "error", true);
-		if (error != NULL)
-			ereport(ERROR,
-					(errcode(ERRCODE_INTERNAL_ERROR),
-							errmsg("%s", response->data)));
-
-		hitsObject = get_json_object_object(jsonResponse, "hits", false);
-
-		context->scrollId = get_json_object_string(jsonResponse, "_scroll_id", false);
-		context->currpos  = 0;
-		context->hits     = get_json_object_array(hitsObject, "hits", false);
-		context->nhits    = context->hits == NULL ? 0 : get_json_array_length(context->hits);
-
-		freeStringInfo(request);
-		freeStringInfo(response);
-		freeStringInfo(postData);
+		fetch_next_page(context);
+	} else if (context->prefetch != NULL && context->currpos % SCROLL_PREFETCH_POLL_INTERVAL == 0) {
+		/* keep the next page coming off the wire while we're busy with this one */
+		rest_async_progress();
 	}
 
 	if (context->hits == NULL)
@@ -898,18 +1989,19 @@ start_over:
 				(errcode(ERRCODE_INTERNAL_ERROR),
 						errmsg("No results found when loading next scroll context")));
 
-	context->hitEntry = get_json_array_element_object(context->hits, context->currpos, context->jsonMemoryContext);
-	context->fields   = get_json_object_object(context->hitEntry, "fields", true);
+	hit = &context->hits[context->currpos];
+	context->fields = hit->fields != NULL ? parse_json_object_from_string(hit->fields, context->jsonMemoryContext) : NULL;
 
 	if (context->usingId) {
-		es_id = (char *) get_json_object_string(context->hitEntry, "_id", false);
+		es_id = hit->id;
+		if (es_id == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+							errmsg("no such key '_id' in json object")));
 	} else if (ctid != NULL) {
-		void   *zdb_ctid;
-		uint64 ctidAs64bits;
-
-		if (context->fields == NULL) {
+		if (!hit->hasCtid) {
 		    /* there's no 'fields' block for this hit entry, which, by omission, indicates
-		     * that this is the hit for the "zdb_aborted_xids" document, so we can just blindly
+		     * that this is the hit for one of the "zdb_aborted_xids" documents, so we can just blindly
 		     * skip to the next one
 		     */
 			context->cnt++;
@@ -920,11 +2012,8 @@ start_over:
             goto start_over;
         }
 
-		zdb_ctid     = get_json_object_array(context->fields, "zdb_ctid", false);
-		ctidAs64bits = get_json_array_element_uint64(zdb_ctid, 0, context->jsonMemoryContext);
-
 		/* set ctid out parameter */
-		ItemPointerSet(ctid, (BlockNumber) (ctidAs64bits >> 32), (OffsetNumber) ctidAs64bits);
+		ItemPointerSet(ctid, (BlockNumber) (hit->ctid >> 32), (OffsetNumber) hit->ctid);
 	}
 
 	context->currpos++;
@@ -936,22 +2025,49 @@ start_over:
 	}
 
 	if (score != NULL) {
-		*score = (float4) get_json_object_real(context->hitEntry, "_score");
+		*score = hit->score;
 	}
 
 	if (highlights != NULL) {
-		*highlights = context->hasHighlights ? get_json_object_object(context->hitEntry, "highlight", true) : NULL;
+		*highlights = context->hasHighlights && hit->highlight != NULL ?
+					  parse_json_object_from_string(hit->highlight, context->jsonMemoryContext) : NULL;
 	}
 
 	return true;
 }
 
 void ElasticsearchCloseScroll(ElasticsearchScrollContext *scrollContext) {
+	if (scrollContext->slices != NULL) {
+		int i;
+
+		for (i = 0; i < scrollContext->nslices; i++)
+			ElasticsearchCloseScroll(scrollContext->slices[i]);
+		pfree(scrollContext->slices);
+		pfree(scrollContext);
+		return;
+	}
+
+	if (scrollContext->pending != NULL)
+		rest_async_cancel(scrollContext->pending);
+	if (scrollContext->prefetch != NULL)
+		rest_async_cancel(scrollContext->prefetch);
+	if (scrollContext->openScroll != NULL)
+		clear_scroll((ScrollId *) scrollContext->openScroll);
+	if (scrollContext->prefetchParser != NULL) {
+		search_response_free(scrollContext->prefetchParser);
+		MemoryContextDelete(scrollContext->prefetchMemoryContext);
+	}
+	if (scrollContext->searchUrl != NULL) {
+		pfree(scrollContext->searchUrl);
+		pfree(scrollContext->skipUrl);
+		pfree(scrollContext->searchBody);
+	}
+	search_response_free(scrollContext->parser);
 	MemoryContextDelete(scrollContext->jsonMemoryContext);
 	pfree(scrollContext);
 }
 
-void ElasticsearchRemoveAbortedTransactions(Relation indexRel, List/*uint64*/ *xids) {
+void ElasticsearchRemoveAbortedTransactions(Relation indexRel, char *docId, List/*uint64*/ *xids) {
 	if (list_length(xids) > 0) {
 		StringInfo xidsArray = makeStringInfo();
 		StringInfo request   = makeStringInfo();
@@ -975,9 +2091,9 @@ void ElasticsearchRemoveAbortedTransactions(Relation indexRel, List/*uint64*/ *x
 								   "}"
 								   "}", xidsArray->data);
 
-		appendStringInfo(request, "%s%s/%s/zdb_aborted_xids/_update?retry_on_conflict=128&refresh=true",
+		appendStringInfo(request, "%s%s/%s/%s/_update?retry_on_conflict=128&refresh=true",
 						 ZDBIndexOptionsGetUrl(indexRel), ZDBIndexOptionsGetIndexName(indexRel),
-						 ZDBIndexOptionsGetTypeName(indexRel));
+						 ZDBIndexOptionsGetTypeName(indexRel), docId);
 
 		response = rest_call("POST", request, postData, ZDBIndexOptionsGetCompressionLevel(indexRel));
 
@@ -1006,28 +2122,45 @@ char *ElasticsearchProfileQuery(Relation indexRel, ZDBQueryType *query) {
 }
 
 uint64 ElasticsearchCount(Relation indexRel, ZDBQueryType *query) {
+	return ElasticsearchFinishCount(ElasticsearchStartCount(indexRel, query));
+}
+
+/*
+ * Send a _count request without waiting for its response.  Several counts can be
+ * started together and will run concurrently until each is given to ElasticsearchFinishCount()
+ */
+RestFuture *ElasticsearchStartCount(Relation indexRel, ZDBQueryType *query) {
 	StringInfo request  = makeStringInfo();
 	StringInfo postData = makeStringInfo();
-	StringInfo response;
-	void       *json;
-	uint64     count;
+	RestFuture *future;
 
 	validate_alias(indexRel);
 
-	finish_inserts(false);
+	finish_inserts_for_index(indexRel);
 
 	appendStringInfo(postData, "{\"query\":%s}", convert_to_query_dsl(indexRel, query, true));
 
 	appendStringInfo(request, "%s%s/_count?filter_path=count", ZDBIndexOptionsGetUrl(indexRel),
 					 ZDBIndexOptionsGetAlias(indexRel));
-	response = rest_call("POST", request, postData, ZDBIndexOptionsGetCompressionLevel(indexRel));
+	future = rest_async_call("POST", request, postData, ZDBIndexOptionsGetCompressionLevel(indexRel));
+
+	freeStringInfo(postData);
+	freeStringInfo(request);
+
+	return future;
+}
+
+uint64 ElasticsearchFinishCount(RestFuture *future) {
+	StringInfo response;
+	void       *json;
+	uint64     count;
+
+	response = rest_await(future);
 	json     = parse_json_object(response, CurrentMemoryContext);
 	count    = get_json_object_uint64(json, "count", false);
 
 	pfree(json);
 	freeStringInfo(response);
-	freeStringInfo(postData);
-	freeStringInfo(request);
 
 	return count;
 }
@@ -1039,7 +2172,7 @@ static char *makeAggRequest(Relation indexRel, ZDBQueryType *query, char *agg, b
 
 	validate_alias(indexRel);
 
-	finish_inserts(false);
+	finish_inserts_for_index(indexRel);
 
 	appendStringInfoCharMacro(postData, '{');
 	if (query != NULL)
@@ -1106,7 +2239,7 @@ static StringInfo terms_agg_only_keys(Relation indexRel, char *field, ZDBQueryTy
 	StringInfo postData     = makeStringInfo();
 	StringInfo response;
 
-	finish_inserts(false);
+	finish_inserts_for_index(indexRel);
 
 	if (size == 0)
 		size = INT32_MAX;
@@ -19,25 +19,42 @@
 
 #include "zombodb.h"
 #include "json/json_support.h"
+#include "json/row_encoder.h"
+#include "elasticsearch/search_response.h"
 #include "rest/curl_support.h"
+#include "rest/rest.h"
 #include "utils/jsonb.h"
 
 /* this needs to match curl_support.h:MAX_CURL_HANDLES */
 #define MAX_BULK_CONCURRENCY 1024
 
+/*
+ * the in-progress/aborted xids of an index are spread across this many documents, by xid, so
+ * that concurrent writers aren't all updating the same one
+ */
+#define ZDB_ABORTED_XIDS_PARTITIONS 8
+#define ZDB_ABORTED_XIDS_PARTITION(xid) ((int) ((xid) % ZDB_ABORTED_XIDS_PARTITIONS))
+
 typedef struct ElasticsearchBulkContext {
 	char           *url;
+	char           *urlSpec;           /* the index's 'url' option, which identifies its cluster */
 	char           *pgIndexName;
 	char           *esIndexName;
 	char           *typeName;
-	int            batchSize;
-	int            bulkConcurrency;
+	int            batchSize;          /* current batch size, adapted between 'minBatchSize' and 'maxBatchSize' */
+	int            minBatchSize;
+	int            maxBatchSize;
+	int            bulkConcurrency;    /* the most concurrent requests we'll ever make */
+	int            concurrency;        /* current number of concurrent requests we'll allow */
 	int            compressionLevel;
 	bool           waitForActiveShards;
 	bool           containsJson;
 	bool           containsJsonIsSet;
 	bool           shouldRefresh;
 	bool           ignoreVersionConflicts;
+	bool           trackTransactions;  /* should we maintain zdb_aborted_xids for the xids we use? */
+	bool           smile;              /* are we sending SMILE instead of json? */
+	int            smileStart;         /* where the json lines not yet transcoded to SMILE start in current->buff */
 	MultiRestState *rest;
 	PostDataEntry  *current;
 	int            nrequests;
@@ -48,33 +65,68 @@ typedef struct ElasticsearchBulkContext {
 	int            ndelete;
 	int            nvacuum;
 	int            nxid;
-	StringInfo     pool[MAX_CURL_HANDLES];
+	PostDataEntry  *pool[MAX_CURL_HANDLES];
 	TransactionId  lastUsedXid;
 	List           *usedXids;    /* should be allocated in TopTransactionContext */
+	MemoryContext  memcxt;       /* where this context, and its RowEncoderPlan, are allocated */
+	RowEncoderPlan *encoderPlan;
+
+	/* ctids ElasticsearchBulkUpdateTuple() has been asked to stamp with the same cmax/xmax but hasn't yet sent */
+	uint64         *xmaxCtids;
+	int            nxmaxCtids;
+	int            maxXmaxCtids;
+	CommandId      xmaxCmax;
+	uint64         xmaxXid;
+	bool           xmaxByQueryRefresh; /* has _update_by_query stamped documents that haven't been refreshed? */
+
+	/* what we've seen from context->rest so far, for adapting to how busy Elasticsearch is */
+	uint64         lastCompleted;
+	uint64         lastRejected;
+	double         lastSeconds;
+	double         avgLatency;         /* smoothed seconds per request */
+	uint64         nextBackoff;        /* don't back off again until this many requests have completed */
 } ElasticsearchBulkContext;
 
 typedef struct ElasticsearchScrollContext {
-	MemoryContext jsonMemoryContext;      /* where are json objects allocated? */
-	char          *url;
-	int           compressionLevel;
-	bool          usingId;    /* is this scroll using _id instead of zdb_id? */
-	const char    *scrollId;
-	bool          hasHighlights;
-	uint64        total;      /* total number of hits across all scroll context's */
-	uint64        cnt;        /* how many have we examined so far? */
-	int           nhits;      /* total number of hits in this scroll context */
-	int           currpos;    /* how many have we examined in this scroll context */
-	void          *hits;      /* the actual hits in the scroll context, of type 'json_t' */
-	void          *hitEntry;
-	void          *fields;
-	char          **extraFields;
-	int           nextraFields;
+	MemoryContext        jsonMemoryContext;      /* where are json objects allocated? */
+	char                 *url;
+	char                 *urlSpec;   /* the index's 'url' option, which identifies its cluster */
+	int                  compressionLevel;
+	bool                 usingId;    /* is this scroll using _id instead of zdb_id? */
+	const char           *scrollId;
+	bool                 hasHighlights;
+	uint64               total;      /* total number of hits across all scroll context's */
+	uint64               cnt;        /* how many have we examined so far? */
+	int                  nhits;      /* total number of hits in this scroll context */
+	int                  currpos;    /* how many have we examined in this scroll context */
+	SearchResponseParser *parser;    /* decodes each response's hits as it arrives */
+	ElasticsearchHit     *hits;      /* the hits in the scroll context */
+	void                 *fields;    /* the current hit's "fields", if we asked for extra fields */
+	char                 **extraFields;
+	int                  nextraFields;
+	RestFuture           *pending;   /* the request for the first page, until it's been waited for */
+	RestFuture           *prefetch;  /* the request for the next page, while we work through this one */
+	SearchResponseParser *prefetchParser;
+	MemoryContext        prefetchMemoryContext;
+	void                 *openScroll; /* while Elasticsearch keeps a scroll context for us, our record of it */
+	struct ElasticsearchScrollContext **slices; /* for a sliced scroll, each of its slices */
+	int                  nslices;
+	int                  currslice;  /* the slice we're reading a page of */
+	uint64               limit;
+	uint64               offset;
+	char                 *searchUrl;  /* for a search_after paged search, the _search url of each page, less its size */
+	char                 *skipUrl;    /* ... the same, for the pages before 'offset', of which we only want sort values */
+	char                 *searchBody; /* ... and the request body, less its closing brace */
 } ElasticsearchScrollContext;
 
 /* defined in zdbam.c */
-extern int ZDB_LOG_LEVEL;
+extern int  ZDB_LOG_LEVEL;
+extern bool zdb_scroll_prefetch_guc;
+extern int  zdb_scroll_keep_alive_guc;
 
 char *make_alias_name(Relation indexRel, bool force_default);
+char *aborted_xids_doc_id(int partition);
+char *aborted_xids_doc_ids_json(void);
 
 char *ElasticsearchArbitraryRequest(Relation indexRel, char *method, char *endpoint, StringInfo postData);
 
@@ -82,31 +134,45 @@ char *ElasticsearchCreateIndex(Relation heapRel, Relation indexRel, TupleDesc tu
 void ElasticsearchDeleteIndex(Relation indexRel);
 void ElasticsearchDeleteIndexDirect(char *index_url);
 void ElasticsearchFinalizeIndexCreation(Relation indexRel);
+void ElasticsearchRefreshIndex(Relation indexRel);
 
 void ElasticsearchUpdateSettings(Relation indexRel, char *oldAlias, char *newAlias);
 void ElasticsearchPutMapping(Relation heapRel, Relation indexRel, TupleDesc tupdesc);
+char *ElasticsearchGetFieldType(Relation indexRel, char *fieldname);
 
 ElasticsearchBulkContext *ElasticsearchStartBulkProcess(Relation indexRel, char *indexName, TupleDesc tupdesc, bool ignore_version_conflicts);
+void ElasticsearchBulkInsertRecord(ElasticsearchBulkContext *context, MemoryContext scratch, ItemPointerData *ctid, Datum record, CommandId cmin, CommandId cmax, uint64 xmin, uint64 xmax);
 void ElasticsearchBulkInsertRow(ElasticsearchBulkContext *context, ItemPointerData *ctid, text *json, CommandId cmin, CommandId cmax, uint64 xmin, uint64 xmax);
+void ElasticsearchBulkMarkCurrentXid(ElasticsearchBulkContext *context);
 void ElasticsearchBulkUpdateTuple(ElasticsearchBulkContext *context, ItemPointer ctid, char *llapi_id, CommandId cmax, uint64 xmax);
 void ElasticsearchBulkVacuumXmax(ElasticsearchBulkContext *context, char *_id, uint64 expected_xmax);
 void ElasticsearchBulkDeleteRowByXmin(ElasticsearchBulkContext *context, char *_id, uint64 xmin);
 void ElasticsearchBulkDeleteRowByXmax(ElasticsearchBulkContext *context, char *_id, uint64 xmax);
+void ElasticsearchBulkDeleteRow(ElasticsearchBulkContext *context, ItemPointer ctid);
 void ElasticsearchFinishBulkProcess(ElasticsearchBulkContext *context, bool is_commit);
 
 uint64 ElasticsearchCountAllDocs(Relation indexRel);
 uint64 ElasticsearchEstimateSelectivity(Relation indexRel, ZDBQueryType *query);
 
 ElasticsearchScrollContext *ElasticsearchOpenScroll(Relation indexRel, ZDBQueryType *userQuery, bool use_id, uint64 limit, List *highlights, char **extraFields, int nextraFields);
+ElasticsearchScrollContext *ElasticsearchOpenSlicedScroll(Relation indexRel, ZDBQueryType *userQuery, bool use_id, List *highlights, char **extraFields, int nextraFields);
+ElasticsearchScrollContext *ElasticsearchStartScroll(Relation indexRel, ZDBQueryType *userQuery, bool use_id, uint64 limit, List *highlights, char **extraFields, int nextraFields, bool sliced);
+char *ElasticsearchPrepareParallelScroll(Relation indexRel, ZDBQueryType *userQuery, uint64 limit, int *nslices);
+ElasticsearchScrollContext *ElasticsearchStartScrollSlice(Relation indexRel, ZDBQueryType *userQuery, char *queryDSL, uint64 limit, List *highlights, int slice, int nslices);
+void ElasticsearchAwaitScroll(ElasticsearchScrollContext *context);
 bool ElasticsearchGetNextItemPointer(ElasticsearchScrollContext *context, ItemPointer ctid, char **_id, float4 *score,
 									 zdb_json_object *highlights);
 void ElasticsearchCloseScroll(ElasticsearchScrollContext *scrollContext);
+void ElasticsearchClearScrolls(void);
+void ElasticsearchAbandonScrolls(void);
 
-void ElasticsearchRemoveAbortedTransactions(Relation indexRel, List/*uint64*/ *xids);
+void ElasticsearchRemoveAbortedTransactions(Relation indexRel, char *docId, List/*uint64*/ *xids);
 
 char *ElasticsearchProfileQuery(Relation indexRel, ZDBQueryType *query);
 
 uint64 ElasticsearchCount(Relation indexRel, ZDBQueryType *query);
+RestFuture *ElasticsearchStartCount(Relation indexRel, ZDBQueryType *query);
+uint64 ElasticsearchFinishCount(RestFuture *future);
 char *ElasticsearchArbitraryAgg(Relation indexRel, ZDBQueryType *query, char *agg);
 char *ElasticsearchTerms(Relation indexRel, char *field, ZDBQueryType *query, char *order, uint64 size);
 ArrayType *ElasticsearchTermsAsArray(Relation indexRel, char *field, ZDBQueryType *query, char *order, uint64 size);
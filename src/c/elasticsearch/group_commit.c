@@ -0,0 +1,411 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Group commit of the zdb_aborted_xids bookkeeping that committing transactions do.
+ *
+ * Backends that need to tell Elasticsearch their xids have committed put them in a queue in
+ * shared memory.  Whichever one finds there's no request already underway becomes the leader,
+ * takes everything in the queue, removes it all from the zdb_aborted_xids documents with one
+ * _bulk request (per Elasticsearch cluster) and then wakes everyone it did that for.
+ *
+ * It's only available when ZomboDB is in 'shared_preload_libraries'.  Otherwise, or whenever the
+ * group commit can't be used, backends make the request themselves
+ */
+
+#include "group_commit.h"
+#include "elasticsearch.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "rest/rest.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+
+#define GROUP_COMMIT_SLOTS   1024
+#define GROUP_COMMIT_MAX_URL 256
+
+/* how long a follower sleeps before checking on its xids, in case its latch is never set */
+#define GROUP_COMMIT_WAIT_MS 100
+
+typedef enum GroupCommitSlotState {
+	GROUP_COMMIT_FREE = 0,
+	GROUP_COMMIT_QUEUED,
+	GROUP_COMMIT_CLAIMED,
+	GROUP_COMMIT_DONE,
+	GROUP_COMMIT_FAILED
+} GroupCommitSlotState;
+
+typedef struct GroupCommitSlot {
+	GroupCommitSlotState state;
+	int                  pgprocno;      /* the backend to wake when the slot is DONE or FAILED */
+	bool                 abandoned;     /* its backend gave up waiting, so free it once it's finished */
+	int                  slotno;        /* in a leader's copy of the slot, where it is in shared memory */
+	uint64               xid;
+	int                  compressionLevel;
+	char                 urlSpec[GROUP_COMMIT_MAX_URL];  /* the index's 'url' option */
+	char                 indexName[NAMEDATALEN * 2];
+	char                 typeName[NAMEDATALEN];
+} GroupCommitSlot;
+
+typedef struct GroupCommitShared {
+	LWLock          *lock;          /* protects everything below */
+	bool            leaderActive;
+	GroupCommitSlot slots[GROUP_COMMIT_SLOTS];
+} GroupCommitShared;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static GroupCommitShared       *group_commit           = NULL;
+
+/* the slots we claimed as leader, so we can release them if we exit while leading */
+static int  *leading_slots  = NULL;
+static int  nleading_slots  = 0;
+static bool exit_registered = false;
+
+static Size group_commit_shmem_size(void) {
+	return MAXALIGN(sizeof(GroupCommitShared));
+}
+
+static void group_commit_shmem_startup(void) {
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	group_commit = ShmemInitStruct("zombodb group commit", group_commit_shmem_size(), &found);
+	if (!found) {
+		memset(group_commit, 0, group_commit_shmem_size());
+		group_commit->lock = &(GetNamedLWLockTranche("zombodb_group_commit"))->lock;
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+void group_commit_init(void) {
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	RequestAddinShmemSpace(group_commit_shmem_size());
+	RequestNamedLWLockTranche("zombodb_group_commit", 1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook      = group_commit_shmem_startup;
+}
+
+/*
+ * Set the state of the slots we've been leading that are still CLAIMED (freeing those whose
+ * backends have given up on them), wake the backends that own them, and also wake the owners
+ * of anything queued since, so one of them can lead next.
+ *
+ * Caller must hold the lock
+ */
+static void finish_leading(GroupCommitSlotState state) {
+	int i;
+
+	for (i = 0; i < nleading_slots; i++) {
+		GroupCommitSlot *slot = &group_commit->slots[leading_slots[i]];
+
+		if (slot->abandoned)
+			slot->state = GROUP_COMMIT_FREE;
+		else if (slot->state == GROUP_COMMIT_CLAIMED)
+			slot->state = state;
+	}
+	nleading_slots = 0;
+	group_commit->leaderActive = false;
+
+	for (i = 0; i < GROUP_COMMIT_SLOTS; i++) {
+		GroupCommitSlot *slot = &group_commit->slots[i];
+
+		if (slot->state != GROUP_COMMIT_FREE && slot->state != GROUP_COMMIT_CLAIMED && slot->pgprocno != MyProc->pgprocno)
+			SetLatch(&ProcGlobal->allProcs[slot->pgprocno].procLatch);
+	}
+}
+
+/*lint -esym 715,code,arg ignore unused param */
+static void group_commit_exit_callback(int code, Datum arg) {
+	int i;
+
+	LWLockAcquire(group_commit->lock, LW_EXCLUSIVE);
+	if (nleading_slots > 0)
+		finish_leading(GROUP_COMMIT_FAILED);
+
+	/* and give back our own slots, or leave those a leader is working on for it to free */
+	for (i = 0; i < GROUP_COMMIT_SLOTS; i++) {
+		GroupCommitSlot *slot = &group_commit->slots[i];
+
+		if (slot->pgprocno != MyProc->pgprocno || slot->state == GROUP_COMMIT_FREE)
+			continue;
+
+		if (slot->state == GROUP_COMMIT_CLAIMED)
+			slot->abandoned = true;
+		else
+			slot->state = GROUP_COMMIT_FREE;
+	}
+	LWLockRelease(group_commit->lock);
+}
+
+static int slot_cmp(const void *a, const void *b) {
+	const GroupCommitSlot *left  = (const GroupCommitSlot *) a;
+	const GroupCommitSlot *right = (const GroupCommitSlot *) b;
+	int                   rc;
+
+	if ((rc = strcmp(left->urlSpec, right->urlSpec)) != 0)
+		return rc;
+	if ((rc = strcmp(left->indexName, right->indexName)) != 0)
+		return rc;
+	return ZDB_ABORTED_XIDS_PARTITION(left->xid) - ZDB_ABORTED_XIDS_PARTITION(right->xid);
+}
+
+static void append_xid_removal(StringInfo body, GroupCommitSlot *slot, StringInfo xids) {
+	appendStringInfo(body, "{\"update\":{\"_index\":\"%s\",\"_type\":\"%s\",\"_id\":\"%s\",\"_retry_on_conflict\":128}}\n",
+					 slot->indexName, slot->typeName, aborted_xids_doc_id(ZDB_ABORTED_XIDS_PARTITION(slot->xid)));
+	appendStringInfo(body, ""
+						   "{"
+						   "\"script\":{"
+						   "\"source\":\"ctx._source.zdb_aborted_xids.removeAll(params.XIDS);\","
+						   "\"params\":{\"XIDS\":[%s]},"
+						   "\"lang\":\"painless\""
+						   "}"
+						   "}\n", xids->data);
+}
+
+/*
+ * Returns false if Elasticsearch reports that any of the updates in 'body' failed
+ */
+static bool send_xid_removals(GroupCommitSlot *slot, StringInfo body) {
+	StringInfo request = makeStringInfo();
+	StringInfo response;
+	bool       success;
+
+	appendStringInfo(request, "%s_bulk?filter_path=errors", rest_nodes_base_url(slot->urlSpec));
+	response = rest_call("POST", request, body, slot->compressionLevel);
+	success  = strstr(response->data, "\"errors\":false") != NULL;
+
+	freeStringInfo(response);
+	freeStringInfo(request);
+	return success;
+}
+
+/*
+ * Remove the xids in the claimed slots, which have been copied into 'batch', from their
+ * zdb_aborted_xids documents.  Each of those gets a single update for all its xids, and
+ * each Elasticsearch cluster a single _bulk request.  The copies sent in a request that
+ * Elasticsearch reports errors for are set to FAILED
+ */
+static void lead(GroupCommitSlot *batch, int nbatch) {
+	StringInfo body  = makeStringInfo();
+	StringInfo xids  = makeStringInfo();
+	int        first = 0;
+	int        i;
+
+	qsort(batch, nbatch, sizeof(GroupCommitSlot), slot_cmp);
+
+	for (i = 0; i < nbatch; i++) {
+		if (xids->len > 0) appendStringInfoChar(xids, ',');
+		appendStringInfo(xids, "%lu", batch[i].xid);
+
+		if (i == nbatch - 1 || slot_cmp(&batch[i], &batch[i + 1]) != 0) {
+			append_xid_removal(body, &batch[i], xids);
+			resetStringInfo(xids);
+		}
+
+		if (i == nbatch - 1 || strcmp(batch[i].urlSpec, batch[i + 1].urlSpec) != 0) {
+			if (!send_xid_removals(&batch[i], body)) {
+				int j;
+
+				for (j = first; j <= i; j++)
+					batch[j].state = GROUP_COMMIT_FAILED;
+			}
+			resetStringInfo(body);
+			first = i + 1;
+		}
+	}
+
+	freeStringInfo(xids);
+	freeStringInfo(body);
+}
+
+/*
+ * Mark the xids as committed in the zdb_aborted_xids documents of the index, along with
+ * those of any other backends committing at the same time.
+ *
+ * Returns false if that isn't possible, in which case the caller needs to do it itself
+ */
+bool group_commit_mark_committed(char *urlSpec, char *indexName, char *typeName, int compressionLevel, List *xids) {
+	int      nxids = list_length(xids);
+	int      *mine;
+	int      nmine = 0;
+	bool     success = false;
+	ListCell *lc;
+	int      i;
+
+	if (group_commit == NULL || nxids == 0 || nxids > GROUP_COMMIT_SLOTS)
+		return false;
+	if (strlen(urlSpec) >= GROUP_COMMIT_MAX_URL || strlen(indexName) >= NAMEDATALEN * 2 ||
+		strlen(typeName) >= NAMEDATALEN)
+		return false;
+
+	if (!exit_registered) {
+		before_shmem_exit(group_commit_exit_callback, (Datum) 0);
+		exit_registered = true;
+	}
+
+	mine = palloc(sizeof(int) * nxids);
+	lc   = list_head(xids);
+
+	LWLockAcquire(group_commit->lock, LW_EXCLUSIVE);
+	for (i = 0; i < GROUP_COMMIT_SLOTS && nmine < nxids; i++) {
+		GroupCommitSlot *slot = &group_commit->slots[i];
+
+		if (slot->state == GROUP_COMMIT_FREE) {
+			slot->state            = GROUP_COMMIT_QUEUED;
+			slot->pgprocno         = MyProc->pgprocno;
+			slot->abandoned        = false;
+			slot->xid              = convert_xid((TransactionId) lfirst_int(lc));
+			slot->compressionLevel = compressionLevel;
+			strcpy(slot->urlSpec, urlSpec);
+			strcpy(slot->indexName, indexName);
+			strcpy(slot->typeName, typeName);
+
+			mine[nmine++] = i;
+			lc = lnext(lc);
+		}
+	}
+
+	if (nmine < nxids) {
+		/* the queue is full */
+		for (i = 0; i < nmine; i++)
+			group_commit->slots[mine[i]].state = GROUP_COMMIT_FREE;
+		LWLockRelease(group_commit->lock);
+		pfree(mine);
+		return false;
+	}
+
+	for (;;) {
+		int ndone = 0, nfailed = 0;
+		int rc;
+
+		for (i = 0; i < nmine; i++) {
+			GroupCommitSlotState state = group_commit->slots[mine[i]].state;
+
+			if (state == GROUP_COMMIT_DONE)
+				ndone++;
+			else if (state == GROUP_COMMIT_FAILED)
+				nfailed++;
+		}
+
+		if (ndone + nfailed == nmine) {
+			for (i = 0; i < nmine; i++)
+				group_commit->slots[mine[i]].state = GROUP_COMMIT_FREE;
+			success = nfailed == 0;
+			break;
+		}
+
+		if (!group_commit->leaderActive) {
+			GroupCommitSlot *batch = palloc(sizeof(GroupCommitSlot) * GROUP_COMMIT_SLOTS);
+			int             nbatch = 0;
+
+			/* we're the leader, for everything that's been queued */
+			group_commit->leaderActive = true;
+			if (leading_slots == NULL)
+				leading_slots = MemoryContextAlloc(TopMemoryContext, sizeof(int) * GROUP_COMMIT_SLOTS);
+
+			for (i = 0; i < GROUP_COMMIT_SLOTS; i++) {
+				GroupCommitSlot *slot = &group_commit->slots[i];
+
+				if (slot->state == GROUP_COMMIT_QUEUED) {
+					slot->state = GROUP_COMMIT_CLAIMED;
+					leading_slots[nleading_slots++] = i;
+					batch[nbatch] = *slot;
+					batch[nbatch++].slotno = i;
+				}
+			}
+			LWLockRelease(group_commit->lock);
+
+			PG_TRY();
+					{
+						lead(batch, nbatch);
+					}
+				PG_CATCH();
+					{
+						LWLockAcquire(group_commit->lock, LW_EXCLUSIVE);
+						finish_leading(GROUP_COMMIT_FAILED);
+						for (i = 0; i < nmine; i++)
+							group_commit->slots[mine[i]].state = GROUP_COMMIT_FREE;
+						LWLockRelease(group_commit->lock);
+						PG_RE_THROW();
+					}
+			PG_END_TRY();
+
+			LWLockAcquire(group_commit->lock, LW_EXCLUSIVE);
+			for (i = 0; i < nbatch; i++) {
+				GroupCommitSlot *slot = &group_commit->slots[batch[i].slotno];
+
+				if (batch[i].state == GROUP_COMMIT_FAILED && !slot->abandoned)
+					slot->state = GROUP_COMMIT_FAILED;
+			}
+			finish_leading(GROUP_COMMIT_DONE);
+			pfree(batch);
+			continue;
+		}
+
+		/* someone else is leading, so wait for them */
+		LWLockRelease(group_commit->lock);
+
+		PG_TRY();
+				{
+					rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, GROUP_COMMIT_WAIT_MS,
+								   PG_WAIT_EXTENSION);
+					ResetLatch(MyLatch);
+
+					if (rc & WL_POSTMASTER_DEATH)
+						proc_exit(1);
+
+					CHECK_FOR_INTERRUPTS();
+
+					/* we're usually called as the transaction commits, with interrupts held off */
+					if (QueryCancelPending || ProcDiePending)
+						ereport(ERROR,
+								(errcode(ERRCODE_QUERY_CANCELED),
+										errmsg("canceling wait for the group commit to %s", indexName)));
+				}
+			PG_CATCH();
+				{
+					/* give up our slots, leaving those a leader is working on for it to free */
+					LWLockAcquire(group_commit->lock, LW_EXCLUSIVE);
+					for (i = 0; i < nmine; i++) {
+						GroupCommitSlot *slot = &group_commit->slots[mine[i]];
+
+						if (slot->state == GROUP_COMMIT_CLAIMED)
+							slot->abandoned = true;
+						else
+							slot->state = GROUP_COMMIT_FREE;
+					}
+					LWLockRelease(group_commit->lock);
+					PG_RE_THROW();
+				}
+		PG_END_TRY();
+
+		LWLockAcquire(group_commit->lock, LW_EXCLUSIVE);
+	}
+	LWLockRelease(group_commit->lock);
+
+	pfree(mine);
+	return success;
+}
@@ -0,0 +1,25 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ZDB_GROUP_COMMIT_H__
+#define __ZDB_GROUP_COMMIT_H__
+
+#include "zombodb.h"
+
+void group_commit_init(void);
+bool group_commit_mark_committed(char *urlSpec, char *indexName, char *typeName, int compressionLevel, List *xids);
+
+#endif /* __ZDB_GROUP_COMMIT_H__ */
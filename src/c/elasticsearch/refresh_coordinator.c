@@ -0,0 +1,309 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Coalesced _refresh of the indices that writing transactions need refreshed before they
+ * commit.
+ *
+ * Every index has a count of the refreshes that have been started, and of those that have
+ * finished.  A backend that needs the index refreshed waits for the next one to start after it
+ * asked, and so also covers every other backend that asked before then.  Whichever backend
+ * finds nobody already taking care of it does that refresh, but not until at least
+ * 'zdb.refresh_coalesce_interval' has passed since the previous one, and then wakes everyone
+ * it was done for.
+ *
+ * It's only available when ZomboDB is in 'shared_preload_libraries'.  Otherwise, or whenever
+ * it can't be used, backends refresh the index themselves
+ */
+
+#include "refresh_coordinator.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "rest/rest.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/timestamp.h"
+
+#define REFRESH_SLOTS   256
+#define REFRESH_MAX_URL 256
+
+typedef struct RefreshSlot {
+	bool              inUse;
+	bool              leaderActive;  /* somebody is waiting to start, or running, the next refresh */
+	int               nwaiters;      /* backends, including the leader, waiting on a refresh of this index */
+	uint64            started;       /* how many refreshes have been started ... */
+	uint64            completed;     /* ... and have finished */
+	uint64            failed;        /* the last one that failed, if any */
+	TimestampTz       lastRefresh;   /* when the last one finished */
+	ConditionVariable cv;            /* broadcast whenever a refresh finishes */
+	char              urlSpec[REFRESH_MAX_URL];  /* the index's 'url' option */
+	char              indexName[NAMEDATALEN * 2];
+} RefreshSlot;
+
+typedef struct RefreshShared {
+	LWLock      *lock;          /* protects everything below, but the condition variables */
+	RefreshSlot slots[REFRESH_SLOTS];
+} RefreshShared;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static RefreshShared           *refresh_coordinator    = NULL;
+
+/* the slot we're waiting in, so we can give it back if we exit while waiting */
+static int  waiting_slot    = -1;
+static bool leading         = false;
+static bool exit_registered = false;
+
+static Size refresh_shmem_size(void) {
+	return MAXALIGN(sizeof(RefreshShared));
+}
+
+static void refresh_shmem_startup(void) {
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	refresh_coordinator = ShmemInitStruct("zombodb refresh coordinator", refresh_shmem_size(), &found);
+	if (!found) {
+		int i;
+
+		memset(refresh_coordinator, 0, refresh_shmem_size());
+		refresh_coordinator->lock = &(GetNamedLWLockTranche("zombodb_refresh_coordinator"))->lock;
+		for (i = 0; i < REFRESH_SLOTS; i++)
+			ConditionVariableInit(&refresh_coordinator->slots[i].cv);
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+void refresh_coordinator_init(void) {
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	RequestAddinShmemSpace(refresh_shmem_size());
+	RequestNamedLWLockTranche("zombodb_refresh_coordinator", 1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook      = refresh_shmem_startup;
+}
+
+bool refresh_coordinator_enabled(void) {
+	return refresh_coordinator != NULL;
+}
+
+/*
+ * Stop waiting in our slot, and if we were leading, let the others know nobody is anymore.
+ *
+ * Caller must hold the lock
+ */
+static void leave_slot(bool failed) {
+	RefreshSlot *slot = &refresh_coordinator->slots[waiting_slot];
+
+	if (leading) {
+		if (failed)
+			slot->failed = slot->started;
+		slot->leaderActive = false;
+		leading = false;
+		ConditionVariableBroadcast(&slot->cv);
+	}
+
+	slot->nwaiters--;
+	waiting_slot = -1;
+}
+
+/*lint -esym 715,code,arg ignore unused param */
+static void refresh_exit_callback(int code, Datum arg) {
+	if (waiting_slot < 0)
+		return;
+
+	LWLockAcquire(refresh_coordinator->lock, LW_EXCLUSIVE);
+	leave_slot(true);
+	LWLockRelease(refresh_coordinator->lock);
+}
+
+/*
+ * The slot of the index, or a new one for it, if there's room.
+ *
+ * Caller must hold the lock
+ */
+static int find_slot(char *urlSpec, char *indexName) {
+	int unused = -1;
+	int i;
+
+	for (i = 0; i < REFRESH_SLOTS; i++) {
+		RefreshSlot *slot = &refresh_coordinator->slots[i];
+
+		if (slot->inUse && strcmp(slot->urlSpec, urlSpec) == 0 && strcmp(slot->indexName, indexName) == 0)
+			return i;
+		else if (unused < 0 && (!slot->inUse || (slot->nwaiters == 0 && !slot->leaderActive)))
+			unused = i;
+	}
+
+	if (unused >= 0) {
+		RefreshSlot *slot = &refresh_coordinator->slots[unused];
+
+		/* nobody is waiting on this one, so it can be (re)used for our index */
+		slot->inUse        = true;
+		slot->leaderActive = false;
+		slot->nwaiters     = 0;
+		slot->started      = slot->completed = slot->failed = 0;
+		slot->lastRefresh  = 0;
+		strcpy(slot->urlSpec, urlSpec);
+		strcpy(slot->indexName, indexName);
+	}
+
+	return unused;
+}
+
+/*
+ * Wait out whatever's left of 'zdb.refresh_coalesce_interval' since the index was last refreshed,
+ * so everyone who asks in the meantime is covered by the one refresh
+ */
+static void wait_for_interval(TimestampTz lastRefresh) {
+	TimestampTz next = TimestampTzPlusMilliseconds(lastRefresh, zdb_refresh_coalesce_interval_guc);
+
+	for (;;) {
+		long secs;
+		int  usecs;
+		int  rc;
+
+		TimestampDifference(GetCurrentTimestamp(), next, &secs, &usecs);
+		if (secs == 0 && usecs == 0)
+			break;
+
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   secs * 1000 + (usecs + 999) / 1000, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+static void send_refresh(char *urlSpec, char *indexName, int compressionLevel) {
+	StringInfo request = makeStringInfo();
+	StringInfo response;
+
+	appendStringInfo(request, "%s%s/_refresh", rest_nodes_base_url(urlSpec), indexName);
+	response = rest_call("GET", request, NULL, compressionLevel);
+
+	freeStringInfo(response);
+	freeStringInfo(request);
+}
+
+/*
+ * Make sure the index is refreshed after now, sharing the refresh with any other backends that
+ * need the same.
+ *
+ * Returns false if that isn't possible, in which case the caller needs to refresh it itself
+ */
+bool refresh_coordinator_refresh(char *urlSpec, char *indexName, int compressionLevel) {
+	RefreshSlot   *slot;
+	uint64        target;
+	volatile bool success = false;
+
+	if (refresh_coordinator == NULL)
+		return false;
+	if (strlen(urlSpec) >= REFRESH_MAX_URL || strlen(indexName) >= NAMEDATALEN * 2)
+		return false;
+
+	if (!exit_registered) {
+		before_shmem_exit(refresh_exit_callback, (Datum) 0);
+		exit_registered = true;
+	}
+
+	LWLockAcquire(refresh_coordinator->lock, LW_EXCLUSIVE);
+	waiting_slot = find_slot(urlSpec, indexName);
+	if (waiting_slot < 0) {
+		/* every slot is busy */
+		LWLockRelease(refresh_coordinator->lock);
+		return false;
+	}
+
+	slot = &refresh_coordinator->slots[waiting_slot];
+	slot->nwaiters++;
+
+	/* only a refresh that starts after this covers what we've written */
+	target = slot->started + 1;
+
+	PG_TRY();
+			{
+				for (;;) {
+					if (slot->completed >= target) {
+						success = true;
+						break;
+					} else if (slot->failed >= target) {
+						break;
+					}
+
+					if (!slot->leaderActive) {
+						TimestampTz lastRefresh = slot->lastRefresh;
+						uint64      generation;
+
+						/* we're the leader, for everyone waiting on this index */
+						slot->leaderActive = true;
+						leading = true;
+						LWLockRelease(refresh_coordinator->lock);
+
+						wait_for_interval(lastRefresh);
+
+						LWLockAcquire(refresh_coordinator->lock, LW_EXCLUSIVE);
+						generation = ++slot->started;
+						LWLockRelease(refresh_coordinator->lock);
+
+						send_refresh(urlSpec, indexName, compressionLevel);
+
+						LWLockAcquire(refresh_coordinator->lock, LW_EXCLUSIVE);
+						slot->completed    = generation;
+						slot->lastRefresh  = GetCurrentTimestamp();
+						slot->leaderActive = false;
+						leading = false;
+						ConditionVariableBroadcast(&slot->cv);
+						continue;
+					}
+
+					/* someone else is leading, so wait for them */
+					ConditionVariablePrepareToSleep(&slot->cv);
+					LWLockRelease(refresh_coordinator->lock);
+
+					ConditionVariableSleep(&slot->cv, PG_WAIT_EXTENSION);
+					ConditionVariableCancelSleep();
+
+					LWLockAcquire(refresh_coordinator->lock, LW_EXCLUSIVE);
+				}
+			}
+		PG_CATCH();
+			{
+				/* we were interrupted, or our refresh failed */
+				ConditionVariableCancelSleep();
+				LWLockAcquire(refresh_coordinator->lock, LW_EXCLUSIVE);
+				leave_slot(true);
+				LWLockRelease(refresh_coordinator->lock);
+				PG_RE_THROW();
+			}
+	PG_END_TRY();
+
+	leave_slot(false);
+	LWLockRelease(refresh_coordinator->lock);
+
+	return success;
+}
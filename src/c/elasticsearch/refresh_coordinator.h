@@ -0,0 +1,29 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ZDB_REFRESH_COORDINATOR_H__
+#define __ZDB_REFRESH_COORDINATOR_H__
+
+#include "zombodb.h"
+
+/* defined in zdbam.c */
+extern int zdb_refresh_coalesce_interval_guc;
+
+void refresh_coordinator_init(void);
+bool refresh_coordinator_enabled(void);
+bool refresh_coordinator_refresh(char *urlSpec, char *indexName, int compressionLevel);
+
+#endif /* __ZDB_REFRESH_COORDINATOR_H__ */
@@ -0,0 +1,580 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "search_response.h"
+
+#include "mb/pg_wchar.h"
+#include "utils/memutils.h"
+
+#include <stdlib.h>
+
+/* tokenizer states */
+#define S_VALUE        0    /* expecting a value */
+#define S_ARRAY_FIRST  1    /* just after a '[', expecting a value or ']' */
+#define S_OBJECT_FIRST 2    /* just after a '{', expecting a key or '}' */
+#define S_KEY          3    /* after a ',' in an object, expecting a key */
+#define S_COLON        4
+#define S_AFTER_VALUE  5    /* expecting a ',' or the end of the container */
+#define S_STRING       6
+#define S_ESCAPE       7
+#define S_UNICODE      8
+#define S_NUMBER       9
+#define S_LITERAL      10
+#define S_DONE         11
+
+/* what a value means to us */
+#define T_NONE       0
+#define T_ROOT       1
+#define T_SCROLL_ID  2
+#define T_ERROR      3
+#define T_HITS       4    /* the top-level "hits" object */
+#define T_TOTAL      5    /* hits.total, which is either a number or an object with a "value" */
+#define T_HIT_ARRAY  6    /* hits.hits */
+#define T_HIT        7
+#define T_ID         8
+#define T_SCORE      9
+#define T_FIELDS     10
+#define T_CTID       11   /* fields.zdb_ctid */
+#define T_CTID_VALUE 12
+#define T_HIGHLIGHT  13
+#define T_SORT       14   /* the hit's sort values, for search_after */
+
+#define INITIAL_MAX_HITS 256
+
+#define is_json_space(c) ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+
+static void feed_char(SearchResponseParser *parser, char c);
+
+SearchResponseParser *search_response_create(MemoryContext hitsContext, bool wantIds, bool wantFields) {
+	SearchResponseParser *parser = palloc0(sizeof(SearchResponseParser));
+
+	parser->hitsContext = hitsContext;
+	parser->wantIds     = wantIds;
+	parser->wantFields  = wantFields;
+	parser->token       = makeStringInfo();
+	parser->capture     = makeStringInfo();
+
+	search_response_reset(parser);
+	return parser;
+}
+
+void search_response_free(SearchResponseParser *parser) {
+	pfree(parser->token->data);
+	pfree(parser->token);
+	pfree(parser->capture->data);
+	pfree(parser->capture);
+	pfree(parser);
+}
+
+/*
+ * Get ready for the next response.  Whatever was allocated in 'hitsContext' for the previous
+ * one is expected to have been freed by the caller
+ */
+void search_response_reset(SearchResponseParser *parser) {
+	parser->scrollId      = NULL;
+	parser->total         = 0;
+	parser->hasError      = false;
+	parser->hits          = NULL;
+	parser->nhits         = 0;
+	parser->maxhits       = 0;
+	parser->syntaxError   = NULL;
+	parser->state         = S_VALUE;
+	parser->depth         = 0;
+	parser->target        = T_NONE;
+	parser->inKey         = false;
+	parser->keepToken     = false;
+	parser->highSurrogate = 0;
+	parser->captureDepth  = -1;
+	resetStringInfo(parser->token);
+	resetStringInfo(parser->capture);
+}
+
+/*
+ * A RestResponseConsumer.  This is called from inside libcurl, so problems are only
+ * noted here and reported by search_response_finish()
+ */
+void search_response_consume(void *arg, const char *data, size_t len) {
+	SearchResponseParser *parser = (SearchResponseParser *) arg;
+	size_t               i;
+
+	for (i = 0; i < len && parser->syntaxError == NULL; i++)
+		feed_char(parser, data[i]);
+}
+
+/*
+ * Make sure we saw an entire, successful, response.  'responsePrefix' is what we have of the
+ * raw response, for error messages
+ */
+void search_response_finish(SearchResponseParser *parser, StringInfo responsePrefix) {
+	if (parser->syntaxError == NULL && parser->state != S_DONE)
+		parser->syntaxError = "unexpected end of response";
+
+	if (parser->syntaxError != NULL) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						errmsg("Error parsing search response: %s", parser->syntaxError),
+						errdetail("%s", responsePrefix->data)));
+	} else if (parser->hasError) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+						errmsg("%s", responsePrefix->data)));
+	}
+}
+
+static int key_target(SearchResponseParser *parser, int parent, const char *key) {
+	switch (parent) {
+		case T_ROOT:
+			if (strcmp(key, "_scroll_id") == 0)
+				return T_SCROLL_ID;
+			else if (strcmp(key, "hits") == 0)
+				return T_HITS;
+			else if (strcmp(key, "error") == 0)
+				return T_ERROR;
+			break;
+
+		case T_HITS:
+			if (strcmp(key, "total") == 0)
+				return T_TOTAL;
+			else if (strcmp(key, "hits") == 0)
+				return T_HIT_ARRAY;
+			break;
+
+		case T_TOTAL:
+			if (strcmp(key, "value") == 0)
+				return T_TOTAL;
+			break;
+
+		case T_HIT:
+			if (strcmp(key, "_id") == 0)
+				return parser->wantIds ? T_ID : T_NONE;
+			else if (strcmp(key, "_score") == 0)
+				return T_SCORE;
+			else if (strcmp(key, "fields") == 0)
+				return T_FIELDS;
+			else if (strcmp(key, "highlight") == 0)
+				return T_HIGHLIGHT;
+			else if (strcmp(key, "sort") == 0)
+				return T_SORT;
+			break;
+
+		case T_FIELDS:
+			if (strcmp(key, "zdb_ctid") == 0)
+				return T_CTID;
+			break;
+
+		default:
+			break;
+	}
+
+	return T_NONE;
+}
+
+/*
+ * what the value that's starting is, given where we are
+ */
+static int value_target(SearchResponseParser *parser) {
+	SearchResponseFrame *top;
+
+	if (parser->depth == 0)
+		return T_ROOT;
+
+	top = &parser->stack[parser->depth - 1];
+	if (!top->isArray)
+		return parser->target;    /* decided by its key */
+	else if (top->role == T_HIT_ARRAY)
+		return T_HIT;
+	else if (top->role == T_CTID && top->nelems == 0)
+		return T_CTID_VALUE;
+	return T_NONE;
+}
+
+static void add_hit(SearchResponseParser *parser) {
+	if (parser->nhits == parser->maxhits) {
+		if (parser->hits == NULL) {
+			parser->maxhits = INITIAL_MAX_HITS;
+			parser->hits    = MemoryContextAlloc(parser->hitsContext, sizeof(ElasticsearchHit) * parser->maxhits);
+		} else {
+			parser->maxhits *= 2;
+			parser->hits = repalloc(parser->hits, sizeof(ElasticsearchHit) * parser->maxhits);
+		}
+	}
+
+	memset(&parser->hits[parser->nhits++], 0, sizeof(ElasticsearchHit));
+}
+
+static void end_value(SearchResponseParser *parser) {
+	if (parser->depth == 0) {
+		parser->state = S_DONE;
+		return;
+	}
+
+	parser->stack[parser->depth - 1].nelems++;
+	parser->state = S_AFTER_VALUE;
+}
+
+static void start_container(SearchResponseParser *parser, int target, char c) {
+	SearchResponseFrame *frame;
+
+	if (parser->depth == SEARCH_RESPONSE_MAX_DEPTH) {
+		parser->syntaxError = "nested too deeply";
+		return;
+	}
+
+	switch (target) {
+		case T_ERROR:
+			parser->hasError = true;
+			target = T_NONE;
+			break;
+
+		case T_HIT:
+			add_hit(parser);
+			break;
+
+		case T_FIELDS:
+		case T_HIGHLIGHT:
+		case T_SORT:
+			if (parser->captureDepth < 0 && (target != T_FIELDS || parser->wantFields)) {
+				/* keep the json of this value, from here to its closing bracket */
+				parser->captureDepth  = parser->depth;
+				parser->captureTarget = target;
+				resetStringInfo(parser->capture);
+				appendStringInfoCharMacro(parser->capture, c);
+			}
+
+			if (target != T_FIELDS)
+				target = T_NONE;
+			break;
+
+		case T_SCROLL_ID:
+		case T_ID:
+		case T_SCORE:
+		case T_CTID_VALUE:
+			/* not what we expected, so ignore it */
+			target = T_NONE;
+			break;
+
+		default:
+			break;
+	}
+
+	frame = &parser->stack[parser->depth++];
+	frame->role    = target;
+	frame->isArray = c == '[';
+	frame->nelems  = 0;
+
+	parser->state = frame->isArray ? S_ARRAY_FIRST : S_OBJECT_FIRST;
+}
+
+static void end_container(SearchResponseParser *parser) {
+	parser->depth--;
+
+	if (parser->captureDepth == parser->depth) {
+		/* the closing bracket has already been added to the capture */
+		ElasticsearchHit *hit  = &parser->hits[parser->nhits - 1];
+		char             *json = MemoryContextStrdup(parser->hitsContext, parser->capture->data);
+
+		if (parser->captureTarget == T_FIELDS)
+			hit->fields = json;
+		else if (parser->captureTarget == T_SORT)
+			hit->sort = json;
+		else
+			hit->highlight = json;
+
+		parser->captureDepth = -1;
+	}
+
+	end_value(parser);
+}
+
+static void start_value(SearchResponseParser *parser, char c) {
+	parser->target = value_target(parser);
+	if (parser->target == T_ROOT && c != '{') {
+		parser->syntaxError = "not a json object";
+		return;
+	}
+
+	switch (c) {
+		case '{':
+		case '[':
+			start_container(parser, parser->target, c);
+			return;
+
+		case '"':
+			parser->inKey         = false;
+			parser->keepToken     = parser->target == T_SCROLL_ID || parser->target == T_ID;
+			parser->highSurrogate = 0;
+			resetStringInfo(parser->token);
+			parser->state = S_STRING;
+			return;
+
+		case 't':
+		case 'f':
+		case 'n':
+			resetStringInfo(parser->token);
+			appendStringInfoCharMacro(parser->token, c);
+			parser->state = S_LITERAL;
+			return;
+
+		default:
+			if (c == '-' || (c >= '0' && c <= '9')) {
+				resetStringInfo(parser->token);
+				appendStringInfoCharMacro(parser->token, c);
+				parser->state = S_NUMBER;
+				return;
+			}
+
+			parser->syntaxError = "unexpected character";
+			return;
+	}
+}
+
+/*
+ * A string, number, or literal just ended.  Keep it if it's something we want
+ */
+static void end_scalar(SearchResponseParser *parser) {
+	ElasticsearchHit *hit      = parser->nhits > 0 ? &parser->hits[parser->nhits - 1] : NULL;
+	char             *token    = parser->token->data;
+	bool             isNumber  = parser->state == S_NUMBER;
+
+	switch (parser->target) {
+		case T_SCROLL_ID:
+			if (parser->state == S_STRING)
+				parser->scrollId = MemoryContextStrdup(parser->hitsContext, token);
+			break;
+
+		case T_ERROR:
+			parser->hasError = true;
+			break;
+
+		case T_TOTAL:
+			if (isNumber)
+				parser->total = strtoull(token, NULL, 10);
+			break;
+
+		case T_ID:
+			if (hit != NULL && parser->state == S_STRING)
+				hit->id = MemoryContextStrdup(parser->hitsContext, token);
+			break;
+
+		case T_SCORE:
+			/* it's null when we didn't ask for scores */
+			if (hit != NULL && isNumber)
+				hit->score = (float4) strtod(token, NULL);
+			break;
+
+		case T_CTID_VALUE:
+			if (hit != NULL && isNumber) {
+				hit->ctid    = strtoull(token, NULL, 10);
+				hit->hasCtid = true;
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	end_value(parser);
+}
+
+static void end_string(SearchResponseParser *parser) {
+	if (parser->inKey) {
+		SearchResponseFrame *top = &parser->stack[parser->depth - 1];
+
+		parser->inKey  = false;
+		parser->target = parser->keepToken ? key_target(parser, top->role, parser->token->data) : T_NONE;
+		parser->state  = S_COLON;
+	} else {
+		end_scalar(parser);
+	}
+}
+
+/*
+ * we've collected all four hex digits of a \u escape
+ */
+static void end_unicode_escape(SearchResponseParser *parser) {
+	uint32        cp = parser->codepoint;
+	unsigned char utf8[8];
+
+	if (cp >= 0xD800 && cp <= 0xDBFF) {
+		/* the first half of a surrogate pair, so wait for the second */
+		parser->highSurrogate = cp;
+		return;
+	} else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+		cp = parser->highSurrogate != 0 ? 0x10000 + ((parser->highSurrogate - 0xD800) << 10) + (cp - 0xDC00) : 0xFFFD;
+	}
+	parser->highSurrogate = 0;
+
+	if (parser->keepToken && cp != 0) {
+		unicode_to_utf8((pg_wchar) cp, utf8);
+		appendBinaryStringInfo(parser->token, (char *) utf8, pg_utf_mblen(utf8));
+	}
+}
+
+static void feed_char(SearchResponseParser *parser, char c) {
+	if (parser->captureDepth >= 0)
+		appendStringInfoCharMacro(parser->capture, c);
+
+reprocess:
+	switch (parser->state) {
+		case S_VALUE:
+		case S_ARRAY_FIRST:
+			if (is_json_space(c))
+				return;
+			if (c == ']' && parser->state == S_ARRAY_FIRST)
+				end_container(parser);
+			else
+				start_value(parser, c);
+			return;
+
+		case S_OBJECT_FIRST:
+		case S_KEY:
+			if (is_json_space(c))
+				return;
+			if (c == '}' && parser->state == S_OBJECT_FIRST) {
+				end_container(parser);
+			} else if (c == '"') {
+				/* we only need to know the keys of the objects we care about */
+				parser->inKey         = true;
+				parser->keepToken     = parser->stack[parser->depth - 1].role != T_NONE;
+				parser->highSurrogate = 0;
+				resetStringInfo(parser->token);
+				parser->state = S_STRING;
+			} else {
+				parser->syntaxError = "expected an object key";
+			}
+			return;
+
+		case S_COLON:
+			if (is_json_space(c))
+				return;
+			if (c == ':')
+				parser->state = S_VALUE;
+			else
+				parser->syntaxError = "expected a colon";
+			return;
+
+		case S_AFTER_VALUE: {
+			SearchResponseFrame *top = &parser->stack[parser->depth - 1];
+
+			if (is_json_space(c))
+				return;
+			if (c == ',')
+				parser->state = top->isArray ? S_VALUE : S_KEY;
+			else if (c == (top->isArray ? ']' : '}'))
+				end_container(parser);
+			else
+				parser->syntaxError = "expected a comma or closing bracket";
+			return;
+		}
+
+		case S_STRING:
+			if (c == '"')
+				end_string(parser);
+			else if (c == '\\')
+				parser->state = S_ESCAPE;
+			else if (parser->keepToken)
+				appendStringInfoCharMacro(parser->token, c);
+			return;
+
+		case S_ESCAPE:
+			switch (c) {
+				case 'b':
+					c = '\b';
+					break;
+				case 'f':
+					c = '\f';
+					break;
+				case 'n':
+					c = '\n';
+					break;
+				case 'r':
+					c = '\r';
+					break;
+				case 't':
+					c = '\t';
+					break;
+				case 'u':
+					parser->nhex      = 0;
+					parser->codepoint = 0;
+					parser->state     = S_UNICODE;
+					return;
+				case '"':
+				case '\\':
+				case '/':
+					break;
+				default:
+					parser->syntaxError = "invalid escape sequence";
+					return;
+			}
+
+			if (parser->keepToken)
+				appendStringInfoCharMacro(parser->token, c);
+			parser->state = S_STRING;
+			return;
+
+		case S_UNICODE:
+			if (c >= '0' && c <= '9')
+				parser->codepoint = (parser->codepoint << 4) | (uint32) (c - '0');
+			else if (c >= 'a' && c <= 'f')
+				parser->codepoint = (parser->codepoint << 4) | (uint32) (c - 'a' + 10);
+			else if (c >= 'A' && c <= 'F')
+				parser->codepoint = (parser->codepoint << 4) | (uint32) (c - 'A' + 10);
+			else {
+				parser->syntaxError = "invalid unicode escape sequence";
+				return;
+			}
+
+			if (++parser->nhex == 4) {
+				end_unicode_escape(parser);
+				parser->state = S_STRING;
+			}
+			return;
+
+		case S_NUMBER:
+			if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+				appendStringInfoCharMacro(parser->token, c);
+				return;
+			}
+
+			/* this character belongs to whatever follows the number */
+			end_scalar(parser);
+			goto reprocess;
+
+		case S_LITERAL:
+			if (c >= 'a' && c <= 'z') {
+				appendStringInfoCharMacro(parser->token, c);
+				return;
+			}
+
+			if (strcmp(parser->token->data, "true") != 0 && strcmp(parser->token->data, "false") != 0 &&
+				strcmp(parser->token->data, "null") != 0) {
+				parser->syntaxError = "invalid literal";
+				return;
+			}
+
+			end_scalar(parser);
+			goto reprocess;
+
+		case S_DONE:
+			if (!is_json_space(c))
+				parser->syntaxError = "unexpected data after the response";
+			return;
+
+		default:
+			parser->syntaxError = "invalid parser state";
+			return;
+	}
+}
@@ -0,0 +1,85 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ZDB_SEARCH_RESPONSE_H__
+#define __ZDB_SEARCH_RESPONSE_H__
+
+#include "postgres.h"
+#include "lib/stringinfo.h"
+
+#define SEARCH_RESPONSE_MAX_DEPTH 64
+
+/*
+ * What we keep of each hit in a _search or _search/scroll response
+ */
+typedef struct ElasticsearchHit {
+	uint64 ctid;       /* fields.zdb_ctid[0] */
+	bool   hasCtid;    /* the zdb_aborted_xids documents don't have one */
+	float4 score;
+	char   *id;        /* only if asked for */
+	char   *fields;    /* the json of the hit's "fields" object, only if asked for */
+	char   *highlight; /* the json of the hit's "highlight" object, if it has one */
+	char   *sort;      /* the json of the hit's "sort" array, if it has one */
+} ElasticsearchHit;
+
+typedef struct SearchResponseFrame {
+	int  role;
+	bool isArray;
+	int  nelems;
+} SearchResponseFrame;
+
+/*
+ * An incremental tokenizer for search responses.  It's fed the response body as it comes off
+ * the wire (see rest_call_streaming()) and keeps only the parts of each hit we use, so we never
+ * have the entire response text, or a DOM of it, in memory
+ */
+typedef struct SearchResponseParser {
+	MemoryContext    hitsContext;   /* where 'hits', and everything they point to, are allocated */
+	bool             wantIds;
+	bool             wantFields;
+
+	/* the results */
+	char             *scrollId;
+	uint64           total;
+	bool             hasError;
+	ElasticsearchHit *hits;
+	int              nhits;
+	int              maxhits;
+	const char       *syntaxError;  /* non-NULL if the response wasn't json we understand */
+
+	/* tokenizer state */
+	int                 state;
+	int                 depth;
+	SearchResponseFrame stack[SEARCH_RESPONSE_MAX_DEPTH];
+	int                 target;     /* what the value we're in the middle of is */
+	bool                inKey;
+	bool                keepToken;
+	StringInfo          token;
+	int                 nhex;
+	uint32              codepoint;
+	uint32              highSurrogate;
+	int                 captureDepth;   /* -1 if we're not capturing */
+	int                 captureTarget;
+	StringInfo          capture;
+} SearchResponseParser;
+
+SearchResponseParser *search_response_create(MemoryContext hitsContext, bool wantIds, bool wantFields);
+void search_response_free(SearchResponseParser *parser);
+void search_response_reset(SearchResponseParser *parser);
+void search_response_consume(void *arg, const char *data, size_t len);
+void search_response_finish(SearchResponseParser *parser, StringInfo responsePrefix);
+
+#endif /* __ZDB_SEARCH_RESPONSE_H__ */
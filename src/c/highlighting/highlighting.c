@@ -369,8 +369,16 @@ Datum zdb_highlight(PG_FUNCTION_ARGS) {
 		QueryDesc     *currentQuery = linitial(currentQueryStack);
 		RangeTblEntry *rentry       = rt_fetch(var->varnoold, currentQuery->plannedstmt->rtable);
 		ZDBHighlightFieldnameData *field = palloc0(sizeof(ZDBHighlightFieldnameData));
+		ItemPointerData root;
 		memcpy(field->data, fieldName, Min(sizeof(ZDBHighlightFieldnameData), strlen(fieldName)));
 
+		if (fcinfo->flinfo->fn_extra == NULL)
+			fcinfo->flinfo->fn_extra = create_hot_root_cache(fcinfo->flinfo->fn_mcxt);
+
+		/* highlights are known by the root ctid of HOT chains */
+		if (find_hot_root_cached(fcinfo->flinfo->fn_extra, rentry->relid, ctid, &root))
+			ctid = &root;
+
 		PG_RETURN_DATUM(highlight_lookup_highlights(rentry->relid, ctid, field));
 	} else {
 		elog(ERROR, "zdb_highlight()'s first argument is not a direct table ctid column reference");
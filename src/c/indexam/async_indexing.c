@@ -0,0 +1,497 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_indexing.h"
+#include "zdbam.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/transam.h"
+#include "access/xact.h"
+#include "catalog/index.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_type.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/bufmgr.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/procarray.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+#include "utils/tqual.h"
+
+/* the session-level advisory lock held by the one worker that's allowed to run in each database */
+#define ASYNC_WORKER_LOCK_KEY INT64CONST(0x7a64625f6173796e)
+
+/* how often, in milliseconds, a backend queueing changes checks that a worker is running */
+#define ASYNC_WORKER_CHECK_INTERVAL 10000
+
+/* how long, in milliseconds, the worker waits for more work after the queue is empty before exiting */
+#define ASYNC_WORKER_IDLE_TIMEOUT 60000
+
+/* how long, in seconds, Postgres waits to restart a worker that exited with an error */
+#define ASYNC_WORKER_RESTART_INTERVAL 10
+
+#define ASYNC_QUEUE_NATTS 3
+
+typedef struct AsyncQueueEntry {
+	ItemPointerData queueCtid;  /* the zdb.async_queue row itself */
+	Oid             indexRelid;
+	ItemPointerData heapCtid;
+} AsyncQueueEntry;
+
+typedef struct AsyncShipState {
+	Relation                 heapRel;
+	IndexInfo                *indexInfo;
+	EState                   *estate;
+	TupleTableSlot           *slot;
+	BlockNumber              nblocks;
+	ElasticsearchBulkContext *esContext;
+	MemoryContext            scratch;
+} AsyncShipState;
+
+static volatile sig_atomic_t got_sighup = false;
+
+static Oid async_queue_relid(bool missing_ok) {
+	Oid namespaceId = get_namespace_oid("zdb", missing_ok);
+
+	if (!OidIsValid(namespaceId))
+		return InvalidOid;
+
+	return get_relname_relid("async_queue", namespaceId);
+}
+
+/*
+ * Make sure there's a worker running in this database to drain the queue.  A worker
+ * holds ASYNC_WORKER_LOCK_KEY for as long as it's running, so if we can get it ourselves,
+ * there isn't one
+ */
+static void start_worker_if_necessary(void) {
+	static TimestampTz last_check = 0;
+	TimestampTz        now        = GetCurrentStatementStartTimestamp();
+	BackgroundWorker   worker;
+
+	if (!TimestampDifferenceExceeds(last_check, now, ASYNC_WORKER_CHECK_INTERVAL))
+		return;
+	last_check = now;
+
+	if (!DatumGetBool(DirectFunctionCall1(pg_try_advisory_lock_int8, Int64GetDatum(ASYNC_WORKER_LOCK_KEY))))
+		return;
+	(void) DirectFunctionCall1(pg_advisory_unlock_int8, Int64GetDatum(ASYNC_WORKER_LOCK_KEY));
+
+	memset(&worker, 0, sizeof(worker));
+	snprintf(worker.bgw_name, BGW_MAXLEN, "zombodb async indexing worker");
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "zombodb");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "zdb_async_worker_main");
+	worker.bgw_flags        = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time   = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = ASYNC_WORKER_RESTART_INTERVAL;
+	worker.bgw_main_arg     = ObjectIdGetDatum(MyDatabaseId);
+	worker.bgw_notify_pid   = 0;
+
+	if (!RegisterDynamicBackgroundWorker(&worker, NULL)) {
+		ereport(WARNING,
+				(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+						errmsg("could not start ZomboDB's async indexing worker"),
+						errdetail("Changes will remain in zdb.async_queue until a worker can be started"),
+						errhint("You might need to increase max_worker_processes")));
+	}
+}
+
+/*
+ * Queue a change to the row at 'ctid' for the worker to send to Elasticsearch.  The queue
+ * row is written as part of the current transaction, so it only becomes visible to the
+ * worker if we commit
+ */
+void zdb_async_enqueue(Relation indexRel, ItemPointer ctid) {
+	Oid       queueRelid = async_queue_relid(false);
+	Relation  queueRel;
+	Datum     values[ASYNC_QUEUE_NATTS];
+	bool      nulls[ASYNC_QUEUE_NATTS];
+	HeapTuple tuple;
+
+	if (!OidIsValid(queueRelid))
+		elog(ERROR, "zdb.async_queue does not exist");
+
+	queueRel = heap_open(queueRelid, RowExclusiveLock);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = ObjectIdGetDatum(RelationGetRelid(indexRel));
+	values[1] = ItemPointerGetDatum(ctid);
+	values[2] = TimestampTzGetDatum(GetCurrentStatementStartTimestamp());
+
+	tuple = heap_form_tuple(RelationGetDescr(queueRel), values, nulls);
+	simple_heap_insert(queueRel, tuple);
+	heap_freetuple(tuple);
+
+	heap_close(queueRel, NoLock);
+
+	start_worker_if_necessary();
+}
+
+/*
+ * Follow the HOT chain rooted at ctid, which is the ctid by which we know the whole chain, to
+ * its last member whose inserting transaction committed.  That's what the row's document
+ * should describe, but with the xmin of the chain's first member
+ */
+static bool find_hot_chain_member(AsyncShipState *state, ItemPointer ctid, ItemPointer member, TransactionId *xmin, bool *inProgress) {
+	BlockNumber   blkno     = ItemPointerGetBlockNumber(ctid);
+	OffsetNumber  offnum    = ItemPointerGetOffsetNumber(ctid);
+	TransactionId priorXmax = InvalidTransactionId;
+	bool          atRoot    = true;
+	bool          found     = false;
+	Buffer        buffer;
+	Page          page;
+
+	*inProgress = false;
+
+	/* VACUUM might have truncated the heap out from under the queued ctid */
+	if (blkno >= state->nblocks)
+		return false;
+
+	buffer = ReadBuffer(state->heapRel, blkno);
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buffer);
+
+	for (;;) {
+		HeapTupleHeader htup;
+		TransactionId   memberXmin;
+		ItemId          lp;
+
+		if (offnum < FirstOffsetNumber || offnum > PageGetMaxOffsetNumber(page))
+			break;
+
+		lp = PageGetItemId(page, offnum);
+		if (atRoot && ItemIdIsRedirected(lp)) {
+			/* pruning left the root pointing at the rest of the chain */
+			offnum = ItemIdGetRedirect(lp);
+			atRoot = false;
+			continue;
+		} else if (!ItemIdIsNormal(lp)) {
+			break;
+		}
+
+		htup       = (HeapTupleHeader) PageGetItem(page, lp);
+		memberXmin = HeapTupleHeaderGetXmin(htup);
+		atRoot     = false;
+
+		if (TransactionIdIsValid(priorXmax) && !TransactionIdEquals(priorXmax, memberXmin))
+			break;  /* the slot was reused by something outside the chain */
+
+		if (TransactionIdIsInProgress(memberXmin)) {
+			/* the transaction that's still running will queue the row itself */
+			*inProgress = !found;
+			break;
+		} else if (!TransactionIdDidCommit(memberXmin)) {
+			break;
+		}
+
+		if (!found)
+			*xmin = memberXmin;
+		ItemPointerSet(member, blkno, offnum);
+		found = true;
+
+		if (!HeapTupleHeaderIsHotUpdated(htup))
+			break;
+
+		priorXmax = HeapTupleHeaderGetUpdateXid(htup);
+		offnum    = ItemPointerGetOffsetNumber(&htup->t_ctid);
+	}
+
+	UnlockReleaseBuffer(buffer);
+	return found;
+}
+
+/*
+ * Send the current state of the heap tuple at 'ctid' to Elasticsearch.
+ *
+ * Every queued entry was committed by the time we see it, so whatever is at 'ctid' now
+ * is at least as new as the change that queued it and we send it in its entirety, xmax included.
+ * That makes shipping the same ctid more than once harmless, regardless of order.
+ */
+static void ship_tuple(AsyncShipState *state, ItemPointer ctid) {
+	HeapTupleData   tuple;
+	Buffer          buffer;
+	ItemPointerData member;
+	TransactionId   xmin       = InvalidTransactionId;
+	TransactionId   xmax       = InvalidTransactionId;
+	CommandId       cid        = FirstCommandId;
+	Datum           values[INDEX_MAX_KEYS];
+	bool            isnull[INDEX_MAX_KEYS];
+	bool            inProgress = false;
+	bool            found      = false;
+
+	if (find_hot_chain_member(state, ctid, &member, &xmin, &inProgress)) {
+		tuple.t_self = member;
+		found = heap_fetch(state->heapRel, SnapshotAny, &tuple, &buffer, false, NULL);
+	} else if (inProgress) {
+		return;
+	}
+
+	if (!found) {
+		/* the row is gone, so its document should be too */
+		ElasticsearchBulkDeleteRow(state->esContext, ctid);
+		return;
+	}
+
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	cid = HeapTupleHeaderGetRawCommandId(tuple.t_data);
+	if (!(tuple.t_data->t_infomask & HEAP_XMAX_INVALID) && !HEAP_XMAX_IS_LOCKED_ONLY(tuple.t_data->t_infomask) &&
+		!HeapTupleHeaderIsHotUpdated(tuple.t_data))
+		xmax = HeapTupleHeaderGetUpdateXid(tuple.t_data);
+	LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+
+	/* a deleting transaction that's still running will queue the row again when it commits */
+	if (TransactionIdIsValid(xmax) && (TransactionIdIsInProgress(xmax) || !TransactionIdDidCommit(xmax)))
+		xmax = InvalidTransactionId;
+
+	ExecStoreTuple(&tuple, state->slot, buffer, false);
+	FormIndexDatum(state->indexInfo, state->slot, state->estate, values, isnull);
+
+	if (!isnull[1]) {
+		/* the document is always known by the root of the chain */
+		/* and only carries a cmax when it has an xmax to go with it */
+		ElasticsearchBulkInsertRecord(state->esContext, state->scratch, ctid, values[1], cid,
+									  TransactionIdIsValid(xmax) ? cid : InvalidCommandId, convert_xid(xmin),
+									  TransactionIdIsValid(xmax) ? convert_xid(xmax) : InvalidTransactionId);
+	}
+
+	ExecClearTuple(state->slot);
+	ReleaseBuffer(buffer);
+	ResetPerTupleExprContext(state->estate);
+	MemoryContextReset(state->scratch);
+}
+
+/*
+ * Ship the entries queued for one index, which are sorted by ctid, and then remove them from the queue
+ */
+static void ship_index_entries(Relation queueRel, AsyncQueueEntry *entries, int nentries) {
+	Relation       indexRel;
+	AsyncShipState state;
+	int            i;
+
+	indexRel = try_relation_open(entries[0].indexRelid, RowExclusiveLock);
+	if (indexRel != NULL && indexRel->rd_rel->relkind != RELKIND_INDEX) {
+		/* the Oid has since been reused by something else */
+		relation_close(indexRel, RowExclusiveLock);
+		indexRel = NULL;
+	}
+
+	if (indexRel != NULL) {
+		state.heapRel   = heap_open(indexRel->rd_index->indrelid, AccessShareLock);
+		state.indexInfo = BuildIndexInfo(indexRel);
+		state.estate    = CreateExecutorState();
+		state.slot      = MakeSingleTupleTableSlot(RelationGetDescr(state.heapRel));
+		state.nblocks   = RelationGetNumberOfBlocks(state.heapRel);
+		state.scratch   = AllocSetContextCreate(CurrentMemoryContext, "zdb async scratch context",
+												ALLOCSET_DEFAULT_MINSIZE,
+												ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE);
+		state.esContext = ElasticsearchStartBulkProcess(indexRel, NULL, NULL, false);
+
+		/* nothing we send belongs to an in-progress transaction */
+		state.esContext->trackTransactions = false;
+
+		GetPerTupleExprContext(state.estate)->ecxt_scantuple = state.slot;
+
+		for (i = 0; i < nentries; i++) {
+			CHECK_FOR_INTERRUPTS();
+
+			if (i > 0 && ItemPointerEquals(&entries[i].heapCtid, &entries[i - 1].heapCtid))
+				continue;
+
+			ship_tuple(&state, &entries[i].heapCtid);
+		}
+
+		ElasticsearchFinishBulkProcess(state.esContext, true);
+
+		elog(ZDB_LOG_LEVEL, "[zombodb] shipped %d queued changes to %s", nentries, RelationGetRelationName(indexRel));
+
+		ExecDropSingleTupleTableSlot(state.slot);
+		FreeExecutorState(state.estate);
+		MemoryContextDelete(state.scratch);
+		heap_close(state.heapRel, AccessShareLock);
+		relation_close(indexRel, RowExclusiveLock);
+	}
+
+	/* and if the index no longer exists, its entries are simply discarded */
+	for (i = 0; i < nentries; i++) {
+		simple_heap_delete(queueRel, &entries[i].queueCtid);
+	}
+}
+
+/*
+ * Ship, in one transaction, up to zdb.async_batch_size of the oldest entries in the queue.
+ * Returns the number of entries processed
+ */
+static int process_queue(void) {
+	Oid             queueRelid;
+	Relation        queueRel;
+	AsyncQueueEntry *entries = NULL;
+	int             nentries = 0;
+	int             i;
+	Oid             argtypes[1] = {INT4OID};
+	Datum           args[1];
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "shipping zdb.async_queue");
+
+	queueRelid = async_queue_relid(true);
+	if (!OidIsValid(queueRelid)) {
+		/* the extension has been dropped */
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		proc_exit(0);
+	}
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect() failed");
+
+	/*
+	 * The oldest entries of each index come from the (indexrelid, queued) index, with the
+	 * distinct indexrelids found by skipping through that same index, and the oldest of those
+	 * make up the batch
+	 */
+	args[0] = Int32GetDatum(zdb_async_batch_size_guc);
+	if (SPI_execute_with_args("WITH RECURSIVE idx AS ( "
+							  "        SELECT min(indexrelid) AS indexrelid FROM zdb.async_queue "
+							  "     UNION ALL "
+							  "        SELECT (SELECT min(indexrelid) FROM zdb.async_queue WHERE indexrelid > idx.indexrelid) "
+							  "          FROM idx "
+							  "         WHERE idx.indexrelid IS NOT NULL) "
+							  "SELECT queue_ctid, indexrelid, heap_ctid "
+							  "  FROM (SELECT q.queue_ctid, idx.indexrelid, q.heap_ctid "
+							  "          FROM idx, "
+							  "               LATERAL (SELECT ctid AS queue_ctid, heap_ctid, queued "
+							  "                          FROM zdb.async_queue "
+							  "                         WHERE indexrelid = idx.indexrelid "
+							  "                      ORDER BY queued "
+							  "                         LIMIT $1) q "
+							  "      ORDER BY q.queued "
+							  "         LIMIT $1) b "
+							  "ORDER BY indexrelid, heap_ctid",
+							  1, argtypes, args, NULL, true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "Problem reading zdb.async_queue");
+
+	nentries = (int) SPI_processed;
+	if (nentries > 0)
+		entries = SPI_palloc(sizeof(AsyncQueueEntry) * nentries);
+
+	for (i = 0; i < nentries; i++) {
+		HeapTuple tuple   = SPI_tuptable->vals[i];
+		TupleDesc tupdesc = SPI_tuptable->tupdesc;
+		bool      isnull;
+
+		entries[i].queueCtid  = *DatumGetItemPointer(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+		entries[i].indexRelid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+		entries[i].heapCtid   = *DatumGetItemPointer(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+	}
+
+	SPI_finish();
+
+	queueRel = heap_open(queueRelid, RowExclusiveLock);
+	for (i = 0; i < nentries;) {
+		int end = i;
+
+		while (end < nentries && entries[end].indexRelid == entries[i].indexRelid)
+			end++;
+
+		ship_index_entries(queueRel, &entries[i], end - i);
+		i = end;
+	}
+	heap_close(queueRel, RowExclusiveLock);
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_stat(false);
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return nentries;
+}
+
+/*lint -esym 715,postgres_signal_arg ignore unused param */
+static void async_worker_sighup(SIGNAL_ARGS) {
+	int save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * entry point for the async indexing background worker.  Called by name from Postgres'
+ * background worker infrastructure with the Oid of the database it should work in
+ */
+void zdb_async_worker_main(Datum arg) {
+	TimestampTz last_work;
+	bool        got_lock;
+
+	pqsignal(SIGHUP, async_worker_sighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnectionByOid(DatumGetObjectId(arg), InvalidOid);
+
+	StartTransactionCommand();
+	got_lock = DatumGetBool(DirectFunctionCall1(pg_try_advisory_lock_int8, Int64GetDatum(ASYNC_WORKER_LOCK_KEY)));
+	CommitTransactionCommand();
+
+	if (!got_lock) {
+		/* another worker is already running in this database.  Exiting cleanly means we won't be restarted */
+		proc_exit(0);
+	}
+
+	last_work = GetCurrentTimestamp();
+	for (;;) {
+		int nprocessed;
+		int rc;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_sighup) {
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		nprocessed = process_queue();
+		if (nprocessed > 0) {
+			last_work = GetCurrentTimestamp();
+
+			/* if we filled a batch there's probably more waiting, so don't sleep */
+			if (nprocessed >= zdb_async_batch_size_guc)
+				continue;
+		} else if (TimestampDifferenceExceeds(last_work, GetCurrentTimestamp(), ASYNC_WORKER_IDLE_TIMEOUT)) {
+			/* backends will start a new worker when they next queue something */
+			proc_exit(0);
+		}
+
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, zdb_async_lag_guc, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+}
@@ -0,0 +1,38 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ZDB_ASYNC_INDEXING_H__
+#define __ZDB_ASYNC_INDEXING_H__
+
+#include "postgres.h"
+#include "storage/itemptr.h"
+#include "utils/relcache.h"
+
+/*
+ * Indexes created WITH (async=true) don't talk to Elasticsearch from the backend making changes.
+ * Instead, the ctid of every row that's inserted, updated, or deleted is appended to the
+ * zdb.async_queue table as part of the same transaction.  A per-database background worker
+ * periodically ships whatever committed entries it finds to Elasticsearch and removes them
+ */
+
+/* defined in zdbam.c */
+extern int zdb_async_lag_guc;
+extern int zdb_async_batch_size_guc;
+
+void zdb_async_enqueue(Relation indexRel, ItemPointer ctid);
+PGDLLEXPORT void zdb_async_worker_main(Datum arg);
+
+#endif /* __ZDB_ASYNC_INDEXING_H__ */
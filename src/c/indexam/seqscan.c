@@ -31,6 +31,7 @@ typedef struct CmpFuncEntry {
 	/*lint -e754 ignore unused member */
 	char key[CMP_FUNC_ENTRY_KEYSIZE];
 	HTAB *hash;
+	HotRootCache *hotRoots;
 } CmpFuncEntry;
 
 PG_FUNCTION_INFO_V1(zdb_anyelement_cmpfunc_array_should);
@@ -86,8 +87,8 @@ static HTAB *create_ctid_map(Relation heapRel, Relation indexRel, ZDBQueryType *
 	HTAB                       *scoreHash     = scoring_create_lookup_table(memoryContext, "scores from seqscan");
 	HTAB                       *highlightHash = highlight_create_lookup_table(memoryContext, "highlights from seqscan");
 
-	scroll = ElasticsearchOpenScroll(indexRel, query, false, 0,
-									 extract_highlight_info(NULL, RelationGetRelid(heapRel)), NULL, 0);
+	scroll = ElasticsearchOpenSlicedScroll(indexRel, query, false,
+										   extract_highlight_info(NULL, RelationGetRelid(heapRel)), NULL, 0);
 
 	scoring_register_callback(RelationGetRelid(heapRel), scoring_cb, scoreHash, memoryContext);
 	highlight_register_callback(RelationGetRelid(heapRel), highlight_cb, highlightHash, memoryContext);
@@ -136,11 +137,13 @@ static Datum do_cmpfunc(ItemPointer ctid, ZDBQueryType *userQuery, FmgrInfo *fli
 		hash = flinfo->fn_extra = hash_create("seqscan", 64, &ctl, HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
 		entry       = hash_search(hash, &key, HASH_ENTER, &found);
 		entry->hash = NULL;
+		entry->hotRoots = NULL;
 	} else {
 		entry = hash_search(hash, &key, HASH_FIND, &found);
 		if (!found) {
 			entry = hash_search(hash, &key, HASH_ENTER, &found);
 			entry->hash = NULL;
+			entry->hotRoots = NULL;
 		}
 	}
 
@@ -155,6 +158,7 @@ static Datum do_cmpfunc(ItemPointer ctid, ZDBQueryType *userQuery, FmgrInfo *fli
 		heapRel  = relation_open(heapRelId, AccessShareLock);
 		indexRel = find_zombodb_index(heapRel);
 		entry->hash = create_ctid_map(heapRel, indexRel, userQuery, CurrentMemoryContext);
+		entry->hotRoots = create_hot_root_cache(CurrentMemoryContext);
 		relation_close(indexRel, AccessShareLock);
 		relation_close(heapRel, AccessShareLock);
 	}
@@ -163,6 +167,14 @@ static Datum do_cmpfunc(ItemPointer ctid, ZDBQueryType *userQuery, FmgrInfo *fli
 	/*lint -e534 ignore return value */
 	hash_search(entry->hash, ctid, HASH_FIND, &found);
 
+	if (!found) {
+		/* it might be a HOT-updated version of a row, which Elasticsearch knows by its root ctid */
+		ItemPointerData root;
+
+		if (find_hot_root_cached(entry->hotRoots, heapRelId, ctid, &root))
+			hash_search(entry->hash, &root, HASH_FIND, &found);
+	}
+
 	MemoryContextSwitchTo(oldContext);
 
 	PG_RETURN_BOOL(found);
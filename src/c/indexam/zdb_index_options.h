@@ -20,6 +20,8 @@
 #include "postgres.h"
 #include "utils/relcache.h"
 
+#include "rest/nodes.h"
+
 #define ZDB_STRATEGY_SINGLE 1
 #define ZDB_STRATEGY_ARRAY_SHOULD 2
 #define ZDB_STRATEGY_ARRAY_MUST 3
@@ -39,7 +41,10 @@ typedef struct {
 	int   aliasOffset;
 	int   uuidOffset;
 	int   optimizeAfter;
+	int   parallelBuildWorkers;
+	int   bulkFormatOffset;
 	bool  llapi;
+	bool  async;
 } ZDBIndexOptions;
 
 #define ZDBIndexOptionsGetUrlMacro(relation) \
@@ -51,7 +56,10 @@ extern char *zdb_default_elasticsearch_url_guc;
 extern int  zdb_default_row_estimation_guc;
 extern int  zdb_default_replicas_guc;
 
-static inline char *ZDBIndexOptionsGetUrl(Relation rel) {
+/*
+ * The 'url' option as written, which might be a comma-separated list of nodes
+ */
+static inline char *ZDBIndexOptionsGetUrlSpec(Relation rel) {
 	char *url = ZDBIndexOptionsGetUrlMacro(rel);
 
 	url = strcmp("default", url) == 0 ? zdb_default_elasticsearch_url_guc : url;
@@ -63,6 +71,13 @@ static inline char *ZDBIndexOptionsGetUrl(Relation rel) {
 	return url;
 }
 
+/*
+ * The base url of the Elasticsearch node requests for this index should be made against
+ */
+static inline char *ZDBIndexOptionsGetUrl(Relation rel) {
+	return rest_nodes_base_url(ZDBIndexOptionsGetUrlSpec(rel));
+}
+
 #define ZDBIndexOptionsGetTypeName(relation) \
     ((relation)->rd_options && ((ZDBIndexOptions *) (relation)->rd_options)->typeNameValueOffset > 0 ? \
       (char *) ((ZDBIndexOptions *) (relation)->rd_options) + ((ZDBIndexOptions *) (relation)->rd_options)->typeNameValueOffset : ("doc"))
@@ -97,7 +112,17 @@ static inline char *ZDBIndexOptionsGetUrl(Relation rel) {
 #define ZDBIndexOptionsGetLLAPI(relation) \
     ((bool) ((relation)->rd_options ? ((ZDBIndexOptions *) (relation)->rd_options)->llapi : false))
 
+#define ZDBIndexOptionsGetAsync(relation) \
+    ((bool) ((relation)->rd_options ? ((ZDBIndexOptions *) (relation)->rd_options)->async : false))
+
 #define ZDBIndexOptionsGetOptimizeAfter(relation) \
     ((uint64) ((relation)->rd_options ? ((ZDBIndexOptions *) (relation)->rd_options)->optimizeAfter : 0))
 
+#define ZDBIndexOptionsGetParallelBuildWorkers(relation) \
+    ((relation)->rd_options ? ((ZDBIndexOptions *) (relation)->rd_options)->parallelBuildWorkers : 0)
+
+#define ZDBIndexOptionsGetBulkFormat(relation) \
+    ((relation)->rd_options && ((ZDBIndexOptions *) (relation)->rd_options)->bulkFormatOffset > 0 ? \
+      (char *) ((ZDBIndexOptions *) (relation)->rd_options) + ((ZDBIndexOptions *) (relation)->rd_options)->bulkFormatOffset : ("json"))
+
 #endif /* __ZDB_ZDB_INDEX_OPTIONS_H__ */
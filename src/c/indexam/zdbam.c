@@ -19,10 +19,13 @@
 #include "elasticsearch/querygen.h"
 #include "highlighting/highlighting.h"
 #include "scoring/scoring.h"
+#include "indexam/async_indexing.h"
 #include "indexam/create_index.h"
 
 #include "access/amapi.h"
+#include "access/heapam.h"
 #include "access/htup_details.h"
+#include "access/parallel.h"
 #include "access/reloptions.h"
 #include "access/reloptions.h"
 #include "access/relscan.h"
@@ -72,6 +75,7 @@
 #include "commands/view.h"
 #include "executor/spi.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/cost.h"
@@ -83,9 +87,12 @@
 #include "rewrite/rewriteDefine.h"
 #include "rewrite/rewriteRemove.h"
 #include "storage/bufmgr.h"
+#include "storage/condition_variable.h"
+#include "storage/dsm.h"
 #include "storage/fd.h"
 #include "storage/lmgr.h"
 #include "storage/procarray.h"
+#include "storage/spin.h"
 #include "tcop/pquery.h"
 #include "tcop/utility.h"
 #include "tcop/utility.h"
@@ -108,12 +115,65 @@ static const struct config_enum_entry zdb_log_level_options[] = {
 		{NULL, 0,            false}
 };
 
+/* shm_toc key for the ZDBParallelBuildShared struct */
+#define PARALLEL_KEY_ZDB_BUILD UINT64CONST(0xA000000000000001)
+
+/* how many heap blocks a parallel build participant claims at a time */
+#define PARALLEL_BUILD_CHUNK_SIZE 256
+
+/* how many aborted xids VACUUM counts the references to concurrently */
+#define VACUUM_COUNT_BATCH_SIZE 32
+
 typedef struct ZDBBuildStateData {
 	double                   indtuples;
 	ElasticsearchBulkContext *esContext;
 	MemoryContext            memoryContext;
 }                                     ZDBBuildStateData;
 
+/*
+ * state shared, via DSM, between the leader and workers of a parallel CREATE INDEX.
+ * Participants claim ranges of PARALLEL_BUILD_CHUNK_SIZE heap blocks until
+ * the heap is exhausted and then add their tuple counts to the totals
+ */
+typedef struct ZDBParallelBuildShared {
+	Oid         heaprelid;
+	Oid         indexrelid;
+	char        esIndexName[NAMEDATALEN * 2];
+	BlockNumber nblocks;
+
+	slock_t     mutex;  /* protects everything below */
+	BlockNumber nextBlock;
+	double      reltuples;
+	double      indtuples;
+}                                     ZDBParallelBuildShared;
+
+/*
+ * state shared by the participants of a parallel index scan.  The leader sends its changes
+ * to the index and publishes the query DSL, in a DSM segment, for the workers to run too.
+ * Each participant then claims slices of that query's scroll until they're all taken
+ */
+typedef struct ZDBParallelScanState {
+	slock_t           mutex;      /* protects everything below */
+	ConditionVariable cv;         /* signalled when the leader publishes its query */
+	bool              published;
+	dsm_handle        query;
+	uint64            limit;
+	int               nslices;
+	int               nextSlice;
+}                                     ZDBParallelScanState;
+
+/*
+ * A row our UPDATE/DELETE triggers have seen, but whose xmax can't be set in Elasticsearch
+ * until we know the UPDATE wasn't a HOT update -- in which case the document, which
+ * is known by the root ctid of the HOT chain, still describes the row
+ */
+typedef struct ZDBPendingUpdate {
+	ItemPointerData member;
+	ItemPointerData root;
+	CommandId       cmax;
+	uint64          xmax;
+}                                     ZDBPendingUpdate;
+
 typedef struct ZDBScanContext {
 	bool                       needsInit;
 	ElasticsearchScrollContext *scrollContext;
@@ -122,6 +182,13 @@ typedef struct ZDBScanContext {
 	bool                       wantScores;
 	bool                       wantHighlights;
 	ZDBQueryType               *query;
+	ZDBQueryType               *sortedQuery;    /* our copy of 'query' with a Sort above us pushed into it */
+
+	/* for a parallel index scan */
+	dsm_segment                *querySegment;
+	char                       *parallelQuery;
+	uint64                     limit;
+	List                       *highlights;
 }                                     ZDBScanContext;
 
 PG_FUNCTION_INFO_V1(zdb_delete_trigger);
@@ -129,7 +196,10 @@ PG_FUNCTION_INFO_V1(zdb_update_trigger);
 
 void zdb_aminit(void);
 bool zdbamvalidate(Oid opclassoid);
+void zdb_parallel_build_main(dsm_segment *seg, shm_toc *toc);
 static IndexBuildResult *ambuild(Relation heapRelation, Relation indexRelation, IndexInfo *indexInfo);
+static double parallel_build(Relation heapRelation, Relation indexRelation, IndexInfo *indexInfo, char *indexName, int nworkers, ZDBBuildStateData *buildstate);
+static void parallel_build_scan(ZDBParallelBuildShared *shared, Relation heapRelation, Relation indexRelation, IndexInfo *indexInfo, ZDBBuildStateData *buildstate);
 static void ambuildempty(Relation indexRelation);
 static bool aminsert(Relation indexRelation, Datum *values, bool *isnull, ItemPointer heap_tid, Relation heapRelation, IndexUniqueCheck checkUnique, IndexInfo *indexInfo);
 static IndexBulkDeleteResult *ambulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats, IndexBulkDeleteCallback callback, void *callback_state);
@@ -142,10 +212,16 @@ static void amrescan(IndexScanDesc scan, ScanKey keys, int nkeys, ScanKey orderb
 static bool amgettuple(IndexScanDesc scan, ScanDirection direction);
 static void amendscan(IndexScanDesc scan);
 static int64 amgetbitmap(IndexScanDesc scan, TIDBitmap *tbm);
+static Size amestimateparallelscan(void);
+static void aminitparallelscan(void *target);
+static void amparallelrescan(IndexScanDesc scan);
 
 static void zdbbuildCallback(Relation indexRel, HeapTuple htup, Datum *values, bool *isnull, bool tupleIsAlive, void *state);
 static void index_record(ElasticsearchBulkContext *esContext, MemoryContext scratchContext, ItemPointer ctid, Datum record, HeapTuple htup);
 
+static bool resolve_pending_update(ZDBIndexChangeContext *context, Relation heapRel, ZDBPendingUpdate *pending);
+static void resolve_pending_updates(ZDBIndexChangeContext *context, bool is_final);
+
 static void apply_alter_statement(PlannedStmt *parsetree, char *url, uint32 shards, char *typeName, char *oldAlias, char *oldUUID);
 static Relation open_relation_from_parsetree(PlannedStmt *parsetree, LOCKMODE lockmode, bool *is_index);
 static void get_immutable_index_options(PlannedStmt *parsetree, char **url, uint32 *shards, char **typeName, char **alias, char **uuid);
@@ -153,14 +229,14 @@ static void get_immutable_index_options(PlannedStmt *parsetree, char **url, uint
 
 /*lint -esym 715,extra,source ignore unused param */
 static bool validate_default_elasticsearch_url(char **newval, void **extra, GucSource source) {
-	/* valid only if it's NULL or ends with a forward slash */
+	/* valid only if it's NULL or a list of urls that each end with a forward slash */
 	char *str = *newval;
-	return str == NULL || str[strlen(str) - 1] == '/';
+	return str == NULL || rest_nodes_validate_spec(str);
 }
 
 static void validate_url(char *str) {
-	/* valid only if it ends with a forward slash or it equals the string 'default' */
-	if (str != NULL && (str[strlen(str) - 1] == '/' || strcmp("default", str) == 0))
+	/* valid only if each of its urls ends with a forward slash or it equals the string 'default' */
+	if (str != NULL && (strcmp("default", str) == 0 || rest_nodes_validate_spec(str)))
 		return;
 
 	elog(ERROR, "'url' index option must end in a slash");
@@ -186,6 +262,21 @@ static void validate_uuid(char *str) {
 	/* noop */
 }
 
+static void validate_bulk_format(char *str) {
+	if (str == NULL || strcmp("json", str) == 0 || strcmp("smile", str) == 0)
+		return;
+
+	if (strcmp("cbor", str) == 0) {
+		/* ES can only split a _bulk request into documents for formats that have a stream separator */
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("'bulk_format' cannot be 'cbor'"),
+						errdetail("Elasticsearch's _bulk endpoint only accepts json and smile")));
+	}
+
+	elog(ERROR, "'bulk_format' index option must be one of 'json' or 'smile'");
+}
+
 
 PG_FUNCTION_INFO_V1(zdb_amhandler);
 
@@ -204,27 +295,58 @@ int  ZDB_LOG_LEVEL;
 char *zdb_default_elasticsearch_url_guc;
 int  zdb_default_row_estimation_guc;
 bool zdb_curl_verbose_guc;
+bool zdb_bulk_io_thread_guc;
 bool zdb_ignore_visibility_guc;
 int  zdb_default_replicas_guc;
+int  zdb_async_lag_guc;
+int  zdb_async_batch_size_guc;
+bool zdb_scroll_prefetch_guc;
+int  zdb_scroll_keep_alive_guc;
+int  zdb_refresh_coalesce_interval_guc;
 
 relopt_kind RELOPT_KIND_ZDB;
 
 List *currentQueryStack = NULL;
 
+static void finish_insert_context(ZDBIndexChangeContext *context, bool is_commit) {
+	ListCell *lc;
+
+	resolve_pending_updates(context, is_commit);
+
+	foreach(lc, aborted_xids) {
+		(void) list_delete_int(context->esContext->usedXids, lfirst_int(lc));
+	}
+
+	ElasticsearchFinishBulkProcess(context->esContext, is_commit);
+}
+
 void finish_inserts(bool is_commit) {
 	ListCell *lc;
 
 	foreach (lc, insert_contexts) {
-		ZDBIndexChangeContext *context = lfirst(lc);
-		ListCell              *lc2;
+		finish_insert_context(lfirst(lc), is_commit);
+	}
 
-		foreach(lc2, aborted_xids) {
-			(void) list_delete_int(context->esContext->usedXids, lfirst_int(lc2));
-		}
+}
 
-		ElasticsearchFinishBulkProcess(context->esContext, is_commit);
-	}
+/*
+ * Before we search an index, send it whatever changes we have yet to, so the search sees them.
+ * The changes we have for other indices can wait until they're searched, or until we commit
+ */
+void finish_inserts_for_index(Relation indexRel) {
+	char     *urlSpec   = ZDBIndexOptionsGetUrlSpec(indexRel);
+	char     *indexName = ZDBIndexOptionsGetIndexName(indexRel);
+	ListCell *lc;
 
+	foreach (lc, insert_contexts) {
+		ZDBIndexChangeContext *context = lfirst(lc);
+
+		/* different Postgres indices (such as during a REINDEX) might be the same Elasticsearch index */
+		if (context->indexRelid == RelationGetRelid(indexRel) ||
+			(indexName != NULL && strcmp(context->esContext->esIndexName, indexName) == 0 &&
+			 strcmp(context->esContext->urlSpec, urlSpec) == 0))
+			finish_insert_context(context, false);
+	}
 }
 
 Datum collect_used_xids(MemoryContext memoryContext) {
@@ -289,6 +411,9 @@ static void xact_commit_callback(XactEvent event, void *arg) {
 				ElasticsearchDeleteIndexDirect(index_url);
 			}
 
+			/* free the scroll contexts on Elasticsearch that our scans are done with */
+			ElasticsearchClearScrolls();
+
 			RESUME_INTERRUPTS();
 		}
 			break;
@@ -296,6 +421,10 @@ static void xact_commit_callback(XactEvent event, void *arg) {
 			break;
 	}
 
+	/* scroll contexts our aborted scans were using are cleared later */
+	if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+		ElasticsearchAbandonScrolls();
+
 	/* reset per-transaction state in any of the xact completion states */
 	switch (event) {
 		case XACT_EVENT_ABORT:
@@ -906,6 +1035,9 @@ ZDBIndexChangeContext *checkout_insert_context(Relation indexRelation, Datum row
 
 	context = palloc(sizeof(ZDBIndexChangeContext));
 	context->indexRelid = RelationGetRelid(indexRelation);
+	context->heapRelid  = IndexGetRelation(context->indexRelid, false);
+	context->pendingUpdates = NIL;
+	context->lastUpdate     = NULL;
 	context->scratch    = AllocSetContextCreate(TopTransactionContext, "aminsert scratch context",
 												ALLOCSET_DEFAULT_MINSIZE,
 												ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE);
@@ -970,6 +1102,8 @@ void zdb_aminit(void) {
 	/* define the GUCs we'll use */
 	DefineCustomBoolVariable("zdb.curl_verbose", "Put libcurl into verbose mode", NULL,
 							 &zdb_curl_verbose_guc, false, PGC_USERSET, 0, NULL, NULL, NULL);
+	DefineCustomBoolVariable("zdb.bulk_io_thread", "Use a dedicated thread to drive bulk indexing requests", NULL,
+							 &zdb_bulk_io_thread_guc, false, PGC_USERSET, 0, NULL, NULL, NULL);
 	DefineCustomEnumVariable("zdb.log_level", "ZomboDB's logging level", NULL, &ZDB_LOG_LEVEL, DEBUG1,
 							 zdb_log_level_options, PGC_USERSET, 0, NULL, NULL, NULL);
 	DefineCustomStringVariable("zdb.default_elasticsearch_url",
@@ -981,9 +1115,23 @@ void zdb_aminit(void) {
 							&zdb_default_row_estimation_guc, 2500, -1, INT_MAX, PGC_USERSET, 0, NULL, NULL, NULL);
 	DefineCustomBoolVariable("zdb.ignore_visibility", "Should queries honor visibility rules", NULL,
 							 &zdb_ignore_visibility_guc, false, PGC_USERSET, 0, NULL, NULL, NULL);
+	DefineCustomBoolVariable("zdb.scroll_prefetch", "Request the next page of a scroll while the current one is read",
+							 NULL, &zdb_scroll_prefetch_guc, true, PGC_USERSET, 0, NULL, NULL, NULL);
+	DefineCustomIntVariable("zdb.scroll_keep_alive",
+							"How long Elasticsearch keeps a scroll context alive between requests for its pages", NULL,
+							&zdb_scroll_keep_alive_guc, 600, 1, INT_MAX, PGC_USERSET, GUC_UNIT_S, NULL, NULL, NULL);
 	DefineCustomIntVariable("zdb.default_replicas",
 							"The default number of index replicas", NULL,
 							&zdb_default_replicas_guc, 0, 0, 32768, PGC_SIGHUP, 0, NULL, NULL, NULL);
+	DefineCustomIntVariable("zdb.async_lag",
+							"How long the async indexing worker waits between checks of its queue", NULL,
+							&zdb_async_lag_guc, 1000, 1, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+	DefineCustomIntVariable("zdb.async_batch_size",
+							"The maximum number of queued changes the async indexing worker ships per transaction", NULL,
+							&zdb_async_batch_size_guc, 10000, 1, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+	DefineCustomIntVariable("zdb.refresh_coalesce_interval",
+							"The least time between the refreshes of an index that committing transactions share", NULL,
+							&zdb_refresh_coalesce_interval_guc, 0, 0, 60000, PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
 
 	/* define the relation options for use ZDB indexes */
 	RELOPT_KIND_ZDB = add_reloption_kind();
@@ -1009,6 +1157,12 @@ void zdb_aminit(void) {
 	add_int_reloption(RELOPT_KIND_ZDB, "optimize_after",
 					  "After how many deleted docs should ZDB _optimize the ES index during VACUUM?", 0, 0, INT32_MAX);
 	add_bool_reloption(RELOPT_KIND_ZDB, "llapi", "Will this index be used by ZomboDB's low-level API?", false);
+	add_int_reloption(RELOPT_KIND_ZDB, "parallel_build_workers",
+					  "The number of parallel workers used to scan the heap during CREATE INDEX/REINDEX", 0, 0, 1024);
+	add_string_reloption(RELOPT_KIND_ZDB, "bulk_format", "The format of documents sent to the _bulk API: json or smile",
+						 "json", validate_bulk_format);
+	add_bool_reloption(RELOPT_KIND_ZDB, "async",
+					   "Should changes be queued locally and sent to Elasticsearch by a background worker?", false);
 
 	/* register xact callbacks and planner hooks */
 	RegisterXactCallback(xact_commit_callback, NULL);
@@ -1045,7 +1199,7 @@ Datum zdb_amhandler(PG_FUNCTION_ARGS) {
 	amroutine->amstorage      = false;
 	amroutine->amclusterable  = false;
 	amroutine->ampredlocks    = false;
-	amroutine->amcanparallel  = false;
+	amroutine->amcanparallel  = true;
 
 	amroutine->amkeytype              = InvalidOid;
 	amroutine->amvalidate             = zdbamvalidate;
@@ -1065,9 +1219,9 @@ Datum zdb_amhandler(PG_FUNCTION_ARGS) {
 	amroutine->amendscan              = amendscan;
 	amroutine->ammarkpos              = NULL;
 	amroutine->amrestrpos             = NULL;
-	amroutine->amestimateparallelscan = NULL;
-	amroutine->aminitparallelscan     = NULL;
-	amroutine->amparallelrescan       = NULL;
+	amroutine->amestimateparallelscan = amestimateparallelscan;
+	amroutine->aminitparallelscan     = aminitparallelscan;
+	amroutine->amparallelrescan       = amparallelrescan;
 
 	PG_RETURN_POINTER(amroutine);
 }
@@ -1085,6 +1239,7 @@ static IndexBuildResult *ambuild(Relation heapRelation, Relation indexRelation,
 	TupleDesc         tupdesc;
 	char              *aliasName = ZDBIndexOptionsGetAlias(indexRelation);
 	char              *indexName;
+	int               nworkers   = ZDBIndexOptionsGetParallelBuildWorkers(indexRelation);
 
 	if (already_has_zdb_index(heapRelation, indexRelation)) {
 		ereport(ERROR,
@@ -1139,9 +1294,16 @@ static IndexBuildResult *ambuild(Relation heapRelation, Relation indexRelation,
 
 	/*
 	 * Now we insert data into our index
+	 *
+	 * Parallel workers can't see temp tables, and CREATE INDEX CONCURRENTLY scans with
+	 * a snapshot of its own, so those are always built by this backend alone
 	 */
-	reltuples = IndexBuildHeapScan(heapRelation, indexRelation, indexInfo, true, zdbbuildCallback, &buildstate);
-	ElasticsearchFinishBulkProcess(buildstate.esContext, true);
+	if (nworkers > 0 && !indexInfo->ii_Concurrent && !RelationUsesLocalBuffers(heapRelation) && !IsInParallelMode()) {
+		reltuples = parallel_build(heapRelation, indexRelation, indexInfo, indexName, nworkers, &buildstate);
+	} else {
+		reltuples = IndexBuildHeapScan(heapRelation, indexRelation, indexInfo, true, zdbbuildCallback, &buildstate);
+		ElasticsearchFinishBulkProcess(buildstate.esContext, true);
+	}
 
 	/* Finish up with elasticsearch index creation */
 	ElasticsearchFinalizeIndexCreation(indexRelation);
@@ -1172,6 +1334,130 @@ static IndexBuildResult *ambuild(Relation heapRelation, Relation indexRelation,
 						   "column and the second is of a record type or whole-row reference, i.e., (table_name.*)")));
 }
 
+/*
+ * Build the index using a Postgres ParallelContext.  Each participant, including this
+ * backend, scans chunks of the heap with its own ElasticsearchBulkContext (and therefore
+ * its own set of curl handles) so that Elasticsearch is fed from multiple cores at once.
+ *
+ * Only the leader tracks the current transaction id in the index's zdb_aborted_xids
+ * doc and only the leader refreshes the index once everyone is finished
+ */
+static double parallel_build(Relation heapRelation, Relation indexRelation, IndexInfo *indexInfo, char *indexName, int nworkers, ZDBBuildStateData *buildstate) {
+	ParallelContext        *pcxt;
+	ZDBParallelBuildShared *shared;
+	double                 reltuples;
+
+	EnterParallelMode();
+	pcxt = CreateParallelContextForExternalFunction("zombodb", "zdb_parallel_build_main", nworkers);
+
+	shm_toc_estimate_chunk(&pcxt->estimator, sizeof(ZDBParallelBuildShared));
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+	InitializeParallelDSM(pcxt);
+
+	shared = (ZDBParallelBuildShared *) shm_toc_allocate(pcxt->toc, sizeof(ZDBParallelBuildShared));
+	shared->heaprelid  = RelationGetRelid(heapRelation);
+	shared->indexrelid = RelationGetRelid(indexRelation);
+	strlcpy(shared->esIndexName, indexName, sizeof(shared->esIndexName));
+	shared->nblocks    = RelationGetNumberOfBlocks(heapRelation);
+	shared->nextBlock  = 0;
+	shared->reltuples  = 0;
+	shared->indtuples  = 0;
+	SpinLockInit(&shared->mutex);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_ZDB_BUILD, shared);
+
+	LaunchParallelWorkers(pcxt);
+
+	elog(ZDB_LOG_LEVEL, "[zombodb] building %s over %u blocks with %d parallel workers (%d requested)",
+		 RelationGetRelationName(indexRelation), shared->nblocks, pcxt->nworkers_launched, nworkers);
+
+	/* we participate too, and will do all the work ourselves if no workers could be launched */
+	buildstate->esContext->shouldRefresh = false;
+	parallel_build_scan(shared, heapRelation, indexRelation, indexInfo, buildstate);
+	ElasticsearchFinishBulkProcess(buildstate->esContext, true);
+
+	WaitForParallelWorkersToFinish(pcxt);
+
+	reltuples = shared->reltuples;
+	buildstate->indtuples = shared->indtuples;
+
+	DestroyParallelContext(pcxt);
+	ExitParallelMode();
+
+	/* each participant only flushed its own batches, so make everything visible at once */
+	if (strcmp("-1", ZDBIndexOptionsGetRefreshInterval(indexRelation)) == 0)
+		ElasticsearchRefreshIndex(indexRelation);
+
+	return reltuples;
+}
+
+/*
+ * claim chunks of heap blocks, until there are none left, and index them
+ */
+static void parallel_build_scan(ZDBParallelBuildShared *shared, Relation heapRelation, Relation indexRelation, IndexInfo *indexInfo, ZDBBuildStateData *buildstate) {
+	double reltuples = 0;
+
+	for (;;) {
+		BlockNumber start;
+		BlockNumber nblocks;
+
+		SpinLockAcquire(&shared->mutex);
+		start   = shared->nextBlock;
+		nblocks = Min(PARALLEL_BUILD_CHUNK_SIZE, shared->nblocks - start);
+		shared->nextBlock += nblocks;
+		SpinLockRelease(&shared->mutex);
+
+		if (nblocks == 0)
+			break;
+
+		reltuples += IndexBuildHeapRangeScan(heapRelation, indexRelation, indexInfo, false, false, start, nblocks,
+											 zdbbuildCallback, buildstate);
+	}
+
+	SpinLockAcquire(&shared->mutex);
+	shared->reltuples += reltuples;
+	shared->indtuples += buildstate->indtuples;
+	SpinLockRelease(&shared->mutex);
+}
+
+/*
+ * entry point for parallel CREATE INDEX workers.  Called by name from Postgres' parallel worker infrastructure
+ */
+/*lint -esym 715,seg ignore unused param */
+void zdb_parallel_build_main(dsm_segment *seg, shm_toc *toc) {
+	ZDBParallelBuildShared *shared;
+	ZDBBuildStateData      buildstate;
+	Relation               heapRelation;
+	Relation               indexRelation;
+	IndexInfo              *indexInfo;
+	TupleDesc              tupdesc;
+
+	shared = (ZDBParallelBuildShared *) shm_toc_lookup(toc, PARALLEL_KEY_ZDB_BUILD, false);
+
+	/* we're in the leader's lock group, so these don't conflict with what it already holds */
+	heapRelation  = heap_open(shared->heaprelid, ShareLock);
+	indexRelation = index_open(shared->indexrelid, RowExclusiveLock);
+	indexInfo     = BuildIndexInfo(indexRelation);
+
+	tupdesc = extract_tuple_desc_from_index_expressions(indexInfo);
+
+	buildstate.indtuples     = 0;
+	buildstate.memoryContext = AllocSetContextCreate(CurrentMemoryContext, "zdbBuildCallback",
+													 ALLOCSET_DEFAULT_MINSIZE,
+													 ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE);
+	buildstate.esContext     = ElasticsearchStartBulkProcess(indexRelation, shared->esIndexName, tupdesc, false);
+	ReleaseTupleDesc(tupdesc);
+
+	/* the leader takes care of these for the build as a whole */
+	buildstate.esContext->trackTransactions = false;
+	buildstate.esContext->shouldRefresh     = false;
+
+	parallel_build_scan(shared, heapRelation, indexRelation, indexInfo, &buildstate);
+	ElasticsearchFinishBulkProcess(buildstate.esContext, true);
+
+	index_close(indexRelation, RowExclusiveLock);
+	heap_close(heapRelation, ShareLock);
+}
+
 static void ambuildempty(Relation indexRelation) {
 	Relation heapRelation = RelationIdGetRelation(IndexGetRelation(RelationGetRelid(indexRelation), false));
 
@@ -1187,13 +1473,10 @@ static void zdbbuildCallback(Relation indexRel, HeapTuple htup, Datum *values, b
 	if (!tupleIsAlive)
 		return;
 
-	if (HeapTupleIsHeapOnly(htup)) {
-		ereport(ERROR,
-				(errcode(ERRCODE_DATA_EXCEPTION),
-						errmsg("Heap Only Tuple (HOT) found at (%u, %u).  Run VACUUM FULL <tablename>; and then create the index",
-							   ItemPointerGetBlockNumber(&(htup->t_self)),
-							   ItemPointerGetOffsetNumber(&(htup->t_self)))));
-	}
+	/*
+	 * Heap Only Tuples arrive here with their t_self already set to the root of their HOT chain,
+	 * which is the ctid by which we know the whole chain
+	 */
 
 	if (ZDBIndexOptionsGetLLAPI(indexRel)) {
 		ereport(ERROR,
@@ -1238,6 +1521,12 @@ static bool aminsert(Relation indexRelation, Datum *values, bool *isnull, ItemPo
 						errmsg("row is null")));
 	}
 
+	if (ZDBIndexOptionsGetAsync(indexRelation)) {
+		/* the async indexing worker will send it once we've committed */
+		zdb_async_enqueue(indexRelation, heap_tid);
+		return true;
+	}
+
 	/*
 	 * when actually indexing the record (sending it to Elasticsearch) we need to be in a MemoryContext
 	 * that's still active when we want to call ElasticsearchFinishBulkProcess().
@@ -1253,20 +1542,10 @@ static bool aminsert(Relation indexRelation, Datum *values, bool *isnull, ItemPo
 }
 
 static void index_record(ElasticsearchBulkContext *esContext, MemoryContext scratchContext, ItemPointer ctid, Datum record, HeapTuple htup) {
-	MemoryContext oldContext;
-	text          *json;
-	CommandId     cmin;
-	CommandId     cmax;
-	uint64        xmin;
-	uint64        xmax;
-
-	/*
-	 * create the json form of the input record in the specified MemoryContext
-	 * and then switch back to whatever the current context is
-	 */
-	oldContext = MemoryContextSwitchTo(scratchContext);
-	json       = DatumGetTextP(DirectFunctionCall1(row_to_json, record));
-	MemoryContextSwitchTo(oldContext);
+	CommandId cmin;
+	CommandId cmax;
+	uint64    xmin;
+	uint64    xmax;
 
 	if (htup == NULL) {
 		/* it's from an INSERT or UPDATE statement */
@@ -1284,14 +1563,17 @@ static void index_record(ElasticsearchBulkContext *esContext, MemoryContext scra
 		xmax = InvalidTransactionId;
 	}
 
-	/* add the row to Elasticsearch */
-	ElasticsearchBulkInsertRow(esContext, ctid, json, cmin, cmax, xmin, xmax);
+	/*
+	 * add the row to Elasticsearch.  It's encoded as json directly into the bulk request
+	 * and anything the encoding leaves behind is allocated in the scratch context
+	 */
+	ElasticsearchBulkInsertRecord(esContext, scratchContext, ctid, record, cmin, cmax, xmin, xmax);
 
 	/*
-	 * and now that we've used the json value, free the MemoryContext in which it was allocated.
+	 * and now that we've used the record, free the MemoryContext in which it was encoded.
 	 *
-	 * if we don't do this, we'll leak the json string version of every row being indexed
-	 * until the transaction ends!
+	 * if we don't do this, we'll leak whatever detoasting and output functions allocated for
+	 * every row being indexed until the transaction ends!
 	 */
 	MemoryContextResetAndDeleteChildren(scratchContext);
 }
@@ -1322,6 +1604,9 @@ static IndexBulkDeleteResult *zdb_vacuum_internal(IndexVacuumInfo *info, IndexBu
 	PG_TRY();
 			{
 				ElasticsearchScrollContext *scroll;
+				ElasticsearchScrollContext *byXminScroll;
+				ElasticsearchScrollContext *byXmaxScroll;
+				ElasticsearchScrollContext *byAbtXmaxScroll;
 				ElasticsearchBulkContext   *bulk;
 				int                        deleted = 0, xmaxes_reset = 0;
 
@@ -1341,16 +1626,35 @@ static IndexBulkDeleteResult *zdb_vacuum_internal(IndexVacuumInfo *info, IndexBu
 				bulk = ElasticsearchStartBulkProcess(info->index, NULL, NULL, true);
 
 				/*
-				 * Find all rows with what we think is an *aborted* xmin
-				 *
-				 * These rows can be deleted
+				 * The three searches below don't depend on each other, so send them all
+				 * now and let Elasticsearch work on them together while we process each in turn
 				 */
-				query  = (ZDBQueryType *) DatumGetPointer(
+				query           = (ZDBQueryType *) DatumGetPointer(
 						OidFunctionCall3(byXmin,
 										 ObjectIdGetDatum(RelationGetRelid(info->index)),
 										 CStringGetTextDatum(ZDBIndexOptionsGetTypeName(info->index)),
 										 Int64GetDatum(convert_xid(oldestXmin))));
-				scroll = ElasticsearchOpenScroll(info->index, query, true, 0, NULL, zdb_x_fields, 2);
+				byXminScroll    = ElasticsearchStartScroll(info->index, query, true, 0, NULL, zdb_x_fields, 2, true);
+				query           = (ZDBQueryType *) DatumGetPointer(
+						OidFunctionCall3(byXmax,
+										 ObjectIdGetDatum(RelationGetRelid(info->index)),
+										 CStringGetTextDatum(ZDBIndexOptionsGetTypeName(info->index)),
+										 Int64GetDatum(convert_xid(oldestXmin))));
+				byXmaxScroll    = ElasticsearchStartScroll(info->index, query, true, 0, NULL, zdb_x_fields, 2, true);
+				query           = (ZDBQueryType *) DatumGetPointer(
+						OidFunctionCall3(byAbtXmax,
+										 ObjectIdGetDatum(RelationGetRelid(info->index)),
+										 CStringGetTextDatum(ZDBIndexOptionsGetTypeName(info->index)),
+										 Int64GetDatum(convert_xid(oldestXmin))));
+				byAbtXmaxScroll = ElasticsearchStartScroll(info->index, query, true, 0, NULL, zdb_x_fields, 2, true);
+
+				/*
+				 * Find all rows with what we think is an *aborted* xmin
+				 *
+				 * These rows can be deleted
+				 */
+				scroll = byXminScroll;
+				ElasticsearchAwaitScroll(scroll);
 				while (scroll->cnt < scroll->total) {
 					char          *_id;
 					TransactionId xmin;
@@ -1373,12 +1677,8 @@ static IndexBulkDeleteResult *zdb_vacuum_internal(IndexVacuumInfo *info, IndexBu
 				 *
 				 * These rows can be deleted
 				 */
-				query  = (ZDBQueryType *) DatumGetPointer(
-						OidFunctionCall3(byXmax,
-										 ObjectIdGetDatum(RelationGetRelid(info->index)),
-										 CStringGetTextDatum(ZDBIndexOptionsGetTypeName(info->index)),
-										 Int64GetDatum(convert_xid(oldestXmin))));
-				scroll = ElasticsearchOpenScroll(info->index, query, true, 0, NULL, zdb_x_fields, 2);
+				scroll = byXmaxScroll;
+				ElasticsearchAwaitScroll(scroll);
 				while (scroll->cnt < scroll->total) {
 					char          *_id;
 					TransactionId xmax;
@@ -1401,12 +1701,8 @@ static IndexBulkDeleteResult *zdb_vacuum_internal(IndexVacuumInfo *info, IndexBu
 				 *
 				 * These rows can have their xmax reset to null because they're still live
 				 */
-				query  = (ZDBQueryType *) DatumGetPointer(
-						OidFunctionCall3(byAbtXmax,
-										 ObjectIdGetDatum(RelationGetRelid(info->index)),
-										 CStringGetTextDatum(ZDBIndexOptionsGetTypeName(info->index)),
-										 Int64GetDatum(convert_xid(oldestXmin))));
-				scroll = ElasticsearchOpenScroll(info->index, query, true, 0, NULL, zdb_x_fields, 2);
+				scroll = byAbtXmaxScroll;
+				ElasticsearchAwaitScroll(scroll);
 				while (scroll->cnt < scroll->total) {
 					char          *_id;
 					TransactionId xmax;
@@ -1433,11 +1729,13 @@ static IndexBulkDeleteResult *zdb_vacuum_internal(IndexVacuumInfo *info, IndexBu
 				 * Finally, any "zdb_aborted_xid" value we have can be removed if it's
 				 * known to be aborted and no longer referenced anywhere in the index
 				 */
-				scroll = ElasticsearchOpenScroll(info->index, MakeZDBQuery("_id:zdb_aborted_xids"), true, 0, NULL, zdb_aborted_fields, 1);
+				query  = MakeZDBQuery(psprintf("{\"ids\":{\"values\":%s}}", aborted_xids_doc_ids_json()));
+				scroll = ElasticsearchOpenScroll(info->index, query, true, 0, NULL, zdb_aborted_fields, 1);
 				while (scroll->cnt < scroll->total) {
+					char *_id;
 					void *array;
 
-					if (!ElasticsearchGetNextItemPointer(scroll, NULL, NULL, NULL, NULL))
+					if (!ElasticsearchGetNextItemPointer(scroll, NULL, &_id, NULL, NULL))
 						break;
 
 					if (scroll->fields == NULL)
@@ -1446,8 +1744,12 @@ static IndexBulkDeleteResult *zdb_vacuum_internal(IndexVacuumInfo *info, IndexBu
 					array = get_json_object_array(scroll->fields, "zdb_aborted_xids", true);
 
 					if (array != NULL) {
-						List *to_remove = NIL;
-						int  i, len     = get_json_array_length(array);
+						List       *to_remove = NIL;
+						uint64     xids[VACUUM_COUNT_BATCH_SIZE];
+						RestFuture *xminCounts[VACUUM_COUNT_BATCH_SIZE];
+						RestFuture *xmaxCounts[VACUUM_COUNT_BATCH_SIZE];
+						int        nxids      = 0;
+						int        i, len     = get_json_array_length(array);
 
 						for (i = 0; i < len; i++) {
 							uint64        xid64 = get_json_array_element_uint64(array, i, scroll->jsonMemoryContext);
@@ -1455,21 +1757,34 @@ static IndexBulkDeleteResult *zdb_vacuum_internal(IndexVacuumInfo *info, IndexBu
 
 							if (TransactionIdPrecedes(xid, oldestXmin) && TransactionIdDidAbort(xid) &&
 								!TransactionIdDidCommit(xid) && !TransactionIdIsInProgress(xid)) {
-								uint64 xmin_cnt = ElasticsearchCount(info->index,
-																	 MakeZDBQuery(psprintf("zdb_xmin:%lu", xid64)));
-								uint64 xmax_cnt = ElasticsearchCount(info->index,
-																	 MakeZDBQuery(psprintf("zdb_xmax:%lu", xid64)));
+								/* count its references along with those of the other xids in this batch */
+								xids[nxids]       = xid64;
+								xminCounts[nxids] = ElasticsearchStartCount(info->index,
+																			MakeZDBQuery(psprintf("zdb_xmin:%lu", xid64)));
+								xmaxCounts[nxids] = ElasticsearchStartCount(info->index,
+																			MakeZDBQuery(psprintf("zdb_xmax:%lu", xid64)));
+								nxids++;
+							}
 
-								/* if it's not referenced anywhere, so we can remove it */
-								if (xmin_cnt == 0 && xmax_cnt == 0) {
-									uint64 *tmp = palloc(sizeof(uint64));
-									memcpy(tmp, &xid64, sizeof(uint64));
+							if (nxids == VACUUM_COUNT_BATCH_SIZE || (nxids > 0 && i == len - 1)) {
+								int j;
 
-									to_remove = lappend(to_remove, tmp);
+								for (j = 0; j < nxids; j++) {
+									uint64 xmin_cnt = ElasticsearchFinishCount(xminCounts[j]);
+									uint64 xmax_cnt = ElasticsearchFinishCount(xmaxCounts[j]);
+
+									/* if it's not referenced anywhere, so we can remove it */
+									if (xmin_cnt == 0 && xmax_cnt == 0) {
+										uint64 *tmp = palloc(sizeof(uint64));
+										memcpy(tmp, &xids[j], sizeof(uint64));
+
+										to_remove = lappend(to_remove, tmp);
+									}
 								}
+								nxids = 0;
 							}
 						}
-						ElasticsearchRemoveAbortedTransactions(info->index, to_remove);
+						ElasticsearchRemoveAbortedTransactions(info->index, _id, to_remove);
 
 						if (list_length(to_remove) > 0)
 							elog(LOG, "[zombodb-vacuum] removed %d aborted xids", list_length(to_remove));
@@ -1548,9 +1863,13 @@ static void amcostestimate(struct PlannerInfo *root, struct IndexPath *path, dou
 		}
 	}
 
+	/*
+	 * we have no pages, but Postgres decides how many workers a parallel IndexScan deserves from
+	 * them, so say we've as many as the heap pages our matching rows are on
+	 */
 	*indexStartupCost = 0;
 	*indexCorrelation = 1;    /* because an IndexScan will sort by zdb_ctid in ES, which will give us heap order */
-	*indexPages       = 0;
+	*indexPages       = *indexSelectivity * heapRel->rd_rel->relpages;
 
 	*indexTotalCost += (*indexSelectivity * Max(1, heapRel->rd_rel->reltuples)) * (cpu_index_tuple_cost);
 
@@ -1576,6 +1895,9 @@ static bytea *amoptions(Datum reloptions, bool validate) {
 			{"optimize_after",    RELOPT_TYPE_INT,    offsetof(ZDBIndexOptions, optimizeAfter)},
 			{"llapi",             RELOPT_TYPE_BOOL,   offsetof(ZDBIndexOptions, llapi)},
 			{"uuid",              RELOPT_TYPE_STRING, offsetof(ZDBIndexOptions, uuidOffset)},
+			{"parallel_build_workers", RELOPT_TYPE_INT, offsetof(ZDBIndexOptions, parallelBuildWorkers)},
+			{"bulk_format",       RELOPT_TYPE_STRING, offsetof(ZDBIndexOptions, bulkFormatOffset)},
+			{"async",             RELOPT_TYPE_BOOL,   offsetof(ZDBIndexOptions, async)},
 	};
 
 	options = parseRelOptions(reloptions, validate, RELOPT_KIND_ZDB, &numoptions);
@@ -1652,7 +1974,114 @@ static IndexScanDesc ambeginscan(Relation indexRelation, int nkeys, int norderby
 	return scan;
 }
 
-static inline void do_search_for_scan(IndexScanDesc scan) {
+static ZDBParallelScanState *parallel_scan_state(IndexScanDesc scan) {
+	return (ZDBParallelScanState *) OffsetToPointer((void *) scan->parallel_scan, scan->parallel_scan->ps_offset);
+}
+
+/* the query we actually send to Elasticsearch */
+static inline ZDBQueryType *search_query(ZDBScanContext *context) {
+	return context->sortedQuery != NULL ? context->sortedQuery : context->query;
+}
+
+/* forget the sorted copy of the query we made for the last search, if we made one */
+static inline void free_sorted_query(ZDBScanContext *context) {
+	if (context->sortedQuery != NULL) {
+		pfree(context->sortedQuery);
+		context->sortedQuery = NULL;
+	}
+}
+
+/*
+ * The leader of a parallel index scan sends our changes to the index, so that the workers'
+ * searches see them too, and then shares the query they're all to run
+ */
+static void publish_parallel_query(IndexScanDesc scan, ZDBScanContext *context) {
+	ZDBParallelScanState *state = parallel_scan_state(scan);
+	char                 *queryDSL;
+	int                  nslices;
+	Size                 len;
+
+	queryDSL = ElasticsearchPrepareParallelScroll(scan->indexRelation, search_query(context), context->limit, &nslices);
+	len      = strlen(queryDSL) + 1;
+
+	if (context->querySegment != NULL)
+		dsm_detach(context->querySegment);
+	context->querySegment = dsm_create(len, 0);
+	memcpy(dsm_segment_address(context->querySegment), queryDSL, len);
+
+	SpinLockAcquire(&state->mutex);
+	state->query     = dsm_segment_handle(context->querySegment);
+	state->limit     = context->limit;
+	state->nslices   = nslices;
+	state->published = true;
+	SpinLockRelease(&state->mutex);
+	ConditionVariableBroadcast(&state->cv);
+
+	if (context->parallelQuery != NULL)
+		pfree(context->parallelQuery);
+	context->parallelQuery = queryDSL;
+}
+
+/*
+ * A worker waits for the leader to publish the query, and takes a copy of it
+ */
+static void await_parallel_query(IndexScanDesc scan, ZDBScanContext *context) {
+	ZDBParallelScanState *state = parallel_scan_state(scan);
+	dsm_segment          *seg;
+	dsm_handle           handle;
+
+	ConditionVariablePrepareToSleep(&state->cv);
+	for (;;) {
+		bool published;
+
+		SpinLockAcquire(&state->mutex);
+		published = state->published;
+		handle    = state->query;
+		context->limit = state->limit;
+		SpinLockRelease(&state->mutex);
+
+		if (published)
+			break;
+		ConditionVariableSleep(&state->cv, PG_WAIT_EXTENSION);
+	}
+	ConditionVariableCancelSleep();
+
+	/* the leader keeps the segment until the scan ends, which is after we're done with it */
+	seg = dsm_attach(handle);
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("could not map the query of a parallel index scan")));
+	if (context->parallelQuery != NULL)
+		pfree(context->parallelQuery);
+	context->parallelQuery = pstrdup(dsm_segment_address(seg));
+	dsm_detach(seg);
+}
+
+/*
+ * Claim the next slice of a parallel index scan's scroll, and start it.  Returns NULL once
+ * every slice has been taken
+ */
+static ElasticsearchScrollContext *start_next_parallel_slice(IndexScanDesc scan, ZDBScanContext *context) {
+	ZDBParallelScanState *state = parallel_scan_state(scan);
+	int                  slice;
+	int                  nslices;
+
+	SpinLockAcquire(&state->mutex);
+	slice   = state->nextSlice;
+	nslices = state->nslices;
+	if (slice < nslices)
+		state->nextSlice++;
+	SpinLockRelease(&state->mutex);
+
+	if (slice >= nslices)
+		return NULL;
+
+	return ElasticsearchStartScrollSlice(scan->indexRelation, search_query(context), context->parallelQuery, context->limit,
+										 context->highlights, slice, nslices);
+}
+
+static inline void do_search_for_scan(IndexScanDesc scan, bool forBitmap) {
 	ZDBScanContext *context = (ZDBScanContext *) scan->opaque;
 
 	if (context->needsInit) {
@@ -1660,18 +2089,46 @@ static inline void do_search_for_scan(IndexScanDesc scan) {
 		uint64   limit;
 		bool     wantScores = zdbquery_get_wants_score(context->query);
 		List     *highlights;
+		char     *sortJson;
 
 		if (scan->heapRelation == NULL)
 			heapRel = RelationIdGetRelation(IndexGetRelation(RelationGetRelid(scan->indexRelation), false));
 
 		highlights = extract_highlight_info(scan, RelationGetRelid(heapRel));
-		limit      = find_limit_for_scan(scan);
+		limit      = find_limit_for_scan(scan, &sortJson);
+
+		/* context->query can be the scan key's own argument, which belongs to the plan, so it's left alone */
+		free_sorted_query(context);
+		if (sortJson != NULL) {
+			/*
+			 * Elasticsearch can sort for the Sort above us, and then we only need 'limit' hits.
+			 * Unless the query has its own sort or limit, which decide the hits it matches
+			 */
+			if (zdbquery_get_sort_json(context->query) == NULL && zdbquery_get_limit(context->query) == 0 &&
+				zdbquery_get_offset(context->query) == 0) {
+				context->sortedQuery = zdbquery_set_sort_json(context->query, sortJson);
+				elog(ZDB_LOG_LEVEL, "[zombodb] sorting by %s in Elasticsearch, limit %lu", sortJson, limit);
+			} else
+				limit = 0;
+		}
 
 		if (context->scrollContext != NULL) {
 			ElasticsearchCloseScroll(context->scrollContext);
 		}
 
-		context->scrollContext  = ElasticsearchOpenScroll(scan->indexRelation, context->query, false, limit, highlights, NULL, 0);
+		/* let Elasticsearch run the search while we get ready for its results */
+		if (scan->parallel_scan != NULL) {
+			context->limit      = limit;
+			context->highlights = highlights;
+			if (IsParallelWorker())
+				await_parallel_query(scan, context);
+			else
+				publish_parallel_query(scan, context);
+			context->scrollContext = start_next_parallel_slice(scan, context);
+		} else {
+			context->scrollContext = ElasticsearchStartScroll(scan->indexRelation, search_query(context), false, limit,
+															  highlights, NULL, 0, forBitmap);
+		}
 		context->wantHighlights = highlights != NULL;
 		context->wantScores     = wantScores;
 		if (context->wantScores) {
@@ -1687,6 +2144,8 @@ static inline void do_search_for_scan(IndexScanDesc scan) {
 		if (scan->heapRelation == NULL)
 			RelationClose(heapRel);
 
+		if (context->scrollContext != NULL)
+			ElasticsearchAwaitScroll(context->scrollContext);
 		context->needsInit = false;
 	}
 }
@@ -1706,17 +2165,29 @@ static bool amgettuple(IndexScanDesc scan, ScanDirection direction) {
 	float4          score;
 	zdb_json_object highlights;
 
-	do_search_for_scan(scan);
+	do_search_for_scan(scan, false);
 
 	/* zdb indexes are never lossy */
 	scan->xs_recheck = false;
 
-	if (context->scrollContext->cnt >= context->scrollContext->total)
-		return false; /* we have no more tuples to return */
+	for (;;) {
+		if (context->scrollContext == NULL)
+			return false; /* every slice of a parallel scan has been taken */
 
-	/* get the next tuple from Elasticsearch */
-	if (!ElasticsearchGetNextItemPointer(context->scrollContext, &ctid, NULL, &score, &highlights))
-		return false;
+		/* get the next tuple from Elasticsearch */
+		if (context->scrollContext->cnt < context->scrollContext->total &&
+			ElasticsearchGetNextItemPointer(context->scrollContext, &ctid, NULL, &score, &highlights))
+			break;
+
+		if (scan->parallel_scan == NULL)
+			return false; /* we have no more tuples to return */
+
+		/* our slice is done, so help with another */
+		ElasticsearchCloseScroll(context->scrollContext);
+		context->scrollContext = start_next_parallel_slice(scan, context);
+		if (context->scrollContext != NULL)
+			ElasticsearchAwaitScroll(context->scrollContext);
+	}
 
 	if (!ItemPointerIsValid(&ctid))
 		ereport(ERROR,
@@ -1757,7 +2228,8 @@ static int64 amgetbitmap(IndexScanDesc scan, TIDBitmap *tbm) {
 	Relation        heapRel  = NULL;
 	zdb_json_object highlights;
 
-	do_search_for_scan(scan);
+	/* a bitmap doesn't care what order the rows come in, so the scroll can be sliced */
+	do_search_for_scan(scan, true);
 
 
 	if (scan->heapRelation == NULL)
@@ -1803,6 +2275,7 @@ static void amendscan(IndexScanDesc scan) {
 
 	if (context->query != NULL)
 		pfree(context->query);
+	free_sorted_query(context);
 
 	if (context->scrollContext != NULL)
 		ElasticsearchCloseScroll(context->scrollContext);
@@ -1813,26 +2286,171 @@ static void amendscan(IndexScanDesc scan) {
 	if (context->highlightLookup != NULL)
 		hash_destroy(context->highlightLookup);
 
+	if (context->parallelQuery != NULL)
+		pfree(context->parallelQuery);
+
+	if (context->querySegment != NULL)
+		dsm_detach(context->querySegment);
+
 	pfree(scan->opaque);
 }
 
-static void handle_trigger(Oid indexRelId, ItemPointer targetCtid) {
+static Size amestimateparallelscan(void) {
+	return sizeof(ZDBParallelScanState);
+}
+
+static void aminitparallelscan(void *target) {
+	ZDBParallelScanState *state = (ZDBParallelScanState *) target;
+
+	SpinLockInit(&state->mutex);
+	ConditionVariableInit(&state->cv);
+	state->published = false;
+	state->query     = 0;
+	state->limit     = 0;
+	state->nslices   = 0;
+	state->nextSlice = 0;
+}
+
+/*
+ * Only the leader rescans, before it starts a new set of workers, and it'll publish its
+ * query again when it next searches
+ */
+static void amparallelrescan(IndexScanDesc scan) {
+	ZDBParallelScanState *state = parallel_scan_state(scan);
+
+	SpinLockAcquire(&state->mutex);
+	state->published = false;
+	state->nslices   = 0;
+	state->nextSlice = 0;
+	SpinLockRelease(&state->mutex);
+}
+
+static void handle_trigger(Oid indexRelId, HeapTuple targetTuple) {
 	MemoryContext         oldContext;
 	ZDBIndexChangeContext *context;
+	ZDBPendingUpdate      *pending;
+	ItemPointer           targetCtid = &targetTuple->t_self;
 	Relation              indexRel;
+	Relation              heapRel;
+
+	indexRel = RelationIdGetRelation(indexRelId);
+	heapRel  = RelationIdGetRelation(IndexGetRelation(indexRelId, false));
+
+	if (ZDBIndexOptionsGetAsync(indexRel)) {
+		ItemPointerData root;
+
+		/* the worker sends the whole row (or HOT chain) again, with whatever xmax it has by then */
+		if (!HeapTupleIsHeapOnly(targetTuple) || !find_hot_root(heapRel, targetCtid, &root))
+			root = *targetCtid;
+		zdb_async_enqueue(indexRel, &root);
+		RelationClose(heapRel);
+		RelationClose(indexRel);
+		return;
+	}
 
 	oldContext = MemoryContextSwitchTo(TopTransactionContext);
-	indexRel   = RelationIdGetRelation(indexRelId);
 
 	context = checkout_insert_context(indexRel, PointerGetDatum(NULL), true);
 
-	ElasticsearchBulkUpdateTuple(context->esContext, targetCtid, NULL, GetCurrentCommandId(true),
-								 convert_xid(GetCurrentTransactionId()));
+	/*
+	 * the row the previous call saw has been UPDATEd or DELETEd by now, unless something
+	 * stopped that from happening, in which case it waits with the others until we're flushed
+	 */
+	if (context->lastUpdate != NULL && !resolve_pending_update(context, heapRel, context->lastUpdate))
+		context->pendingUpdates = lappend(context->pendingUpdates, context->lastUpdate);
+
+	/*
+	 * we won't know if this is a HOT update until after the row has been updated, so
+	 * remember it for later, along with the root of its HOT chain, which is the document
+	 * we'd need to update.  Only a heap-only tuple has a root other than itself
+	 */
+	pending = palloc(sizeof(ZDBPendingUpdate));
+	pending->member = *targetCtid;
+	if (!HeapTupleIsHeapOnly(targetTuple) || !find_hot_root(heapRel, targetCtid, &pending->root))
+		pending->root = *targetCtid;
+	pending->cmax = GetCurrentCommandId(true);
+	pending->xmax = convert_xid(GetCurrentTransactionId());
+	context->lastUpdate = pending;
+
+	/* and the xid we'll eventually stamp needs to be known as in-progress now */
+	ElasticsearchBulkMarkCurrentXid(context->esContext);
 
+	RelationClose(heapRel);
 	RelationClose(indexRel);
 	MemoryContextSwitchTo(oldContext);
 }
 
+/*
+ * Set the xmax of the document for a row our triggers have seen, if it's since been UPDATEd
+ * (but not HOT updated) or DELETEd by this transaction.  Returns false if it hasn't been, yet
+ */
+static bool resolve_pending_update(ZDBIndexChangeContext *context, Relation heapRel, ZDBPendingUpdate *pending) {
+	TransactionId xmax       = InvalidTransactionId;
+	bool          hotUpdated = false;
+	Buffer        buffer;
+	Page          page;
+	ItemId        lp;
+
+	buffer = ReadBuffer(heapRel, ItemPointerGetBlockNumber(&pending->member));
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buffer);
+	lp   = PageGetItemId(page, ItemPointerGetOffsetNumber(&pending->member));
+
+	if (ItemIdIsNormal(lp)) {
+		HeapTupleHeader htup = (HeapTupleHeader) PageGetItem(page, lp);
+
+		if (!(htup->t_infomask & HEAP_XMAX_INVALID) && !HEAP_XMAX_IS_LOCKED_ONLY(htup->t_infomask)) {
+			xmax       = HeapTupleHeaderGetUpdateXid(htup);
+			hotUpdated = HeapTupleHeaderIsHotUpdated(htup);
+		}
+	}
+	UnlockReleaseBuffer(buffer);
+
+	if (!TransactionIdIsValid(xmax) || !TransactionIdIsCurrentTransactionId(xmax)) {
+		/* we haven't UPDATEd/DELETEd it, or at least not yet */
+		return false;
+	}
+
+	if (!hotUpdated)
+		ElasticsearchBulkUpdateTuple(context->esContext, &pending->root, NULL, pending->cmax, pending->xmax);
+	pfree(pending);
+	return true;
+}
+
+/*
+ * Resolve every row our triggers have seen.  Rows that haven't been UPDATEd or DELETEd are kept
+ * for next time, unless this is the final call, in which case they never will be
+ */
+static void resolve_pending_updates(ZDBIndexChangeContext *context, bool is_final) {
+	MemoryContext oldContext;
+	Relation      heapRel;
+	List          *keep = NIL;
+	ListCell      *lc;
+
+	if (context->lastUpdate != NULL) {
+		context->pendingUpdates = lappend(context->pendingUpdates, context->lastUpdate);
+		context->lastUpdate     = NULL;
+	}
+
+	if (context->pendingUpdates == NIL)
+		return;
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+	heapRel    = RelationIdGetRelation(context->heapRelid);
+
+	foreach (lc, context->pendingUpdates) {
+		ZDBPendingUpdate *pending = lfirst(lc);
+
+		if (!resolve_pending_update(context, heapRel, pending) && !is_final)
+			keep = lappend(keep, pending);
+	}
+
+	RelationClose(heapRel);
+	list_free(context->pendingUpdates);
+	context->pendingUpdates = keep;
+	MemoryContextSwitchTo(oldContext);
+}
+
 Datum zdb_delete_trigger(PG_FUNCTION_ARGS) {
 	TriggerData *trigdata = (TriggerData *) fcinfo->context;
 	Oid         indexRelId;
@@ -1851,7 +2469,7 @@ Datum zdb_delete_trigger(PG_FUNCTION_ARGS) {
 		elog(ERROR, "zdb_delete_trigger: called with incorrect number of arguments");
 
 	indexRelId = DatumGetObjectId(DirectFunctionCall1(oidin, CStringGetDatum(trigdata->tg_trigger->tgargs[0])));
-	handle_trigger(indexRelId, &trigdata->tg_trigtuple->t_self);
+	handle_trigger(indexRelId, trigdata->tg_trigtuple);
 
 	return PointerGetDatum(trigdata->tg_trigtuple);
 }
@@ -1874,7 +2492,7 @@ Datum zdb_update_trigger(PG_FUNCTION_ARGS) {
 		elog(ERROR, "zdb_update_trigger: called with incorrect number of arguments");
 
 	indexRelId = DatumGetObjectId(DirectFunctionCall1(oidin, CStringGetDatum(trigdata->tg_trigger->tgargs[0])));
-	handle_trigger(indexRelId, &trigdata->tg_trigtuple->t_self);
+	handle_trigger(indexRelId, trigdata->tg_trigtuple);
 
 	return PointerGetDatum(trigdata->tg_newtuple);
 }
@@ -2002,7 +2620,7 @@ static void get_immutable_index_options(PlannedStmt *parsetree, char **url, uint
 	rel = open_relation_from_parsetree(parsetree, AccessShareLock, &is_index);
 	if (RelationIsValid(rel)) {
 		if (is_index) {
-			*url      = ZDBIndexOptionsGetUrl(rel);
+			*url      = ZDBIndexOptionsGetUrlSpec(rel);
 			*shards   = ZDBIndexOptionsGetNumberOfShards(rel);
 			*typeName = pstrdup(ZDBIndexOptionsGetTypeName(rel));
 			*alias    = ZDBIndexOptionsGetAlias(rel) != NULL ? pstrdup(ZDBIndexOptionsGetAlias(rel)) : NULL;
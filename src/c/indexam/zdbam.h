@@ -24,13 +24,17 @@
 
 typedef struct ZDBIndexChangeContext {
 	Oid                      indexRelid;
+	Oid                      heapRelid;
 	ElasticsearchBulkContext *esContext;
 	MemoryContext            scratch;
+	List                     *pendingUpdates;   /* ZDBPendingUpdate entries not yet known to be (non-HOT) updated */
+	struct ZDBPendingUpdate  *lastUpdate;       /* the one the most recent trigger call saw */
 } ZDBIndexChangeContext;
 
 
 ZDBIndexChangeContext *checkout_insert_context(Relation indexRelation, Datum row, bool isnull);
 void finish_inserts(bool is_commit);
+void finish_inserts_for_index(Relation indexRel);
 Datum collect_used_xids(MemoryContext memoryContext);
 
 #endif /* __ZDB_ZDBAM_H__ */
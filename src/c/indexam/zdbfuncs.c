@@ -37,6 +37,7 @@ PG_FUNCTION_INFO_V1(zdb_profile_query);
 PG_FUNCTION_INFO_V1(zdb_to_query_dsl);
 PG_FUNCTION_INFO_V1(zdb_json_build_object_wrapper);
 PG_FUNCTION_INFO_V1(zdb_internal_visibility_clause);
+PG_FUNCTION_INFO_V1(zdb_aborted_xids_doc_ids);
 
 #define zdb_array_to_json(array) DirectFunctionCall1(array_to_json, array)
 
@@ -58,7 +59,7 @@ Datum zdb_index_url(PG_FUNCTION_ARGS) {
 	char     *url;
 
 	indexRel = zdb_open_index(indexRelId, AccessShareLock);
-	url      = pstrdup(ZDBIndexOptionsGetUrl(indexRel));
+	url      = pstrdup(ZDBIndexOptionsGetUrlSpec(indexRel));
 	relation_close(indexRel, AccessShareLock);
 
 	PG_RETURN_TEXT_P(CStringGetTextDatum(url));
@@ -247,8 +248,7 @@ Datum zdb_query_tids(PG_FUNCTION_ARGS) {
 
 	indexRel = zdb_open_index(indexRelOid, AccessShareLock);
 
-	scrollContext = ElasticsearchOpenScroll(indexRel, userJsonQuery, false, 0, NULL,
-											NULL, 0);
+	scrollContext = ElasticsearchOpenSlicedScroll(indexRel, userJsonQuery, false, NULL, NULL, 0);
 
 	relation_close(indexRel, AccessShareLock);
 
@@ -296,6 +296,39 @@ Datum zdb_json_build_object_wrapper(PG_FUNCTION_ARGS) {
 	return json_build_object(fcinfo);
 }
 
+/*
+ * a "terms" lookup of the field against every document that holds the index's aborted xids
+ */
+static char *aborted_xids_terms_lookup(Relation indexRel, char *field) {
+	StringInfo lookup = makeStringInfo();
+	int        i;
+
+	appendStringInfoString(lookup, "{\"bool\":{\"should\":[");
+	for (i = 0; i < ZDB_ABORTED_XIDS_PARTITIONS; i++) {
+		if (i > 0) appendStringInfoChar(lookup, ',');
+		appendStringInfo(lookup,
+						 "{\"terms\":{\"%s\":{\"index\":\"%s\",\"type\":\"%s\",\"path\":\"zdb_aborted_xids\",\"id\":\"%s\"}}}",
+						 field,
+						 ZDBIndexOptionsGetIndexName(indexRel),
+						 ZDBIndexOptionsGetTypeName(indexRel),
+						 aborted_xids_doc_id(i));
+	}
+	appendStringInfoString(lookup, "]}}");
+
+	return lookup->data;
+}
+
+Datum zdb_aborted_xids_doc_ids(PG_FUNCTION_ARGS) {
+	ArrayBuildState *astate = NULL;
+	int             i;
+
+	for (i = 0; i < ZDB_ABORTED_XIDS_PARTITIONS; i++) {
+		astate = accumArrayResult(astate, CStringGetTextDatum(aborted_xids_doc_id(i)), false, TEXTOID,
+								  CurrentMemoryContext);
+	}
+
+	PG_RETURN_DATUM(makeArrayResult(astate, CurrentMemoryContext));
+}
 
 Datum zdb_internal_visibility_clause(PG_FUNCTION_ARGS) {
     MemoryContext   tmpContext  = AllocSetContextCreate(CurrentMemoryContext, "visibility_clause",
@@ -330,8 +363,8 @@ Datum zdb_internal_visibility_clause(PG_FUNCTION_ARGS) {
                             "        \"bool\": {"
                             "          \"must_not\": ["
                             "            {"
-                            "              \"query_string\": {"
-                            "                \"query\": \"_id:zdb_aborted_xids\""
+                            "              \"ids\": {"
+                            "                \"values\": %s"
                             "              }"
                             "            }"
                             "          ]"
@@ -402,16 +435,7 @@ Datum zdb_internal_visibility_clause(PG_FUNCTION_ARGS) {
                             "                        {"
                             "                          \"bool\": {"
                             "                            \"must_not\": ["
-                            "                              {"
-                            "                                \"terms\": {"
-                            "                                  \"zdb_xmin\": {"
-                            "                                    \"index\": \"%s\","
-                            "                                    \"type\": \"%s\","
-                            "                                    \"path\": \"zdb_aborted_xids\","
-                            "                                    \"id\": \"zdb_aborted_xids\""
-                            "                                  }"
-                            "                                }"
-                            "                              }"
+                            "                              %s"
                             "                            ]"
                             "                          }"
                             "                        },"
@@ -488,16 +512,7 @@ Datum zdb_internal_visibility_clause(PG_FUNCTION_ARGS) {
                             "                                    {"
                             "                                      \"bool\": {"
                             "                                        \"should\": ["
-                            "                                          {"
-                            "                                            \"terms\": {"
-                            "                                              \"zdb_xmax\": {"
-                            "                                                \"index\": \"%s\","
-                            "                                                \"type\": \"%s\","
-                            "                                                \"path\": \"zdb_aborted_xids\","
-                            "                                                \"id\": \"zdb_aborted_xids\""
-                            "                                              }"
-                            "                                            }"
-                            "                                          },"
+                            "                                          %s,"
                             "                                          {"
                             "                                            \"terms\": {"
                             "                                              \"zdb_xmax\": %s"
@@ -531,19 +546,18 @@ Datum zdb_internal_visibility_clause(PG_FUNCTION_ARGS) {
                             "    ]"
                             "  }"
                             "}",
+                     aborted_xids_doc_ids_json(),
                      TextDatumGetCString(zdb_array_to_json(myXids)),
                      commandId,
                      TextDatumGetCString(zdb_array_to_json(myXids)),
                      commandId,
-                     ZDBIndexOptionsGetIndexName(indexRel),
-                     ZDBIndexOptionsGetTypeName(indexRel),
+                     aborted_xids_terms_lookup(indexRel, "zdb_xmin"),
                      TextDatumGetCString(zdb_array_to_json(activeXids)),
                      xmax,
                      TextDatumGetCString(zdb_array_to_json(myXids)),
                      commandId,
                      TextDatumGetCString(zdb_array_to_json(myXids)),
-                     ZDBIndexOptionsGetIndexName(indexRel),
-                     ZDBIndexOptionsGetTypeName(indexRel),
+                     aborted_xids_terms_lookup(indexRel, "zdb_xmax"),
                      TextDatumGetCString(zdb_array_to_json(activeXids)),
                      xmax
 
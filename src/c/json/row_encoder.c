@@ -0,0 +1,645 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "row_encoder.h"
+#include "smile.h"
+#include "zombodb.h"
+
+#include "access/htup_details.h"
+#include "access/transam.h"
+#include "catalog/pg_type.h"
+#include "datatype/timestamp.h"
+#include "miscadmin.h"
+#include "parser/parse_coerce.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/fmgrprotos.h"
+#include "utils/json.h"
+#include "utils/jsonapi.h"
+#include "utils/jsonb.h"
+#include "utils/lsyscache.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
+
+static void encode_bool(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_int2(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_int4(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_int8(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_number(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_date(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_timestamp(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_timestamptz(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_text(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_json(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_jsonb(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_array(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_composite(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_cast(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void encode_other(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+
+static void smile_encode_bool(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_int2(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_int4(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_int8(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_number(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_date(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_timestamp(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_timestamptz(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_text(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_via_json(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+static void smile_encode_other(StringInfo buff, Datum value, RowEncoderAttribute *attr);
+
+/*
+ * Same as Postgres' escape_json(), but for a string that isn't null-terminated.
+ * Runs of characters that don't need escaping are copied as a whole
+ */
+static void escape_json_len(StringInfo buff, const char *str, int len) {
+	const char *start = str;
+	const char *end   = str + len;
+	const char *p;
+
+	appendStringInfoCharMacro(buff, '"');
+	for (p = str; p < end; p++) {
+		const char *escaped;
+
+		switch (*p) {
+			case '\b':
+				escaped = "\\b";
+				break;
+			case '\f':
+				escaped = "\\f";
+				break;
+			case '\n':
+				escaped = "\\n";
+				break;
+			case '\r':
+				escaped = "\\r";
+				break;
+			case '\t':
+				escaped = "\\t";
+				break;
+			case '"':
+				escaped = "\\\"";
+				break;
+			case '\\':
+				escaped = "\\\\";
+				break;
+			default:
+				if ((unsigned char) *p >= ' ')
+					continue;
+				escaped = NULL;
+				break;
+		}
+
+		if (p > start)
+			appendBinaryStringInfo(buff, start, (int) (p - start));
+		if (escaped != NULL)
+			appendStringInfoString(buff, escaped);
+		else
+			appendStringInfo(buff, "\\u%04x", (int) *p);
+		start = p + 1;
+	}
+
+	if (p > start)
+		appendBinaryStringInfo(buff, start, (int) (p - start));
+	appendStringInfoCharMacro(buff, '"');
+}
+
+/*
+ * Append json text that was produced by Postgres, making sure it stays on one line
+ * as ES' _bulk endpoint requires.  Only values of type ::json (possibly nested in arrays,
+ * composites, or the result of a cast) can contain line breaks, but they can
+ * only be whitespace between tokens, so replacing them with spaces is safe
+ */
+static void append_json_text(StringInfo buff, text *json) {
+	int start = buff->len;
+
+	appendBinaryStringInfo(buff, VARDATA_ANY(json), (int) VARSIZE_ANY_EXHDR(json));
+	replace_line_breaks(buff->data + start, buff->len - start, ' ');
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void encode_bool(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	if (DatumGetBool(value))
+		appendBinaryStringInfo(buff, "true", 4);
+	else
+		appendBinaryStringInfo(buff, "false", 5);
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void encode_int2(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	enlargeStringInfo(buff, 12);
+	pg_ltoa((int32) DatumGetInt16(value), buff->data + buff->len);
+	buff->len += strlen(buff->data + buff->len);
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void encode_int4(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	enlargeStringInfo(buff, 12);
+	pg_ltoa(DatumGetInt32(value), buff->data + buff->len);
+	buff->len += strlen(buff->data + buff->len);
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void encode_int8(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	enlargeStringInfo(buff, 21);
+	pg_lltoa(DatumGetInt64(value), buff->data + buff->len);
+	buff->len += strlen(buff->data + buff->len);
+}
+
+/*
+ * float4, float8, and numeric.  Values like NaN and Infinity aren't json numbers, so they get quoted
+ */
+static void encode_number(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char *str = OutputFunctionCall(&attr->func, value);
+	int  len  = (int) strlen(str);
+
+	if (IsValidJsonNumber(str, len))
+		appendBinaryStringInfo(buff, str, len);
+	else
+		escape_json_len(buff, str, len);
+	pfree(str);
+}
+
+/*
+ * dates and timestamps are always written in ISO 8601 form, regardless of the session's DateStyle.
+ * These return false for +/-infinity, which is written by the type's output function instead,
+ * just like row_to_json() does
+ */
+static bool xsd_date(Datum value, char *str) {
+	DateADT      date = DatumGetDateADT(value);
+	struct pg_tm tm;
+
+	if (DATE_NOT_FINITE(date))
+		return false;
+
+	j2date(date + POSTGRES_EPOCH_JDATE, &(tm.tm_year), &(tm.tm_mon), &(tm.tm_mday));
+	EncodeDateOnly(&tm, USE_XSD_DATES, str);
+	return true;
+}
+
+static bool xsd_timestamp(Datum value, char *str) {
+	Timestamp    timestamp = DatumGetTimestamp(value);
+	struct pg_tm tm;
+	fsec_t       fsec;
+
+	if (TIMESTAMP_NOT_FINITE(timestamp))
+		return false;
+
+	if (timestamp2tm(timestamp, NULL, &tm, &fsec, NULL, NULL) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+						errmsg("timestamp out of range")));
+
+	EncodeDateTime(&tm, fsec, false, 0, NULL, USE_XSD_DATES, str);
+	return true;
+}
+
+static bool xsd_timestamptz(Datum value, char *str) {
+	TimestampTz  timestamp = DatumGetTimestampTz(value);
+	struct pg_tm tm;
+	fsec_t       fsec;
+	int          tz;
+	const char   *tzn      = NULL;
+
+	if (TIMESTAMP_NOT_FINITE(timestamp))
+		return false;
+
+	if (timestamp2tm(timestamp, &tz, &tm, &fsec, &tzn, NULL) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+						errmsg("timestamp out of range")));
+
+	EncodeDateTime(&tm, fsec, true, tz, tzn, USE_XSD_DATES, str);
+	return true;
+}
+
+static void encode_date(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char str[MAXDATELEN + 1];
+
+	if (xsd_date(value, str))
+		appendStringInfo(buff, "\"%s\"", str);
+	else
+		encode_other(buff, value, attr);
+}
+
+static void encode_timestamp(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char str[MAXDATELEN + 1];
+
+	if (xsd_timestamp(value, str))
+		appendStringInfo(buff, "\"%s\"", str);
+	else
+		encode_other(buff, value, attr);
+}
+
+static void encode_timestamptz(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char str[MAXDATELEN + 1];
+
+	if (xsd_timestamptz(value, str))
+		appendStringInfo(buff, "\"%s\"", str);
+	else
+		encode_other(buff, value, attr);
+}
+
+/*
+ * text, varchar, and bpchar can be escaped straight from the (detoasted) Datum
+ */
+/*lint -esym 715,attr ignore unused param */
+static void encode_text(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	struct varlena *txt = PG_DETOAST_DATUM_PACKED(value);
+
+	escape_json_len(buff, VARDATA_ANY(txt), (int) VARSIZE_ANY_EXHDR(txt));
+	if ((Pointer) txt != DatumGetPointer(value))
+		pfree(txt);
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void encode_json(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	text *json = DatumGetTextPP(value);
+
+	append_json_text(buff, json);
+	if ((Pointer) json != DatumGetPointer(value))
+		pfree(json);
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void encode_jsonb(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	Jsonb *jsonb = DatumGetJsonb(value);
+
+	(void) JsonbToCString(buff, &jsonb->root, VARSIZE(jsonb));
+	if ((Pointer) jsonb != DatumGetPointer(value))
+		pfree(jsonb);
+}
+
+/*
+ * arrays, composites, and types with a cast to json are rare enough and varied enough
+ * that we just let Postgres do the work for us
+ */
+/*lint -esym 715,attr ignore unused param */
+static void encode_array(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	text *json = DatumGetTextPP(DirectFunctionCall1(array_to_json, value));
+
+	append_json_text(buff, json);
+	pfree(json);
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void encode_composite(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	text *json = DatumGetTextPP(DirectFunctionCall1(row_to_json, value));
+
+	append_json_text(buff, json);
+	pfree(json);
+}
+
+static void encode_cast(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	text *json = DatumGetTextPP(FunctionCall1(&attr->func, value));
+
+	append_json_text(buff, json);
+	pfree(json);
+}
+
+/*
+ * everything else is whatever the type's output function says, as a json string
+ */
+static void encode_other(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char *str = OutputFunctionCall(&attr->func, value);
+
+	escape_json_len(buff, str, (int) strlen(str));
+	pfree(str);
+}
+
+/*
+ * SMILE versions of the above.  Types we'd otherwise have Postgres turn into json get transcoded
+ */
+/*lint -esym 715,attr ignore unused param */
+static void smile_encode_bool(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	smile_append_bool(buff, DatumGetBool(value));
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void smile_encode_int2(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	smile_append_int64(buff, (int64) DatumGetInt16(value));
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void smile_encode_int4(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	smile_append_int64(buff, (int64) DatumGetInt32(value));
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void smile_encode_int8(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	smile_append_int64(buff, DatumGetInt64(value));
+}
+
+static void smile_encode_number(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char *str = OutputFunctionCall(&attr->func, value);
+	int  len  = (int) strlen(str);
+
+	if (IsValidJsonNumber(str, len))
+		smile_append_json_number(buff, str, len);
+	else
+		smile_append_string(buff, str, len);
+	pfree(str);
+}
+
+static void smile_encode_date(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char str[MAXDATELEN + 1];
+
+	if (xsd_date(value, str))
+		smile_append_string(buff, str, (int) strlen(str));
+	else
+		smile_encode_other(buff, value, attr);
+}
+
+static void smile_encode_timestamp(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char str[MAXDATELEN + 1];
+
+	if (xsd_timestamp(value, str))
+		smile_append_string(buff, str, (int) strlen(str));
+	else
+		smile_encode_other(buff, value, attr);
+}
+
+static void smile_encode_timestamptz(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char str[MAXDATELEN + 1];
+
+	if (xsd_timestamptz(value, str))
+		smile_append_string(buff, str, (int) strlen(str));
+	else
+		smile_encode_other(buff, value, attr);
+}
+
+/*lint -esym 715,attr ignore unused param */
+static void smile_encode_text(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	struct varlena *txt = PG_DETOAST_DATUM_PACKED(value);
+
+	smile_append_string(buff, VARDATA_ANY(txt), (int) VARSIZE_ANY_EXHDR(txt));
+	if ((Pointer) txt != DatumGetPointer(value))
+		pfree(txt);
+}
+
+/*
+ * json, jsonb, arrays, composites, and casts to json
+ */
+static void smile_encode_via_json(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	StringInfoData json;
+
+	initStringInfo(&json);
+	attr->encoder(&json, value, attr);
+	smile_append_json(buff, json.data, json.len);
+	pfree(json.data);
+}
+
+static void smile_encode_other(StringInfo buff, Datum value, RowEncoderAttribute *attr) {
+	char *str = OutputFunctionCall(&attr->func, value);
+
+	smile_append_string(buff, str, (int) strlen(str));
+	pfree(str);
+}
+
+/*
+ * Decide how to encode an attribute of the specified type.  This follows the same rules as
+ * Postgres' json_categorize_type() so that the output is identical to row_to_json()
+ */
+static void categorize_attribute(RowEncoderAttribute *attr, Oid typeOid, MemoryContext memcxt) {
+	Oid  funcOid = InvalidOid;
+	bool isvarlena;
+
+	typeOid = getBaseType(typeOid);
+
+	switch (typeOid) {
+		case BOOLOID:
+			attr->encoder = encode_bool;
+			attr->smileEncoder = smile_encode_bool;
+			break;
+
+		case INT2OID:
+			attr->encoder = encode_int2;
+			attr->smileEncoder = smile_encode_int2;
+			break;
+
+		case INT4OID:
+			attr->encoder = encode_int4;
+			attr->smileEncoder = smile_encode_int4;
+			break;
+
+		case INT8OID:
+			attr->encoder = encode_int8;
+			attr->smileEncoder = smile_encode_int8;
+			break;
+
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+			attr->encoder = encode_number;
+			attr->smileEncoder = smile_encode_number;
+			getTypeOutputInfo(typeOid, &funcOid, &isvarlena);
+			break;
+
+		case DATEOID:
+			attr->encoder = encode_date;
+			attr->smileEncoder = smile_encode_date;
+			getTypeOutputInfo(typeOid, &funcOid, &isvarlena);
+			break;
+
+		case TIMESTAMPOID:
+			attr->encoder = encode_timestamp;
+			attr->smileEncoder = smile_encode_timestamp;
+			getTypeOutputInfo(typeOid, &funcOid, &isvarlena);
+			break;
+
+		case TIMESTAMPTZOID:
+			attr->encoder = encode_timestamptz;
+			attr->smileEncoder = smile_encode_timestamptz;
+			getTypeOutputInfo(typeOid, &funcOid, &isvarlena);
+			break;
+
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			attr->encoder = encode_text;
+			attr->smileEncoder = smile_encode_text;
+			break;
+
+		case JSONOID:
+			attr->encoder = encode_json;
+			attr->smileEncoder = smile_encode_via_json;
+			break;
+
+		case JSONBOID:
+			attr->encoder = encode_jsonb;
+			attr->smileEncoder = smile_encode_via_json;
+			break;
+
+		default:
+			if (OidIsValid(get_element_type(typeOid)) || typeOid == ANYARRAYOID || typeOid == RECORDARRAYOID) {
+				attr->encoder = encode_array;
+				attr->smileEncoder = smile_encode_via_json;
+			} else if (type_is_rowtype(typeOid)) {
+				attr->encoder = encode_composite;
+				attr->smileEncoder = smile_encode_via_json;
+			} else {
+				attr->encoder = encode_other;
+				attr->smileEncoder = smile_encode_other;
+
+				/* user-defined types might have a cast to json, which row_to_json() would use */
+				if (typeOid >= FirstNormalObjectId) {
+					Oid              castFunc;
+					CoercionPathType ctype;
+
+					ctype = find_coercion_pathway(JSONOID, typeOid, COERCION_EXPLICIT, &castFunc);
+					if (ctype == COERCION_PATH_FUNC && OidIsValid(castFunc)) {
+						attr->encoder = encode_cast;
+						attr->smileEncoder = smile_encode_via_json;
+						funcOid = castFunc;
+					}
+				}
+
+				if (!OidIsValid(funcOid))
+					getTypeOutputInfo(typeOid, &funcOid, &isvarlena);
+			}
+			break;
+	}
+
+	if (OidIsValid(funcOid))
+		fmgr_info_cxt(funcOid, &attr->func, memcxt);
+}
+
+RowEncoderPlan *row_encoder_create_plan(Datum record, MemoryContext memcxt) {
+	MemoryContext   oldContext = MemoryContextSwitchTo(memcxt);
+	RowEncoderPlan  *plan      = palloc0(sizeof(RowEncoderPlan));
+	TupleDesc       tupdesc    = lookup_composite_tupdesc(record);
+	StringInfo      key        = makeStringInfo();
+	int             i;
+
+	plan->typeId  = tupdesc->tdtypeid;
+	plan->typeMod = tupdesc->tdtypmod;
+	plan->tupdesc = CreateTupleDescCopy(tupdesc);
+	plan->attrs   = palloc0(sizeof(RowEncoderAttribute) * tupdesc->natts);
+	plan->values  = palloc(sizeof(Datum) * tupdesc->natts);
+	plan->nulls   = palloc(sizeof(bool) * tupdesc->natts);
+	ReleaseTupleDesc(tupdesc);
+
+	for (i = 0; i < plan->tupdesc->natts; i++) {
+		Form_pg_attribute   att   = plan->tupdesc->attrs[i];
+		RowEncoderAttribute *attr = &plan->attrs[i];
+
+		if (att->attisdropped) {
+			attr->dropped = true;
+			continue;
+		}
+
+		resetStringInfo(key);
+		escape_json(key, NameStr(att->attname));
+		appendStringInfoChar(key, ':');
+		attr->key    = pstrdup(key->data);
+		attr->keylen = key->len;
+
+		resetStringInfo(key);
+		smile_append_key(key, NameStr(att->attname), (int) strlen(NameStr(att->attname)));
+		attr->smileKey    = palloc(key->len);
+		attr->smileKeylen = key->len;
+		memcpy(attr->smileKey, key->data, key->len);
+
+		categorize_attribute(attr, att->atttypid, memcxt);
+	}
+
+	freeStringInfo(key);
+	MemoryContextSwitchTo(oldContext);
+
+	return plan;
+}
+
+bool row_encoder_plan_matches(RowEncoderPlan *plan, Datum record) {
+	HeapTupleHeader td = DatumGetHeapTupleHeader(record);
+
+	return plan->typeId == HeapTupleHeaderGetTypeId(td) && plan->typeMod == HeapTupleHeaderGetTypMod(td);
+}
+
+static void deform_record(RowEncoderPlan *plan, Datum record) {
+	HeapTupleHeader td = DatumGetHeapTupleHeader(record);
+	HeapTupleData   tuple;
+
+	tuple.t_len = HeapTupleHeaderGetDatumLength(td);
+	ItemPointerSetInvalid(&(tuple.t_self));
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data     = td;
+
+	heap_deform_tuple(&tuple, plan->tupdesc, plan->values, plan->nulls);
+}
+
+/*
+ * Write the json form of the record to the end of 'buff', without the closing brace so that
+ * the caller can add properties of its own.  Returns true if any properties were written.
+ * 
+ * The caller is expected to be in a short-lived MemoryContext as Datum detoasting and
+ * output functions may leave garbage behind
+ */
+bool row_encoder_encode(RowEncoderPlan *plan, StringInfo buff, Datum record) {
+	bool needsep = false;
+	int  i;
+
+	deform_record(plan, record);
+
+	appendStringInfoCharMacro(buff, '{');
+	for (i = 0; i < plan->tupdesc->natts; i++) {
+		RowEncoderAttribute *attr = &plan->attrs[i];
+
+		if (attr->dropped)
+			continue;
+
+		if (needsep)
+			appendStringInfoCharMacro(buff, ',');
+		needsep = true;
+
+		appendBinaryStringInfo(buff, attr->key, attr->keylen);
+		if (plan->nulls[i])
+			appendBinaryStringInfo(buff, "null", 4);
+		else
+			attr->encoder(buff, plan->values[i], attr);
+	}
+
+	return needsep;
+}
+
+/*
+ * Same as row_encoder_encode(), but writes SMILE.  The caller is responsible for the
+ * SMILE header and the END_OBJECT token
+ */
+bool row_encoder_encode_smile(RowEncoderPlan *plan, StringInfo buff, Datum record) {
+	bool any = false;
+	int  i;
+
+	deform_record(plan, record);
+
+	smile_append_token(buff, SMILE_START_OBJECT);
+	for (i = 0; i < plan->tupdesc->natts; i++) {
+		RowEncoderAttribute *attr = &plan->attrs[i];
+
+		if (attr->dropped)
+			continue;
+		any = true;
+
+		appendBinaryStringInfo(buff, attr->smileKey, attr->smileKeylen);
+		if (plan->nulls[i])
+			smile_append_null(buff);
+		else
+			attr->smileEncoder(buff, plan->values[i], attr);
+	}
+
+	return any;
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ZDB_ROW_ENCODER_H__
+#define __ZDB_ROW_ENCODER_H__
+
+#include "postgres.h"
+#include "access/tupdesc.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+
+struct RowEncoderAttribute;
+
+typedef void (*RowEncoderFunc)(StringInfo buff, Datum value, struct RowEncoderAttribute *attr);
+
+typedef struct RowEncoderAttribute {
+	char           *key;      /* the attribute name as a quoted json string, followed by a colon */
+	int            keylen;
+	bool           dropped;
+	RowEncoderFunc encoder;
+	char           *smileKey; /* the attribute name as a SMILE key */
+	int            smileKeylen;
+	RowEncoderFunc smileEncoder;
+	FmgrInfo       func;      /* the type's output function, or its cast to json, for encoders that need one */
+} RowEncoderAttribute;
+
+/*
+ * A RowEncoderPlan is built once per row type and then used to write the json form
+ * of each row directly into a StringInfo, exactly as row_to_json() would have produced it,
+ * or the equivalent SMILE
+ */
+typedef struct RowEncoderPlan {
+	Oid                 typeId;
+	int32               typeMod;
+	TupleDesc           tupdesc;
+	RowEncoderAttribute *attrs;
+	Datum               *values;
+	bool                *nulls;
+} RowEncoderPlan;
+
+RowEncoderPlan *row_encoder_create_plan(Datum record, MemoryContext memcxt);
+bool row_encoder_plan_matches(RowEncoderPlan *plan, Datum record);
+bool row_encoder_encode(RowEncoderPlan *plan, StringInfo buff, Datum record);
+bool row_encoder_encode_smile(RowEncoderPlan *plan, StringInfo buff, Datum record);
+
+#endif /* __ZDB_ROW_ENCODER_H__ */
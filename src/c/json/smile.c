@@ -0,0 +1,298 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "smile.h"
+#include "json.h"
+
+#include <math.h>
+
+#define SMILE_HEADER_FLAGS 0x00    /* version 0, no shared names or values, no raw binary */
+
+#define SMILE_EMPTY_STRING 0x20
+#define SMILE_NULL         0x21
+#define SMILE_FALSE        0x22
+#define SMILE_TRUE         0x23
+#define SMILE_INT32        0x24
+#define SMILE_INT64        0x25
+#define SMILE_FLOAT64      0x29
+#define SMILE_TINY_ASCII   0x40    /* 1-32 bytes */
+#define SMILE_SHORT_ASCII  0x60    /* 33-64 bytes */
+#define SMILE_TINY_UNICODE 0x80    /* 2-33 bytes */
+#define SMILE_SHORT_UNICODE 0xA0   /* 34-65 bytes */
+#define SMILE_SMALL_INT    0xC0    /* -16 to 15, zigzag encoded */
+#define SMILE_LONG_ASCII   0xE0
+#define SMILE_LONG_UNICODE 0xE4
+#define SMILE_END_STRING   0xFC
+
+#define SMILE_KEY_EMPTY         0x20
+#define SMILE_KEY_LONG_UNICODE  0x34
+#define SMILE_KEY_SHORT_ASCII   0x80    /* 1-64 bytes */
+#define SMILE_KEY_SHORT_UNICODE 0xC0    /* 2-57 bytes */
+
+/*lint -esym 715,user_data */
+static void *json_alloc(void *user_data, size_t size) {
+	return palloc(size);
+}
+
+static bool is_ascii(const char *str, int len) {
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if ((unsigned char) str[i] >= 0x80)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * SMILE's variable-length unsigned int:  7 bits per byte, most significant first, with
+ * the last byte holding just 6 bits and its high bit set
+ */
+static void append_vint(StringInfo buff, uint64 value) {
+	char bytes[10];
+	int  i = sizeof(bytes) - 1;
+
+	bytes[i] = (char) (0x80 | (value & 0x3F));
+	value >>= 6;
+	while (value != 0) {
+		bytes[--i] = (char) (value & 0x7F);
+		value >>= 7;
+	}
+
+	appendBinaryStringInfo(buff, bytes + i, (int) sizeof(bytes) - i);
+}
+
+void smile_append_header(StringInfo buff) {
+	appendBinaryStringInfo(buff, ":)\n", 3);
+	appendStringInfoCharMacro(buff, (char) SMILE_HEADER_FLAGS);
+}
+
+void smile_append_key(StringInfo buff, const char *key, int len) {
+	bool ascii = is_ascii(key, len);
+
+	if (len == 0) {
+		smile_append_token(buff, SMILE_KEY_EMPTY);
+		return;
+	} else if (ascii && len <= 64) {
+		smile_append_token(buff, SMILE_KEY_SHORT_ASCII + len - 1);
+	} else if (!ascii && len >= 2 && len <= 57) {
+		smile_append_token(buff, SMILE_KEY_SHORT_UNICODE + len - 2);
+	} else {
+		smile_append_token(buff, SMILE_KEY_LONG_UNICODE);
+		appendBinaryStringInfo(buff, key, len);
+		smile_append_token(buff, SMILE_END_STRING);
+		return;
+	}
+
+	appendBinaryStringInfo(buff, key, len);
+}
+
+void smile_append_string(StringInfo buff, const char *str, int len) {
+	bool ascii = is_ascii(str, len);
+
+	if (len == 0) {
+		smile_append_token(buff, SMILE_EMPTY_STRING);
+		return;
+	} else if (ascii && len <= 32) {
+		smile_append_token(buff, SMILE_TINY_ASCII + len - 1);
+	} else if (ascii && len <= 64) {
+		smile_append_token(buff, SMILE_SHORT_ASCII + len - 33);
+	} else if (!ascii && len >= 2 && len <= 33) {
+		smile_append_token(buff, SMILE_TINY_UNICODE + len - 2);
+	} else if (!ascii && len >= 34 && len <= 65) {
+		smile_append_token(buff, SMILE_SHORT_UNICODE + len - 34);
+	} else {
+		smile_append_token(buff, ascii ? SMILE_LONG_ASCII : SMILE_LONG_UNICODE);
+		appendBinaryStringInfo(buff, str, len);
+		smile_append_token(buff, SMILE_END_STRING);
+		return;
+	}
+
+	appendBinaryStringInfo(buff, str, len);
+}
+
+void smile_append_int64(StringInfo buff, int64 value) {
+	if (value >= -16 && value <= 15) {
+		smile_append_token(buff, SMILE_SMALL_INT + (int) (((uint64) value << 1) ^ (uint64) (value >> 63)));
+	} else if (value >= PG_INT32_MIN && value <= PG_INT32_MAX) {
+		int32 v = (int32) value;
+
+		smile_append_token(buff, SMILE_INT32);
+		append_vint(buff, (uint32) (((uint32) v << 1) ^ (uint32) (v >> 31)));
+	} else {
+		smile_append_token(buff, SMILE_INT64);
+		append_vint(buff, ((uint64) value << 1) ^ (uint64) (value >> 63));
+	}
+}
+
+/*
+ * the raw IEEE 754 bits, 7 per byte, most significant first
+ */
+void smile_append_double(StringInfo buff, double value) {
+	union {
+		double d;
+		uint64 l;
+	}    bits;
+	char bytes[10];
+	int  i;
+
+	bits.d = value;
+	for (i = 9; i >= 0; i--) {
+		bytes[i] = (char) (bits.l & 0x7F);
+		bits.l >>= 7;
+	}
+
+	smile_append_token(buff, SMILE_FLOAT64);
+	appendBinaryStringInfo(buff, bytes, sizeof(bytes));
+}
+
+void smile_append_bool(StringInfo buff, bool value) {
+	smile_append_token(buff, value ? SMILE_TRUE : SMILE_FALSE);
+}
+
+void smile_append_null(StringInfo buff) {
+	smile_append_token(buff, SMILE_NULL);
+}
+
+/*
+ * A number in json form.  Integers that fit in an int64 stay integers, everything else becomes a double
+ */
+void smile_append_json_number(StringInfo buff, const char *number, int len) {
+	char str[64];
+	char *end;
+
+	if (len >= (int) sizeof(str)) {
+		/* far more digits than either an int64 or a double can hold */
+		char *copy = pnstrdup(number, len);
+
+		smile_append_double(buff, strtod(copy, NULL));
+		pfree(copy);
+		return;
+	}
+
+	memcpy(str, number, len);
+	str[len] = '\0';
+
+	if (strpbrk(str, ".eE") == NULL) {
+		int64 value;
+
+		errno = 0;
+		value = strtoll(str, &end, 10);
+		if (errno == 0 && *end == '\0') {
+			smile_append_int64(buff, value);
+			return;
+		}
+	}
+
+	smile_append_double(buff, strtod(str, NULL));
+}
+
+static void append_json_value(StringInfo buff, struct json_value_s *value) {
+	switch (value->type) {
+		case json_type_string: {
+			struct json_string_s *string = (struct json_string_s *) value->payload;
+
+			smile_append_string(buff, string->string, (int) string->string_size);
+		}
+			break;
+
+		case json_type_number: {
+			struct json_number_s *number = (struct json_number_s *) value->payload;
+
+			smile_append_json_number(buff, number->number, (int) number->number_size);
+		}
+			break;
+
+		case json_type_object: {
+			struct json_object_s         *object = (struct json_object_s *) value->payload;
+			struct json_object_element_s *elem;
+
+			smile_append_token(buff, SMILE_START_OBJECT);
+			for (elem = object->start; elem != NULL; elem = elem->next) {
+				smile_append_key(buff, elem->name->string, (int) elem->name->string_size);
+				append_json_value(buff, elem->value);
+			}
+			smile_append_token(buff, SMILE_END_OBJECT);
+		}
+			break;
+
+		case json_type_array: {
+			struct json_array_s         *array = (struct json_array_s *) value->payload;
+			struct json_array_element_s *elem;
+
+			smile_append_token(buff, SMILE_START_ARRAY);
+			for (elem = array->start; elem != NULL; elem = elem->next)
+				append_json_value(buff, elem->value);
+			smile_append_token(buff, SMILE_END_ARRAY);
+		}
+			break;
+
+		case json_type_true:
+			smile_append_bool(buff, true);
+			break;
+
+		case json_type_false:
+			smile_append_bool(buff, false);
+			break;
+
+		default:
+			smile_append_null(buff);
+			break;
+	}
+}
+
+/*
+ * Transcode a single json value into SMILE, without a header
+ */
+void smile_append_json(StringInfo buff, const char *json, int len) {
+	struct json_value_s        *value;
+	struct json_parse_result_s result;
+
+	value = json_parse_ex(json, (size_t) len, json_parse_flags_default, json_alloc, NULL, &result);
+	if (value == NULL) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						errmsg("Error parsing json: code=%ld", result.error)));
+	}
+
+	append_json_value(buff, value);
+	pfree(value);
+}
+
+/*
+ * Transcode newline-delimited json documents, such as the lines of a _bulk request,
+ * into a stream of SMILE documents
+ */
+void smile_append_json_lines(StringInfo buff, const char *json, int len) {
+	const char *end = json + len;
+
+	while (json < end) {
+		const char *eol = memchr(json, '\n', end - json);
+		int        linelen;
+
+		if (eol == NULL)
+			eol = end;
+		linelen = (int) (eol - json);
+
+		if (linelen > 0) {
+			smile_append_header(buff);
+			smile_append_json(buff, json, linelen);
+			smile_append_token(buff, SMILE_END_OF_CONTENT);
+		}
+
+		json = eol + 1;
+	}
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ZDB_SMILE_H__
+#define __ZDB_SMILE_H__
+
+#include "postgres.h"
+#include "lib/stringinfo.h"
+
+/*
+ * Support for writing Jackson's SMILE binary json format, which Elasticsearch accepts
+ * everywhere it accepts json, including as the documents of a _bulk request.
+ *
+ * See https://github.com/FasterXML/smile-format-specification
+ */
+
+#define SMILE_START_OBJECT   0xFA
+#define SMILE_END_OBJECT     0xFB
+#define SMILE_START_ARRAY    0xF8
+#define SMILE_END_ARRAY      0xF9
+#define SMILE_END_OF_CONTENT 0xFF    /* separates documents in a stream, such as a _bulk request */
+
+#define smile_append_token(buff, token) appendStringInfoCharMacro((buff), (char) (token))
+
+void smile_append_header(StringInfo buff);
+void smile_append_key(StringInfo buff, const char *key, int len);
+void smile_append_string(StringInfo buff, const char *str, int len);
+void smile_append_int64(StringInfo buff, int64 value);
+void smile_append_double(StringInfo buff, double value);
+void smile_append_bool(StringInfo buff, bool value);
+void smile_append_null(StringInfo buff);
+void smile_append_json_number(StringInfo buff, const char *number, int len);
+
+void smile_append_json(StringInfo buff, const char *json, int len);
+void smile_append_json_lines(StringInfo buff, const char *json, int len);
+
+#endif /* __ZDB_SMILE_H__ */
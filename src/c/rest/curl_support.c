@@ -15,16 +15,76 @@
  */
 
 #include "curl_support.h"
+#include "io_thread.h"
+#include "nodes.h"
+#include "rest.h"
 
 #include "access/xact.h"
 #include "utils/memutils.h"
 
+#include <pthread.h>
+
+/* how many idle easy handles we keep around for the next MultiRestState to use */
+#define MAX_IDLE_CURL_HANDLES 32
 
 static List *curlMultiHandles = NULL;
 
+/*
+ * Every easy handle we make shares its connection and DNS caches through GLOBAL_CURL_SHARE, so
+ * connections to Elasticsearch are kept alive and reused across requests, MultiRestStates,
+ * and transactions.
+ *
+ * libcurl doesn't allow a connection cache to be used by two threads at once, even with locking,
+ * so the handles the I/O thread drives only share the DNS cache, through IO_THREAD_CURL_SHARE, and
+ * keep their connections in the I/O thread's multi handle.  The DNS cache is used by both threads,
+ * so access to it is locked
+ */
+static CURLSH          *GLOBAL_CURL_SHARE    = NULL;
+static CURLSH          *IO_THREAD_CURL_SHARE = NULL;
+static pthread_mutex_t curlShareLocks[CURL_LOCK_DATA_LAST];
+
+static CURL *idleCurlHandles[MAX_IDLE_CURL_HANDLES];
+static int  nidleCurlHandles = 0;
+
 CURL *GLOBAL_CURL_INSTANCE;
 char GLOBAL_CURL_ERRBUF[CURL_ERROR_SIZE];
 
+/*lint -esym 715,handle,access,userptr ignore unused params */
+static void curl_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+	pthread_mutex_lock(&curlShareLocks[data]);
+}
+
+/*lint -esym 715,handle,userptr ignore unused params */
+static void curl_share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+	pthread_mutex_unlock(&curlShareLocks[data]);
+}
+
+static void init_curl_share(void) {
+	int i;
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&curlShareLocks[i], NULL);
+
+	IO_THREAD_CURL_SHARE = curl_share_init();
+	if (IO_THREAD_CURL_SHARE != NULL) {
+		curl_share_setopt(IO_THREAD_CURL_SHARE, CURLSHOPT_LOCKFUNC, curl_share_lock);
+		curl_share_setopt(IO_THREAD_CURL_SHARE, CURLSHOPT_UNLOCKFUNC, curl_share_unlock);
+		curl_share_setopt(IO_THREAD_CURL_SHARE, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	}
+
+	GLOBAL_CURL_SHARE = curl_share_init();
+	if (GLOBAL_CURL_SHARE == NULL)
+		return; /* we'll just have to live without it */
+
+	curl_share_setopt(GLOBAL_CURL_SHARE, CURLSHOPT_LOCKFUNC, curl_share_lock);
+	curl_share_setopt(GLOBAL_CURL_SHARE, CURLSHOPT_UNLOCKFUNC, curl_share_unlock);
+	curl_share_setopt(GLOBAL_CURL_SHARE, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	/* sharing connections needs libcurl 7.57.0 */
+	curl_share_setopt(GLOBAL_CURL_SHARE, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
 /*
  * Cleanup libcurl allocated objects when the transaction finishes
  */
@@ -42,6 +102,13 @@ static void curl_cleanup_callback(XactEvent event, void *arg) {
 				if (state != NULL && state->multi_handle != NULL) {
 					int i;
 
+					if (state->iothread != NULL) {
+						/* the I/O thread must be gone before we touch its multi handle */
+						rest_io_thread_stop(state->iothread, true);
+						pfree(state->iothread);
+						state->iothread = NULL;
+					}
+
 					for (i = 0; i < state->nhandles; i++) {
 						if (state->handles[i] != NULL) {
 							curl_multi_remove_handle(state->multi_handle, state->handles[i]);
@@ -54,6 +121,9 @@ static void curl_cleanup_callback(XactEvent event, void *arg) {
 					curl_multi_cleanup(state->multi_handle);
 				}
 			}
+
+			/* none of the requests we'd started are in flight anymore */
+			rest_nodes_forget_outstanding();
 		}
 			break;
 		default:
@@ -69,6 +139,28 @@ static void curl_cleanup_callback(XactEvent event, void *arg) {
 		case XACT_EVENT_PREPARE:
 			list_free_deep(curlMultiHandles);
 			curlMultiHandles = NULL;
+
+			/* asynchronous requests nobody waited for */
+			rest_async_cleanup();
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*
+ * Asynchronous requests belong to the subtransaction that started them
+ */
+/*lint -esym 715,arg ignore unused param */
+static void curl_subxact_callback(SubXactEvent event, SubTransactionId mySubid, SubTransactionId parentSubid, void *arg) {
+	switch (event) {
+		case SUBXACT_EVENT_ABORT_SUB:
+			rest_async_subxact_cleanup(mySubid, parentSubid, false);
+			break;
+
+		case SUBXACT_EVENT_COMMIT_SUB:
+			rest_async_subxact_cleanup(mySubid, parentSubid, true);
 			break;
 
 		default:
@@ -92,16 +184,20 @@ void curl_support_init(void) {
 						errmsg("Problem initializing libcurl:  rc=%d", rc)));
 	}
 
+	init_curl_share();
+
 	GLOBAL_CURL_INSTANCE = curl_easy_init();
 	if (GLOBAL_CURL_INSTANCE == NULL) {
 		ereport(ERROR,
 				(errcode(ERRCODE_IO_ERROR),
 						errmsg("Error initializing our GLOBAL_CURL_INSTANCE")));
 	}
+	curl_easy_setopt(GLOBAL_CURL_INSTANCE, CURLOPT_SHARE, GLOBAL_CURL_SHARE);
 	memset(GLOBAL_CURL_ERRBUF, 0, CURL_ERROR_SIZE);
 
 	/* A callback for freeing libcurl-allocated objects when the transaction completes */
 	RegisterXactCallback(curl_cleanup_callback, NULL);
+	RegisterSubXactCallback(curl_subxact_callback, NULL);
 }
 
 void curl_record_multi_handle(MultiRestState *state) {
@@ -117,3 +213,41 @@ void curl_forget_multi_handle(MultiRestState *state) {
 	pfree(state);
 }
 
+/*
+ * Get an easy handle for a MultiRestState request, reusing an idle one if we have it.  The
+ * handle has no options set other than its connection to GLOBAL_CURL_SHARE, or to
+ * IO_THREAD_CURL_SHARE if the I/O thread will be driving it
+ */
+CURL *curl_checkout_easy_handle(bool forIOThread) {
+	CURL *curl;
+
+	if (nidleCurlHandles > 0) {
+		curl = idleCurlHandles[--nidleCurlHandles];
+	} else {
+		curl = curl_easy_init();
+		if (curl == NULL) {
+			ereport(ERROR,
+					(errcode(ERRCODE_IO_ERROR),
+							errmsg("unable to initialize curl handle")));
+		}
+	}
+	curl_easy_setopt(curl, CURLOPT_SHARE, forIOThread ? IO_THREAD_CURL_SHARE : GLOBAL_CURL_SHARE);
+
+	return curl;
+}
+
+/*
+ * Give back a handle from curl_checkout_easy_handle() that's finished with its request and
+ * no longer part of a multi handle
+ */
+void curl_return_easy_handle(CURL *curl) {
+	if (nidleCurlHandles == MAX_IDLE_CURL_HANDLES) {
+		curl_easy_cleanup(curl);
+		return;
+	}
+
+	/* forget about the request's headers, buffers, and callbacks.  The share is set at checkout */
+	curl_easy_reset(curl);
+
+	idleCurlHandles[nidleCurlHandles++] = curl;
+}
@@ -20,18 +20,33 @@
 #include "postgres.h"
 #include "lib/stringinfo.h"
 #include "nodes/pg_list.h"
+#include "utils/timestamp.h"
 
 #include <curl/curl.h>
+#include <zlib.h>
 
 /* this needs to match elasticsearch.h:MAX_BULK_CONCURRENCY */
 #define MAX_CURL_HANDLES 1024
 
+/*
+ * A request body that's built up over time, such as a _bulk request.  When compression is on,
+ * the contents of 'buff' are periodically deflated into 'compressed' so that the body is
+ * (nearly) ready to send the moment it's full
+ */
 typedef struct PostDataEntry {
 	int        pool_idx;
-	StringInfo buff;
-	char       *compressed_data;
+	StringInfo buff;        /* data not yet fed to 'zstream' */
+	z_stream   *zstream;    /* NULL if compression is off */
+	StringInfo compressed;
+	int64      nflushed;    /* how many uncompressed bytes have been fed to 'zstream' */
+	const char *contentType; /* NULL means application/json */
+	char       separator;   /* what terminates each document in the body */
+	bool       replayable;  /* can the whole body be sent again without changing what it does? */
 } PostDataEntry;
 
+/* the total, uncompressed, size of a PostDataEntry */
+#define PostDataEntryLength(entry) ((entry)->nflushed + (entry)->buff->len)
+
 typedef struct MultiRestState {
 	int               nhandles;
 	CURL              *handles[MAX_CURL_HANDLES];
@@ -40,11 +55,21 @@ typedef struct MultiRestState {
 	PostDataEntry     *postDatas[MAX_CURL_HANDLES];
 	StringInfo        responses[MAX_CURL_HANDLES];
 	bool              vconflicts[MAX_CURL_HANDLES];    /* should we ignore version conflicts for this request? */
+	int               nretries[MAX_CURL_HANDLES];      /* how many times has this request been rejected and retried? */
+	TimestampTz       retryAt[MAX_CURL_HANDLES];       /* when a rejected request is to be sent again, or 0 */
 
 	CURLM *multi_handle;
 	int   available;
+	int   limit;    /* the most requests we'll allow in flight at once, never more than 'nhandles' */
+
+	/* running totals for anyone that wants to adapt to how the remote server is coping */
+	uint64 ncompleted;
+	uint64 nrejected;
+	double total_seconds;
+
+	PostDataEntry **pool;
 
-	StringInfo *pool;
+	struct RestIOThread *iothread;    /* if not NULL, owns 'multi_handle' */
 } MultiRestState;
 
 extern CURL *GLOBAL_CURL_INSTANCE;
@@ -53,5 +78,7 @@ extern char GLOBAL_CURL_ERRBUF[CURL_ERROR_SIZE];
 void curl_support_init(void);
 void curl_record_multi_handle(MultiRestState *state);
 void curl_forget_multi_handle(MultiRestState *state);
+CURL *curl_checkout_easy_handle(bool forIOThread);
+void curl_return_easy_handle(CURL *curl);
 
 #endif /* __ZDB_CURL_SUPPORT_H__ */
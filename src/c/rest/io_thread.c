@@ -0,0 +1,305 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "io_thread.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/latch.h"
+#include "utils/memutils.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define IO_QUEUE_SIZE (MAX_CURL_HANDLES + 1)
+
+static bool queue_push(RestIOQueue *queue, int item) {
+	uint32 tail = pg_atomic_read_u32(&queue->tail);
+	uint32 next = (tail + 1) % IO_QUEUE_SIZE;
+
+	if (next == pg_atomic_read_u32(&queue->head))
+		return false;   /* full */
+
+	queue->items[tail] = item;
+	pg_write_barrier();
+	pg_atomic_write_u32(&queue->tail, next);
+	return true;
+}
+
+static bool queue_pop(RestIOQueue *queue, int *item) {
+	uint32 head = pg_atomic_read_u32(&queue->head);
+
+	if (head == pg_atomic_read_u32(&queue->tail))
+		return false;   /* empty */
+
+	pg_read_barrier();
+	*item = queue->items[head];
+	pg_memory_barrier();
+	pg_atomic_write_u32(&queue->head, (head + 1) % IO_QUEUE_SIZE);
+	return true;
+}
+
+static void drain_pipe(int fd) {
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		/* keep going */ ;
+}
+
+static void poke_pipe(int fd) {
+	char c = 'x';
+
+	/* the pipe is non-blocking, and if it's full the reader already has a wakeup pending */
+	(void) write(fd, &c, 1);
+}
+
+/*
+ * libcurl callbacks used while a handle belongs to the I/O thread
+ */
+static size_t io_thread_write_func(char *ptr, size_t size, size_t nmemb, void *userdata) {
+	RestIOBuffer *buff = (RestIOBuffer *) userdata;
+	size_t       len   = size * nmemb;
+
+	if (buff->len + len + 1 > buff->maxlen) {
+		size_t newlen = Max(Max(buff->maxlen * 2, buff->len + len + 1), 1024);
+		char   *data  = realloc(buff->data, newlen);
+
+		if (data == NULL)
+			return 0;   /* tells libcurl the write failed */
+
+		buff->data   = data;
+		buff->maxlen = newlen;
+	}
+
+	memcpy(buff->data + buff->len, ptr, len);
+	buff->len += len;
+	buff->data[buff->len] = '\0';
+	return len;
+}
+
+/*lint -esym 715,dltotal,dlnow,ultotal,ulnow */
+static int io_thread_progress_func(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+	RestIOThread *iot = (RestIOThread *) clientp;
+
+	return pg_atomic_read_u32(&iot->abort) ? -1 : 0;
+}
+
+static void *io_thread_main(void *arg) {
+	RestIOThread *iot = (RestIOThread *) arg;
+	CURLM        *multi = iot->state->multi_handle;
+	CURLMcode    mc     = CURLM_OK;
+
+	while (!pg_atomic_read_u32(&iot->stop)) {
+		struct curl_waitfd wakeup;
+		CURLMsg            *msg;
+		int                msgs_left;
+		int                still_running;
+		int                numfds;
+		int                slot;
+		bool               notify = false;
+
+		drain_pipe(iot->wakeup_pipe[0]);
+
+		while (queue_pop(&iot->submitted, &slot)) {
+			if ((mc = curl_multi_add_handle(multi, iot->state->handles[slot])) != CURLM_OK)
+				goto done;
+		}
+
+		while ((mc = curl_multi_perform(multi, &still_running)) == CURLM_CALL_MULTI_PERFORM)
+			/* keep going */ ;
+		if (mc != CURLM_OK)
+			goto done;
+
+		while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+			if (msg->msg == CURLMSG_DONE) {
+				CURL     *handle = msg->easy_handle;
+				CURLcode result  = msg->data.result;
+				char     *private;
+
+				curl_easy_getinfo(handle, CURLINFO_PRIVATE, &private);
+				slot = (int) (intptr_t) private;
+
+				curl_multi_remove_handle(multi, handle);
+				iot->results[slot] = result;
+				(void) queue_push(&iot->completed, slot);   /* can't be full:  it's as big as the handle array */
+				notify = true;
+			}
+		}
+
+		if (notify)
+			poke_pipe(iot->done_pipe[1]);
+
+		wakeup.fd      = iot->wakeup_pipe[0];
+		wakeup.events  = CURL_WAIT_POLLIN;
+		wakeup.revents = 0;
+		if ((mc = curl_multi_wait(multi, &wakeup, 1, 1000, &numfds)) != CURLM_OK)
+			goto done;
+	}
+
+done:
+	pg_atomic_write_u32(&iot->error, (uint32) mc);
+	poke_pipe(iot->done_pipe[1]);
+	return NULL;
+}
+
+static void make_pipe(int fds[2]) {
+	if (pipe(fds) != 0 ||
+		fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+		fcntl(fds[1], F_SETFL, O_NONBLOCK) == -1) {
+		ereport(ERROR,
+				(errcode_for_file_access(),
+						errmsg("unable to create I/O thread pipe: %m")));
+	}
+}
+
+/*
+ * Start an I/O thread that takes over 'state's multi handle.  From here on the backend
+ * must not call any curl_multi_*() function on it until rest_io_thread_stop()
+ */
+RestIOThread *rest_io_thread_start(MultiRestState *state) {
+	RestIOThread *iot = MemoryContextAllocZero(TopMemoryContext, sizeof(RestIOThread));
+	sigset_t     all_signals;
+	sigset_t     old_signals;
+	int          rc;
+
+	iot->state = state;
+	pg_atomic_init_u32(&iot->submitted.head, 0);
+	pg_atomic_init_u32(&iot->submitted.tail, 0);
+	pg_atomic_init_u32(&iot->completed.head, 0);
+	pg_atomic_init_u32(&iot->completed.tail, 0);
+	pg_atomic_init_u32(&iot->stop, 0);
+	pg_atomic_init_u32(&iot->abort, 0);
+	pg_atomic_init_u32(&iot->error, CURLM_OK);
+
+	make_pipe(iot->wakeup_pipe);
+	make_pipe(iot->done_pipe);
+
+	/* signals must only ever be delivered to the backend's main thread, so the I/O thread blocks them all */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	rc = pthread_create(&iot->thread, NULL, io_thread_main, iot);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (rc != 0) {
+		close(iot->wakeup_pipe[0]);
+		close(iot->wakeup_pipe[1]);
+		close(iot->done_pipe[0]);
+		close(iot->done_pipe[1]);
+		pfree(iot);
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+						errmsg("unable to start I/O thread: rc=%d", rc)));
+	}
+
+	iot->running = true;
+	return iot;
+}
+
+/*
+ * Stop and join the I/O thread, after which the backend owns the multi handle again.
+ * If 'abort' is true, any in-flight transfers are cancelled
+ *
+ * Safe to call from a transaction abort callback
+ */
+void rest_io_thread_stop(RestIOThread *iot, bool abort) {
+	int i;
+
+	if (!iot->running)
+		return;
+
+	if (abort)
+		pg_atomic_write_u32(&iot->abort, 1);
+	pg_atomic_write_u32(&iot->stop, 1);
+	poke_pipe(iot->wakeup_pipe[1]);
+	pthread_join(iot->thread, NULL);
+	iot->running = false;
+
+	close(iot->wakeup_pipe[0]);
+	close(iot->wakeup_pipe[1]);
+	close(iot->done_pipe[0]);
+	close(iot->done_pipe[1]);
+
+	for (i = 0; i < MAX_CURL_HANDLES; i++) {
+		if (iot->responses[i].data != NULL)
+			free(iot->responses[i].data);
+		iot->responses[i].data = NULL;
+	}
+}
+
+/*
+ * Point an easy handle's callbacks at the I/O thread.  Must be called before the handle is submitted
+ */
+void rest_io_thread_prepare_handle(RestIOThread *iot, CURL *curl, int slot) {
+	iot->responses[slot].len = 0;
+
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *) (intptr_t) slot);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, io_thread_write_func);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &iot->responses[slot]);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, io_thread_progress_func);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, iot);
+}
+
+void rest_io_thread_submit(RestIOThread *iot, int slot) {
+	if (!queue_push(&iot->submitted, slot)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+						errmsg("I/O thread submission queue is full")));
+	}
+	poke_pipe(iot->wakeup_pipe[1]);
+}
+
+/*
+ * Get the next completed handle, if there is one, copying its response into the MultiRestState
+ */
+bool rest_io_thread_next_completed(RestIOThread *iot, int *slot, CURLcode *result) {
+	uint32 error;
+
+	if (queue_pop(&iot->completed, slot)) {
+		RestIOBuffer *buff = &iot->responses[*slot];
+
+		*result = iot->results[*slot];
+		if (buff->len > 0)
+			appendBinaryStringInfo(iot->state->responses[*slot], buff->data, (int) buff->len);
+		buff->len = 0;
+		return true;
+	}
+
+	if ((error = pg_atomic_read_u32(&iot->error)) != CURLM_OK) {
+		ereport(ERROR,
+				(errcode(ERRCODE_IO_ERROR),
+						errmsg("I/O thread failed:  %s (%u)", curl_multi_strerror((CURLMcode) error), error)));
+	}
+
+	return false;
+}
+
+/*
+ * Sleep until the I/O thread says something has completed, we're interrupted, or 'timeout'
+ * milliseconds have passed
+ */
+void rest_io_thread_wait(RestIOThread *iot, long timeout) {
+	int rc;
+
+	rc = WaitLatchOrSocket(MyLatch, WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT,
+						   iot->done_pipe[0], timeout, PG_WAIT_EXTENSION);
+	if (rc & WL_LATCH_SET)
+		ResetLatch(MyLatch);
+
+	drain_pipe(iot->done_pipe[0]);
+	CHECK_FOR_INTERRUPTS();
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ZDB_IO_THREAD_H__
+#define __ZDB_IO_THREAD_H__
+
+#include "curl_support.h"
+
+#include "port/atomics.h"
+
+#include <pthread.h>
+
+/*
+ * A growable response buffer that libcurl writes into from the I/O thread.  It's malloc()'d
+ * because the I/O thread can't touch Postgres' memory contexts
+ */
+typedef struct RestIOBuffer {
+	char   *data;
+	size_t len;
+	size_t maxlen;
+} RestIOBuffer;
+
+/*
+ * single-producer/single-consumer ring of MultiRestState handle slots
+ */
+typedef struct RestIOQueue {
+	pg_atomic_uint32 head;    /* next item to read, only advanced by the consumer */
+	pg_atomic_uint32 tail;    /* next item to write, only advanced by the producer */
+	int              items[MAX_CURL_HANDLES + 1];
+} RestIOQueue;
+
+/*
+ * A thread that owns a MultiRestState's CURLM handle and keeps its transfers moving
+ * while the backend is busy doing other things, such as serializing the next batch of rows.
+ *
+ * The backend hands it fully-configured easy handles through 'submitted' and gets them
+ * back, already removed from the multi handle, through 'completed'.  The thread never
+ * calls palloc() or elog()
+ */
+typedef struct RestIOThread {
+	MultiRestState   *state;
+	pthread_t        thread;
+	bool             running;
+
+	RestIOQueue      submitted;
+	RestIOQueue      completed;
+	CURLcode         results[MAX_CURL_HANDLES];
+	RestIOBuffer     responses[MAX_CURL_HANDLES];
+
+	int              wakeup_pipe[2];    /* backend -> thread:  new handles were submitted, or stop */
+	int              done_pipe[2];      /* thread -> backend:  handles have completed */
+
+	pg_atomic_uint32 stop;
+	pg_atomic_uint32 abort;             /* cancel any in-flight transfers */
+	pg_atomic_uint32 error;             /* a CURLMcode if the thread died */
+} RestIOThread;
+
+RestIOThread *rest_io_thread_start(MultiRestState *state);
+void rest_io_thread_stop(RestIOThread *iot, bool abort);
+void rest_io_thread_prepare_handle(RestIOThread *iot, CURL *curl, int slot);
+void rest_io_thread_submit(RestIOThread *iot, int slot);
+bool rest_io_thread_next_completed(RestIOThread *iot, int *slot, CURLcode *result);
+void rest_io_thread_wait(RestIOThread *iot, long timeout);
+
+#endif /* __ZDB_IO_THREAD_H__ */
@@ -0,0 +1,325 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "nodes.h"
+
+#include "nodes/pg_list.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include <ctype.h>
+
+/* how much a node's latency average moves towards each new request time */
+#define NODE_LATENCY_WEIGHT 0.2
+
+/* so that nodes we've not yet heard from still get their requests spread around */
+#define NODE_MIN_LATENCY    0.001    /* seconds */
+
+/* how long we leave a node alone after we couldn't connect to it */
+#define NODE_RETRY_INTERVAL 10000    /* ms */
+
+typedef struct RestNode {
+	char        *url;         /* the node's base url, ending in a slash */
+	int         urllen;
+	int         outstanding;  /* requests sent to it that haven't yet finished */
+	double      latency;      /* moving average of its request times, in seconds */
+	TimestampTz downUntil;    /* don't send it anything before this */
+} RestNode;
+
+typedef struct RestNodeGroup {
+	char     *spec;           /* the comma-separated list of urls, as written */
+	int      nnodes;
+	RestNode **nodes;
+} RestNodeGroup;
+
+/*
+ * Only nodes from lists of more than one url are tracked.  A single url is used as-is, so
+ * indices that talk to one node pay nothing for this.  Everything lives in TopMemoryContext
+ * and is only ever touched by the backend itself, never the I/O thread
+ */
+static List *allNodes  = NIL;
+static List *allGroups = NIL;
+
+extern int ZDB_LOG_LEVEL;
+
+static RestNode *find_or_create_node(char *url, int len) {
+	RestNode      *node;
+	ListCell      *lc;
+	MemoryContext oldContext;
+
+	foreach (lc, allNodes) {
+		node = lfirst(lc);
+		if (node->urllen == len && strncmp(node->url, url, len) == 0)
+			return node;
+	}
+
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+	node = palloc0(sizeof(RestNode));
+	node->url    = pnstrdup(url, len);
+	node->urllen = len;
+	allNodes = lappend(allNodes, node);
+	MemoryContextSwitchTo(oldContext);
+
+	return node;
+}
+
+static RestNodeGroup *find_or_create_group(char *spec) {
+	RestNodeGroup *group;
+	ListCell      *lc;
+	MemoryContext oldContext;
+	int           nurls = 1;
+	char          *p;
+
+	foreach (lc, allGroups) {
+		group = lfirst(lc);
+		if (strcmp(group->spec, spec) == 0)
+			return group;
+	}
+
+	for (p = spec; *p; p++) {
+		if (*p == ',')
+			nurls++;
+	}
+
+	oldContext = MemoryContextSwitchTo(TopMemoryContext);
+	group = palloc0(sizeof(RestNodeGroup));
+	group->spec  = pstrdup(spec);
+	group->nodes = palloc(sizeof(RestNode *) * nurls);
+
+	for (p = spec; ;) {
+		char *end = strchr(p, ',');
+		char *last;
+
+		if (end == NULL)
+			end = p + strlen(p);
+
+		/* ignore whitespace around each url */
+		while (p < end && isspace((unsigned char) *p))
+			p++;
+		last = end;
+		while (last > p && isspace((unsigned char) last[-1]))
+			last--;
+
+		if (last > p)
+			group->nodes[group->nnodes++] = find_or_create_node(p, (int) (last - p));
+
+		if (*end == '\0')
+			break;
+		p = end + 1;
+	}
+
+	allGroups = lappend(allGroups, group);
+	MemoryContextSwitchTo(oldContext);
+
+	return group;
+}
+
+/*
+ * the tracked node whose url is the longest prefix of 'url'
+ */
+static RestNode *find_node(char *url) {
+	RestNode *found = NULL;
+	ListCell *lc;
+
+	foreach (lc, allNodes) {
+		RestNode *node = lfirst(lc);
+
+		if (strncmp(node->url, url, node->urllen) == 0 && (found == NULL || node->urllen > found->urllen))
+			found = node;
+	}
+
+	return found;
+}
+
+/*
+ * the largest group the node belongs to, as that's the most choice we've been given
+ */
+static RestNodeGroup *find_group(RestNode *node) {
+	RestNodeGroup *found = NULL;
+	ListCell      *lc;
+
+	foreach (lc, allGroups) {
+		RestNodeGroup *group = lfirst(lc);
+		int           i;
+
+		for (i = 0; i < group->nnodes; i++) {
+			if (group->nodes[i] == node && (found == NULL || group->nnodes > found->nnodes)) {
+				found = group;
+				break;
+			}
+		}
+	}
+
+	return found;
+}
+
+/*
+ * what we expect a new request to the node to cost:  its typical latency, scaled by the
+ * number of requests it's already working on for us
+ */
+static double node_cost(RestNode *node) {
+	return (node->outstanding + 1) * (node->latency + NODE_MIN_LATENCY);
+}
+
+/*
+ * Pick the cheapest node in the group, other than 'exclude', that we believe is up.
+ *
+ * If we don't have one and aren't failing over (exclude is NULL), we settle for whichever
+ * down node is due to be retried first, otherwise we return NULL
+ */
+static RestNode *choose_node(RestNodeGroup *group, RestNode *exclude) {
+	TimestampTz now  = GetCurrentTimestamp();
+	RestNode    *best = NULL;
+	RestNode    *down = NULL;
+	int         i;
+
+	for (i = 0; i < group->nnodes; i++) {
+		RestNode *node = group->nodes[i];
+
+		if (node == exclude)
+			continue;
+
+		if (node->downUntil > now) {
+			if (down == NULL || node->downUntil < down->downUntil)
+				down = node;
+		} else if (best == NULL || node_cost(node) < node_cost(best)) {
+			best = node;
+		}
+	}
+
+	if (best == NULL && exclude == NULL)
+		best = down;
+	return best;
+}
+
+/*
+ * The base url to use for an index whose 'url' option is 'spec'
+ */
+char *rest_nodes_base_url(char *spec) {
+	if (strchr(spec, ',') == NULL)
+		return spec;
+
+	return choose_node(find_or_create_group(spec), NULL)->url;
+}
+
+/*
+ * Is 'spec' a comma-separated list of one or more urls that each end in a slash?
+ */
+bool rest_nodes_validate_spec(char *spec) {
+	char *p = spec;
+
+	while (true) {
+		char *end = strchr(p, ',');
+		char *last;
+
+		if (end == NULL)
+			end = p + strlen(p);
+
+		while (p < end && isspace((unsigned char) *p))
+			p++;
+		last = end;
+		while (last > p && isspace((unsigned char) last[-1]))
+			last--;
+
+		if (last == p || last[-1] != '/')
+			return false;
+
+		if (*end == '\0')
+			return true;
+		p = end + 1;
+	}
+}
+
+/*
+ * Move a request's url onto what's now the best node of its cluster.  Returns 'url'
+ * itself if it should be left alone
+ */
+char *rest_nodes_route(char *url) {
+	RestNode *node = find_node(url);
+	RestNode *best;
+
+	if (node == NULL)
+		return url;
+
+	best = choose_node(find_group(node), NULL);
+	if (best == node)
+		return url;
+
+	return psprintf("%s%s", best->url, url + node->urllen);
+}
+
+void rest_nodes_request_started(char *url) {
+	RestNode *node = find_node(url);
+
+	if (node != NULL)
+		node->outstanding++;
+}
+
+void rest_nodes_request_finished(char *url, double seconds) {
+	RestNode *node = find_node(url);
+
+	if (node == NULL)
+		return;
+
+	if (node->outstanding > 0)
+		node->outstanding--;
+
+	if (node->latency == 0)
+		node->latency = seconds;
+	else
+		node->latency += NODE_LATENCY_WEIGHT * (seconds - node->latency);
+}
+
+/*
+ * A request to 'url' failed with 'result'.  If that's because we couldn't reach its node,
+ * and so Elasticsearch never saw the request, return the url of the same request on another
+ * node of the cluster that we think is up.  Otherwise returns NULL and the failure stands
+ */
+char *rest_nodes_failover(char *url, CURLcode result) {
+	RestNode *node;
+	RestNode *next;
+
+	switch (result) {
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+			break;
+		default:
+			return NULL;
+	}
+
+	if ((node = find_node(url)) == NULL)
+		return NULL;
+
+	node->downUntil = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), NODE_RETRY_INTERVAL);
+	if ((next = choose_node(find_group(node), node)) == NULL)
+		return NULL;
+
+	elog(ZDB_LOG_LEVEL, "[zombodb] couldn't connect to %s, trying %s instead", node->url, next->url);
+	return psprintf("%s%s", next->url, url + node->urllen);
+}
+
+/*
+ * Called when the transaction aborts, by which point nothing we'd sent is still in flight
+ */
+void rest_nodes_forget_outstanding(void) {
+	ListCell *lc;
+
+	foreach (lc, allNodes) {
+		RestNode *node = lfirst(lc);
+
+		node->outstanding = 0;
+	}
+}
@@ -0,0 +1,38 @@
+/**
+ * Copyright 2018-2019 ZomboDB, LLC
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ZDB_REST_NODES_H__
+#define __ZDB_REST_NODES_H__
+
+#include "postgres.h"
+
+#include <curl/curl.h>
+
+/*
+ * The 'url' index option, and zdb.default_elasticsearch_url, can name more than one node of the
+ * same Elasticsearch cluster as a comma-separated list.  These track how each node is doing
+ * (in this backend) so the REST layer can spread requests across them and step around any
+ * node it can't connect to
+ */
+char *rest_nodes_base_url(char *spec);
+bool rest_nodes_validate_spec(char *spec);
+char *rest_nodes_route(char *url);
+void rest_nodes_request_started(char *url);
+void rest_nodes_request_finished(char *url, double seconds);
+char *rest_nodes_failover(char *url, CURLcode result);
+void rest_nodes_forget_outstanding(void);
+
+#endif /* __ZDB_REST_NODES_H__ */
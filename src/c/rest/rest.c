@@ -16,18 +16,51 @@
  */
 
 #include "rest.h"
+#include "io_thread.h"
+#include "nodes.h"
 #include "zombodb.h"
 #include "json/json_support.h"
 
 #include "access/xact.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
 
 #include <zlib.h>
 
+/* how much uncompressed data we let build up in a PostDataEntry before deflating it */
+#define POSTDATA_DEFLATE_THRESHOLD (64 * 1024)
+
+/* how we back off when Elasticsearch rejects a request because it's too busy (HTTP 429) */
+#define REJECTED_MAX_RETRIES     10
+#define REJECTED_RETRY_DELAY     100L    /* ms, doubled after each attempt */
+#define REJECTED_MAX_RETRY_DELAY 10000L
+
+/* the error Elasticsearch gives each _bulk item it rejected because it was too busy */
+#define REJECTED_ERROR_TYPE "es_rejected_execution_exception"
+
+/* how much of a streamed response we keep for error messages */
+#define REST_RESPONSE_PREFIX_SIZE 8192
+
+typedef struct StreamingResponse {
+	StringInfo           prefix;
+	RestResponseConsumer consumer;
+	void                 *consumerArg;
+} StreamingResponse;
+
 static size_t curl_write_func(char *ptr, size_t size, size_t nmemb, void *userdata);
+static size_t curl_streaming_write_func(char *ptr, size_t size, size_t nmemb, void *userdata);
 static int curl_progress_func(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
 static bool contains_version_conflict_error(const MultiRestState *state, int i);
+static char *effective_url(CURL *handle);
+static void start_due_retries(MultiRestState *state);
+static int retries_waiting(const MultiRestState *state);
+static long retry_wait_timeout(const MultiRestState *state, long timeout);
 
 extern bool zdb_curl_verbose_guc;
+extern bool zdb_bulk_io_thread_guc;
+extern int  ZDB_LOG_LEVEL;
 
 static size_t curl_write_func(char *ptr, size_t size, size_t nmemb, void *userdata) {
 	MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
@@ -37,6 +70,20 @@ static size_t curl_write_func(char *ptr, size_t size, size_t nmemb, void *userda
 	return size * nmemb;
 }
 
+static size_t curl_streaming_write_func(char *ptr, size_t size, size_t nmemb, void *userdata) {
+	StreamingResponse *stream = (StreamingResponse *) userdata;
+	size_t            len     = size * nmemb;
+
+	if (stream->prefix->len < REST_RESPONSE_PREFIX_SIZE) {
+		MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+		appendBinaryStringInfo(stream->prefix, ptr, (int) Min(len, (size_t) (REST_RESPONSE_PREFIX_SIZE - stream->prefix->len)));
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	stream->consumer(stream->consumerArg, ptr, len);
+	return len;
+}
+
 /*
  * used to check for Postgres-level interrupts while a curl call is running
  */
@@ -80,6 +127,129 @@ static char *do_compression(StringInfo input, int level, uint64 *len) {
 	return (char *) compressed;
 }
 
+/*
+ * zlib allocation functions, so that a PostDataEntry's deflate state lives in its MemoryContext
+ */
+static voidpf postdata_zalloc(voidpf opaque, uInt items, uInt size) {
+	return MemoryContextAlloc((MemoryContext) opaque, (Size) items * size);
+}
+
+/*lint -esym 715,opaque ignore unused param */
+static void postdata_zfree(voidpf opaque, voidpf address) {
+	pfree(address);
+}
+
+/*
+ * feed everything in entry->buff to the deflate stream, growing entry->compressed as necessary
+ */
+static void postdata_deflate(PostDataEntry *entry, int flush) {
+	z_stream *zs = entry->zstream;
+	int      rc;
+
+	zs->next_in  = (Bytef *) entry->buff->data;
+	zs->avail_in = (uInt) entry->buff->len;
+
+	do {
+		enlargeStringInfo(entry->compressed, POSTDATA_DEFLATE_THRESHOLD);
+		zs->next_out  = (Bytef *) (entry->compressed->data + entry->compressed->len);
+		zs->avail_out = (uInt) (entry->compressed->maxlen - entry->compressed->len - 1);
+
+		if ((rc = deflate(zs, flush)) == Z_STREAM_ERROR) {
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+							errmsg("compression error, code=%d", rc)));
+		}
+
+		entry->compressed->len = (int) ((char *) zs->next_out - entry->compressed->data);
+	} while (zs->avail_out == 0 || (flush == Z_FINISH && rc != Z_STREAM_END));
+
+	entry->nflushed += entry->buff->len;
+	resetStringInfo(entry->buff);
+}
+
+PostDataEntry *rest_postdata_create(int pool_idx, int compressionLevel) {
+	PostDataEntry *entry = palloc0(sizeof(PostDataEntry));
+
+	entry->pool_idx   = pool_idx;
+	entry->buff       = makeStringInfo();
+	entry->separator  = '\n';
+	entry->replayable = true;
+
+	if (compressionLevel > 0) {
+		int rc;
+
+		entry->compressed     = makeStringInfo();
+		entry->zstream        = palloc0(sizeof(z_stream));
+		entry->zstream->zalloc = postdata_zalloc;
+		entry->zstream->zfree  = postdata_zfree;
+		entry->zstream->opaque = (voidpf) CurrentMemoryContext;
+
+		if ((rc = deflateInit(entry->zstream, compressionLevel)) != Z_OK) {
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+							errmsg("compression error, code=%d", rc)));
+		}
+	}
+
+	return entry;
+}
+
+/*
+ * Called after data has been appended to entry->buff.  Once enough has accumulated
+ * we deflate it, which keeps compression time spread out over the time it takes to
+ * build the request, rather than all at once when it's sent
+ */
+void rest_postdata_compress(PostDataEntry *entry) {
+	if (entry->zstream != NULL && entry->buff->len >= POSTDATA_DEFLATE_THRESHOLD)
+		postdata_deflate(entry, Z_NO_FLUSH);
+}
+
+/*
+ * make the entry ready to be used for a new request
+ */
+void rest_postdata_reset(PostDataEntry *entry) {
+	resetStringInfo(entry->buff);
+	entry->nflushed   = 0;
+	entry->replayable = true;
+
+	if (entry->zstream != NULL) {
+		resetStringInfo(entry->compressed);
+		deflateReset(entry->zstream);
+	}
+}
+
+/*
+ * point the handle at the PostDataEntry's body, finishing its deflate stream if it has one
+ */
+static void set_post_fields(CURL *curl, PostDataEntry *postData) {
+	if (postData != NULL && postData->zstream != NULL) {
+		/* deflate whatever is left and finish off the stream */
+		postdata_deflate(postData, Z_FINISH);
+
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, postData->compressed->len);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postData->compressed->data);
+	} else if (postData != NULL) {
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, postData->buff->len);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postData->buff->data);
+	} else {
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, NULL);
+	}
+}
+
+/*
+ * hand a fully-configured handle off to whatever is driving the multi handle
+ */
+static void start_handle(MultiRestState *state, int i) {
+	if (state->iothread != NULL) {
+		rest_io_thread_prepare_handle(state->iothread, state->handles[i], i);
+		rest_io_thread_submit(state->iothread, i);
+	} else {
+		curl_multi_add_handle(state->multi_handle, state->handles[i]);
+		rest_multi_perform(state);
+	}
+}
+
 MultiRestState *rest_multi_init(int nhandles, bool ignore_version_conflicts) {
 	MultiRestState *state = MemoryContextAlloc(TopMemoryContext,  /* because that's where curl is allocated too */
 											   sizeof(MultiRestState));
@@ -94,6 +264,11 @@ MultiRestState *rest_multi_init(int nhandles, bool ignore_version_conflicts) {
 	state->nhandles     = nhandles;
 	state->multi_handle = curl_multi_init();
 	state->available    = nhandles;
+	state->limit        = nhandles;
+	state->iothread     = NULL;
+	state->ncompleted    = 0;
+	state->nrejected     = 0;
+	state->total_seconds = 0;
 	for (i = 0; i < nhandles; i++) {
 		state->handles[i]    = NULL;
 		state->headers[i]    = NULL;
@@ -101,10 +276,15 @@ MultiRestState *rest_multi_init(int nhandles, bool ignore_version_conflicts) {
 		state->postDatas[i]  = NULL;
 		state->responses[i]  = NULL;
 		state->vconflicts[i] = ignore_version_conflicts;
+		state->nretries[i]   = 0;
+		state->retryAt[i]    = 0;
 	}
 
 	curl_record_multi_handle(state);
 
+	if (zdb_bulk_io_thread_guc)
+		state->iothread = rest_io_thread_start(state);
+
 	return state;
 }
 
@@ -112,6 +292,13 @@ int rest_multi_perform(MultiRestState *state) {
 	int still_running;
 	CURLMcode mc;
 
+	start_due_retries(state);
+
+	if (state->iothread != NULL) {
+		/* the I/O thread is driving the transfers, so all we can say is how many we've not yet reaped */
+		return state->nhandles - state->available;
+	}
+
 	while ((mc = curl_multi_perform(state->multi_handle, &still_running)) == CURLM_CALL_MULTI_PERFORM)
 		CHECK_FOR_INTERRUPTS();
 
@@ -124,20 +311,28 @@ int rest_multi_perform(MultiRestState *state) {
 void rest_multi_call(MultiRestState *state, char *method, StringInfo url, PostDataEntry *postData, int compressionLevel) {
 	int i;
 
-	if (state->available == 0) {
-		int still_running;
-
-		do {
-			CHECK_FOR_INTERRUPTS();
-
-			still_running = rest_multi_perform(state);
-		} while (still_running == state->nhandles);
+	/* wait for enough requests to finish that we're allowed to start another */
+	while (state->nhandles - state->available >= state->limit) {
+		if (state->iothread != NULL) {
+			rest_multi_partial_cleanup(state, false, true);
+			if (state->nhandles - state->available < state->limit)
+				break;
+
+			rest_io_thread_wait(state->iothread, retry_wait_timeout(state, 1000L));
+		} else {
+			/* requests waiting to be retried still count against our limit */
+			while (rest_multi_perform(state) + retries_waiting(state) >= state->limit) {
+				CURLMcode mc;
+				int       numfds;
+
+				CHECK_FOR_INTERRUPTS();
+
+				if ((mc = curl_multi_wait(state->multi_handle, NULL, 0, (int) retry_wait_timeout(state, 1000L),
+										  &numfds)) != CURLM_OK)
+					elog(ERROR, "curl_multi_wait failed.  code=%d", mc);
+			}
 
-		rest_multi_partial_cleanup(state, false, true);
-		if (state->available == 0) {
-			ereport(ERROR,
-					(errcode(ERRCODE_IO_ERROR),
-							errmsg("unable to cleanup an available rest_multi slot")));
+			rest_multi_partial_cleanup(state, false, false);
 		}
 	}
 
@@ -145,18 +340,26 @@ void rest_multi_call(MultiRestState *state, char *method, StringInfo url, PostDa
 		if (state->handles[i] == NULL) {
 			CURL       *curl;
 			char       *errorbuff;
+			char       *target;
 			StringInfo response;
 
-			curl = state->handles[i] = curl_easy_init();
-			if (!state->handles[i]) {
-				ereport(ERROR,
-						(errcode(ERRCODE_IO_ERROR),
-								errmsg("unable to initialize curl handle")));
-			}
+			curl = state->handles[i] = curl_checkout_easy_handle(state->iothread != NULL);
+			target = rest_nodes_route(url->data);
 
-			state->headers[i] = curl_slist_append(state->headers[i], "Content-Type: application/json");
+			if (postData != NULL && postData->contentType != NULL) {
+				char *header = psprintf("Content-Type: %s", postData->contentType);
+
+				/* we still want responses we can read */
+				state->headers[i] = curl_slist_append(state->headers[i], header);
+				state->headers[i] = curl_slist_append(state->headers[i], "Accept: application/json");
+				pfree(header);
+			} else {
+				state->headers[i] = curl_slist_append(state->headers[i], "Content-Type: application/json");
+			}
 			errorbuff = state->errorbuffs[i] = palloc0(CURL_ERROR_SIZE);
 			state->postDatas[i] = postData;
+			state->nretries[i]  = 0;
+			state->retryAt[i]   = 0;
 			response = state->responses[i] = makeStringInfo();
 
 			curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0);      /* we want progress ... */
@@ -172,40 +375,28 @@ void rest_multi_call(MultiRestState *state, char *method, StringInfo url, PostDa
 			curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
 			curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorbuff);
 
-			curl_easy_setopt(curl, CURLOPT_URL, url->data);
+			curl_easy_setopt(curl, CURLOPT_URL, target);
 			curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
 			curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
 			curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, compressionLevel > 0 ? "" : NULL);
 			curl_easy_setopt(curl, CURLOPT_VERBOSE, zdb_curl_verbose_guc);
 
-			if (postData != NULL && compressionLevel > 0) {
-				char   *data;
-				uint64 len;
-
-				postData->compressed_data = data = do_compression(postData->buff, compressionLevel, &len);
-
+			if (postData != NULL && postData->zstream != NULL)
 				state->headers[i] = curl_slist_append(state->headers[i], "Content-Encoding: deflate");
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
-			} else if (postData != NULL) {
-				postData->compressed_data = NULL;
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, postData->buff->len);
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postData->buff->data);
-			} else {
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0);
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, NULL);
-			}
+			set_post_fields(curl, postData);
 
 			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, state->headers[i]);
 			curl_easy_setopt(curl, CURLOPT_POST,
 							 strcmp(method, "GET") != 0 && postData && postData->buff->data ? 1 : 0);
-			curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_0);
 			curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
 
-			curl_multi_add_handle(state->multi_handle, curl);
 			state->available--;
 
-			rest_multi_perform(state);
+			rest_nodes_request_started(target);
+			start_handle(state, i);
+
+			if (target != url->data)
+				pfree(target);
 			return;
 		}
 	}
@@ -215,18 +406,42 @@ void rest_multi_wait_for_all_done(MultiRestState *state) {
     int still_running;
     int repeats = 0;
 
+    if (state->iothread != NULL) {
+        while (true) {
+            rest_multi_partial_cleanup(state, false, false);
+            if (state->available == state->nhandles)
+                return;
+
+            rest_io_thread_wait(state->iothread, retry_wait_timeout(state, 1000L));
+        }
+    }
+
     do {
         CURLMcode mc;
         int numfds = 0;
 
+        start_due_retries(state);
         while ((mc = curl_multi_perform(state->multi_handle, &still_running)) == CURLM_CALL_MULTI_PERFORM)
             CHECK_FOR_INTERRUPTS();
         if (mc != CURLM_OK) {
             elog(ERROR, "curl_multi_perform failed.  code=%d", mc);
         }
 
+        if (still_running == 0 && retries_waiting(state) > 0) {
+            /* nothing's in flight, but a rejected request is due to be sent again */
+            int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+                               retry_wait_timeout(state, 1000L), PG_WAIT_EXTENSION);
+
+            ResetLatch(MyLatch);
+            if (rc & WL_POSTMASTER_DEATH)
+                proc_exit(1);
+            CHECK_FOR_INTERRUPTS();
+            still_running = 1;
+            continue;
+        }
+
         /* wait for activity, timeout or "nothing" */
-        mc = curl_multi_wait(state->multi_handle, NULL, 0, 10000, &numfds);
+        mc = curl_multi_wait(state->multi_handle, NULL, 0, (int) retry_wait_timeout(state, 10000L), &numfds);
         if (mc != CURLM_OK) {
             elog(ERROR, "curl_multi_wait failed.  code=%d", mc);
         }
@@ -239,7 +454,7 @@ void rest_multi_wait_for_all_done(MultiRestState *state) {
         if (!numfds) {
             repeats++;
             if (repeats > 1) {
-                if (still_running == 0) {
+                if (still_running == 0 && retries_waiting(state) == 0) {
                     return;
                 }
                 pg_usleep(100);
@@ -248,72 +463,385 @@ void rest_multi_wait_for_all_done(MultiRestState *state) {
             repeats = 0;
         }
 
-    } while (still_running);
+    } while (still_running || retries_waiting(state) > 0);
 }
 
-void rest_multi_partial_cleanup(MultiRestState *state, bool finalize, bool fast) {
+/*
+ * the url the handle's last request went to
+ */
+static char *effective_url(CURL *handle) {
+	char *url = NULL;
+
+	curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url);
+	return url != NULL ? url : "";
+}
+
+/*
+ * Recover the uncompressed body of a PostDataEntry that's already been sent
+ */
+static StringInfo postdata_contents(PostDataEntry *entry) {
+	StringInfo raw = makeStringInfo();
+	z_stream   zs;
+	int        rc;
+
+	if (entry->zstream == NULL) {
+		appendBinaryStringInfo(raw, entry->buff->data, entry->buff->len);
+		return raw;
+	}
+
+	memset(&zs, 0, sizeof(z_stream));
+	zs.zalloc = postdata_zalloc;
+	zs.zfree  = postdata_zfree;
+	zs.opaque = (voidpf) CurrentMemoryContext;
+	if ((rc = inflateInit(&zs)) != Z_OK) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+						errmsg("decompression error, code=%d", rc)));
+	}
+
+	zs.next_in  = (Bytef *) entry->compressed->data;
+	zs.avail_in = (uInt) entry->compressed->len;
+	do {
+		enlargeStringInfo(raw, POSTDATA_DEFLATE_THRESHOLD);
+		zs.next_out  = (Bytef *) (raw->data + raw->len);
+		zs.avail_out = (uInt) (raw->maxlen - raw->len - 1);
+
+		rc = inflate(&zs, Z_NO_FLUSH);
+		if (rc != Z_OK && rc != Z_STREAM_END) {
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+							errmsg("decompression error, code=%d", rc)));
+		}
+
+		raw->len = (int) ((char *) zs.next_out - raw->data);
+	} while (rc != Z_STREAM_END);
+
+	raw->data[raw->len] = '\0';
+	inflateEnd(&zs);
+	return raw;
+}
+
+/*
+ * Is the only problem with a _bulk response that Elasticsearch rejected some of its items
+ * because it was too busy (along with version conflicts we've been told to ignore)?
+ *
+ * If the response has each item's status, '*rejected' is set to which items those were.  Most
+ * responses don't, as asking for them makes every response bigger, and then '*rejected' is NULL
+ */
+static bool find_rejected_items(const MultiRestState *state, int i, bool **rejected, int *nitems) {
+	void *json = parse_json_object(state->responses[i], CurrentMemoryContext);
+	void *items;
+	bool any        = false;
+	bool positional = true;
+	int  idx;
+
+	*rejected = NULL;
+	*nitems   = 0;
+	if (json == NULL || (items = get_json_object_array(json, "items", true)) == NULL)
+		return false;
+
+	*nitems   = get_json_array_length(items);
+	*rejected = palloc0(sizeof(bool) * (*nitems + 1));
+
+	for (idx = 0; idx < *nitems; idx++) {
+		void                  *elem = get_json_array_element_object(items, idx, CurrentMemoryContext);
+		JsonObjectKeyIterator itr;
+		void                  *action;
+		void                  *error;
+		const char            *type;
+		uint64                status;
+
+		if (elem == NULL || (itr = get_json_object_key_iterator(elem)) == NULL) {
+			any = false;
+			break;
+		}
+
+		/* each item is keyed by its action name -- index, update, etc */
+		action = get_value_from_json_object_iterator(itr);
+		error  = get_json_object_object(action, "error", true);
+		type   = error != NULL ? get_json_object_string(error, "type", true) : NULL;
+		status = get_json_object_uint64(action, "status", true);
+
+		/* without statuses, only the items that failed are in the response */
+		if (status == 0)
+			positional = false;
+
+		if (status == 429 || (type != NULL && strcmp(REJECTED_ERROR_TYPE, type) == 0)) {
+			(*rejected)[idx] = any = true;
+		} else if (error != NULL) {
+			if (!state->vconflicts[i] || type == NULL || strcmp("version_conflict_engine_exception", type) != 0) {
+				/* a real error */
+				any = false;
+				break;
+			}
+		}
+	}
+
+	pfree(json);
+	if (!any || !positional) {
+		pfree(*rejected);
+		*rejected = NULL;
+	}
+	return any;
+}
+
+/*
+ * When a rejected request is due to be sent again, it's this many milliseconds from now
+ */
+static long retry_delay(const MultiRestState *state, int i) {
+	return Min(REJECTED_RETRY_DELAY << (state->nretries[i] - 1), REJECTED_MAX_RETRY_DELAY);
+}
+
+/*
+ * Elasticsearch rejected the request in slot 'i', or some of its items, because it's too busy.
+ * It's sent again once it's backed off for a bit, by whoever is waiting on the multi handle at
+ * the time, so the requests still in flight aren't held up.  If 'rejected' is NULL the entire
+ * request is resent, otherwise only the rejected items are
+ */
+static void retry_rejected_request(MultiRestState *state, int i, const bool *rejected, int nitems) {
+	PostDataEntry *entry = state->postDatas[i];
+	long          delay;
+	int           nresend = 0;
+
+	state->nrejected++;
+	if (++state->nretries[i] > REJECTED_MAX_RETRIES) {
+		ereport(ERROR,
+				(errcode(ERRCODE_IO_ERROR),
+						errmsg("Elasticsearch rejected the request %d times: %s", REJECTED_MAX_RETRIES,
+							   state->responses[i]->data)));
+	}
+
+	if (entry != NULL && rejected != NULL) {
+		/* rebuild the request from just the items that were rejected */
+		StringInfo raw        = postdata_contents(entry);
+		char       *line      = raw->data;
+		char       *last      = raw->data + raw->len;
+		bool       replayable = entry->replayable;
+		int        item;
+
+		rest_postdata_reset(entry);
+		entry->replayable = replayable;
+
+		/* every bulk action is exactly two documents:  the action and its source */
+		for (item = 0; item < nitems && line < last; item++) {
+			char *end = memchr(line, entry->separator, last - line);
+
+			if (end != NULL)
+				end = memchr(end + 1, entry->separator, last - (end + 1));
+			if (end == NULL)
+				end = last - 1;
+
+			if (rejected[item]) {
+				appendBinaryStringInfo(entry->buff, line, (int) (end - line + 1));
+				nresend++;
+			}
+			line = end + 1;
+		}
+
+		pfree(raw->data);
+		pfree(raw);
+
+		set_post_fields(state->handles[i], entry);
+	}
+
+	resetStringInfo(state->responses[i]);
+	state->errorbuffs[i][0] = '\0';
+
+	delay = retry_delay(state, i);
+	if (rejected != NULL)
+		elog(ZDB_LOG_LEVEL, "[zombodb] Elasticsearch rejected %d items, retrying in %ldms", nresend, delay);
+	else
+		elog(ZDB_LOG_LEVEL, "[zombodb] Elasticsearch rejected a request, retrying in %ldms", delay);
+
+	state->retryAt[i] = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), delay);
+}
+
+/*
+ * Send the rejected requests whose backoff is over
+ */
+static void start_due_retries(MultiRestState *state) {
+	TimestampTz now = 0;
+	int         i;
+
+	for (i = 0; i < state->nhandles; i++) {
+		if (state->retryAt[i] == 0)
+			continue;
+
+		if (now == 0)
+			now = GetCurrentTimestamp();
+		if (state->retryAt[i] <= now) {
+			state->retryAt[i] = 0;
+			rest_nodes_request_started(effective_url(state->handles[i]));
+			start_handle(state, i);
+		}
+	}
+}
+
+/*
+ * How many rejected requests are waiting out their backoff
+ */
+static int retries_waiting(const MultiRestState *state) {
+	int many = 0;
+	int i;
+
+	for (i = 0; i < state->nhandles; i++) {
+		if (state->retryAt[i] != 0)
+			many++;
+	}
+	return many;
+}
+
+/*
+ * 'timeout', or less if that's when the next rejected request is due to be sent again
+ */
+static long retry_wait_timeout(const MultiRestState *state, long timeout) {
+	TimestampTz now = GetCurrentTimestamp();
+	int         i;
+
+	for (i = 0; i < state->nhandles; i++) {
+		if (state->retryAt[i] != 0) {
+			long secs;
+			int  usecs;
+
+			TimestampDifference(now, state->retryAt[i], &secs, &usecs);
+			timeout = Min(timeout, secs * 1000L + usecs / 1000 + 1);
+		}
+	}
+	return timeout;
+}
+
+/*
+ * We couldn't reach the node the request in slot 'i' was sent to, so send it to another
+ */
+static void failover_request(MultiRestState *state, int i, char *url) {
+	curl_easy_setopt(state->handles[i], CURLOPT_URL, url);
+	resetStringInfo(state->responses[i]);
+	state->errorbuffs[i][0] = '\0';
+
+	rest_nodes_request_started(url);
+	start_handle(state, i);
+}
+
+/*
+ * Check the response for the handle in slot 'i' and release everything associated with it.
+ * The handle must already be removed from the multi handle
+ *
+ * Returns false if the request was rejected and has been started again instead
+ */
+static bool multi_handle_done(MultiRestState *state, int i, CURLcode result) {
+	CURL     *handle = state->handles[i];
+	CURLcode rc;
+	int64    response_code;
+	double   seconds = 0;
+	char     *failover;
+
+	if ((rc = curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code)) != CURLE_OK) {
+		ereport(ERROR,
+				(errcode(ERRCODE_IO_ERROR),
+						errmsg("problem getting response code: rc=%d", rc)));
+	}
+
+	curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &seconds);
+	state->ncompleted++;
+	state->total_seconds += seconds;
+	rest_nodes_request_finished(effective_url(handle), seconds);
+
+	if (result != CURLE_OK && (failover = rest_nodes_failover(effective_url(handle), result)) != NULL) {
+		failover_request(state, i, failover);
+		pfree(failover);
+		return false;
+	} else if (result == CURLE_OK && response_code == 429) {
+		/* the whole request was rejected */
+		retry_rejected_request(state, i, NULL, 0);
+		return false;
+	} else if (result != CURLE_OK || response_code != 200 ||
+			   strstr(state->responses[i]->data, "\"errors\":true")) {
+		bool *rejected = NULL;
+		int  nitems    = 0;
+		bool ignoreError;
+
+		/*
+		 * Without each item's status we can't tell which were rejected, and the whole request
+		 * is sent again, but only if that doesn't change what its accepted items did
+		 */
+		if (result == CURLE_OK && response_code == 200 && find_rejected_items(state, i, &rejected, &nitems) &&
+			(rejected != NULL || state->postDatas[i] == NULL || state->postDatas[i]->replayable)) {
+			retry_rejected_request(state, i, rejected, nitems);
+			if (rejected != NULL)
+				pfree(rejected);
+			return false;
+		}
+
+		ignoreError = state->vconflicts[i] && contains_version_conflict_error(state, i);
+		if (!ignoreError) {
+			/* REST endpoint messed up */
+			ereport(ERROR,
+					(errcode(ERRCODE_IO_ERROR),
+							errmsg("i=%d, libcurl error:  handle=%p, %s: %s, response_code=%ld, result=%d",
+								   i, handle, state->errorbuffs[i], state->responses[i]->data,
+								   response_code, result)));
+		}
+	}
+
+	if (state->errorbuffs[i] != NULL) {
+		pfree(state->errorbuffs[i]);
+		state->errorbuffs[i] = NULL;
+	}
+	if (state->postDatas[i] != NULL) {
+		PostDataEntry *entry = state->postDatas[i];
+
+		rest_postdata_reset(entry);
+		state->pool[entry->pool_idx] = entry;
+		state->postDatas[i]          = NULL;
+	}
+	if (state->responses[i] != NULL) {
+		pfree(state->responses[i]->data);
+		pfree(state->responses[i]);
+		state->responses[i] = NULL;
+	}
+	if (state->headers[i] != NULL) {
+		curl_slist_free_all(state->headers[i]);
+		state->headers[i] = NULL;
+	}
+	state->handles[i] = NULL;
+	state->available++;
+
+	/* keep the handle, and its connection to Elasticsearch, around for the next request */
+	curl_return_easy_handle(handle);
+	return true;
+}
+
+/*
+ * Process finished handles.  Returns true if 'fast' and one was released
+ */
+static bool reap_finished_handles(MultiRestState *state, bool fast) {
 	CURLMsg *msg;
 	int     msgs_left;
 
+	if (state->iothread != NULL) {
+		int      i;
+		CURLcode result;
+
+		while (rest_io_thread_next_completed(state->iothread, &i, &result)) {
+			if (multi_handle_done(state, i, result) && fast)
+				return true;
+		}
+		return false;
+	}
+
 	while ((msg = curl_multi_info_read(state->multi_handle, &msgs_left))) {
 		if (msg->msg == CURLMSG_DONE) {
 			/* this handle is finished, so lets clean it */
-			CURL *handle = msg->easy_handle;
-			bool found   = false;
-			int  i;
+			CURL     *handle = msg->easy_handle;
+			CURLcode result  = msg->data.result;
+			bool     found   = false;
+			bool     released = false;
+			int      i;
 
 			for (i = 0; i < state->nhandles; i++) {
 				if (state->handles[i] == handle) {
-					CURLcode rc;
-					int64    response_code;
-
-					if ((rc           = curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code)) !=
-						CURLE_OK) {
-						ereport(ERROR,
-								(errcode(ERRCODE_IO_ERROR),
-										errmsg("problem getting response code: rc=%d", rc)));
-					}
-
-					if (msg->data.result != CURLE_OK || response_code != 200 ||
-						strstr(state->responses[i]->data, "\"errors\":true")) {
-						bool ignoreError = state->vconflicts[i] && contains_version_conflict_error(state, i);
-
-						if (!ignoreError) {
-							/* REST endpoint messed up */
-							ereport(ERROR,
-									(errcode(ERRCODE_IO_ERROR),
-											errmsg("i=%d, libcurl error:  handle=%p, %s: %s, response_code=%ld, result=%d",
-												   i, handle, state->errorbuffs[i], state->responses[i]->data,
-												   response_code, msg->data.result)));
-						}
-					}
-
-					if (state->errorbuffs[i] != NULL) {
-						pfree(state->errorbuffs[i]);
-						state->errorbuffs[i] = NULL;
-					}
-					if (state->postDatas[i] != NULL) {
-						PostDataEntry *entry = state->postDatas[i];
-
-						resetStringInfo(entry->buff);
-						if (state->postDatas[i]->compressed_data != NULL) {
-							pfree(state->postDatas[i]->compressed_data);
-							state->postDatas[i]->compressed_data = NULL;
-						}
-						state->pool[entry->pool_idx] = entry->buff;
-						state->postDatas[i]          = NULL;
-					}
-					if (state->responses[i] != NULL) {
-						pfree(state->responses[i]->data);
-						pfree(state->responses[i]);
-						state->responses[i] = NULL;
-					}
-					if (state->headers[i] != NULL) {
-						curl_slist_free_all(state->headers[i]);
-						state->headers[i] = NULL;
-					}
-					state->handles[i] = NULL;
-					state->available++;
+					curl_multi_remove_handle(state->multi_handle, handle);
+					released = multi_handle_done(state, i, result);
 
 					found = true;
 					break;
@@ -321,10 +849,8 @@ void rest_multi_partial_cleanup(MultiRestState *state, bool finalize, bool fast)
 			}
 
 			if (found) {
-				curl_multi_remove_handle(state->multi_handle, handle);
-				curl_easy_cleanup(handle);
-				if (fast)
-					return;
+				if (fast && released)
+					return true;
 			} else {
 				ereport(ERROR,
 						(errcode(ERRCODE_IO_ERROR),
@@ -333,7 +859,28 @@ void rest_multi_partial_cleanup(MultiRestState *state, bool finalize, bool fast)
 		}
 	}
 
+	return false;
+}
+
+void rest_multi_partial_cleanup(MultiRestState *state, bool finalize, bool fast) {
+	start_due_retries(state);
+
+	if (reap_finished_handles(state, fast))
+		return;
+
 	if (finalize) {
+		/* requests we retried above are still in flight, and we need to see them through */
+		while (state->available < state->nhandles) {
+			rest_multi_wait_for_all_done(state);
+			reap_finished_handles(state, false);
+		}
+
+		if (state->iothread != NULL) {
+			rest_io_thread_stop(state->iothread, false);
+			pfree(state->iothread);
+			state->iothread = NULL;
+		}
+
 		curl_multi_cleanup(state->multi_handle);
 		curl_forget_multi_handle(state);
 	}
@@ -375,13 +922,12 @@ static bool contains_version_conflict_error(const MultiRestState *state, int i)
 	return ignoreError;
 }
 
-StringInfo rest_call(char *method, StringInfo url, StringInfo postData, int compressionLevel) {
-	char              *compressed_data = NULL;
-	StringInfo        response         = makeStringInfo();
-	CURLcode          ret;
-	int64             response_code;
-	CURL              *curl            = GLOBAL_CURL_INSTANCE;
-	struct curl_slist *headers         = NULL;
+/*
+ * Set all the options for a single request on 'curl', other than its url.  Returns the headers,
+ * which the caller frees once the request is finished, along with '*compressed'
+ */
+static struct curl_slist *setup_request(CURL *curl, char *method, StringInfo postData, int compressionLevel, char *errorbuff, StreamingResponse *stream, StringInfo response, char **compressed) {
+	struct curl_slist *headers = NULL;
 
 	headers = curl_slist_append(headers, "Content-Type: application/json");
 
@@ -391,29 +937,29 @@ StringInfo rest_call(char *method, StringInfo url, StringInfo postData, int comp
 					 (curl_progress_callback) curl_progress_func);   /* to go here so we can detect a ^C within postgres */
 	curl_easy_setopt(curl, CURLOPT_USERAGENT, "zdb");
 	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 0);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_func);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream != NULL ? curl_streaming_write_func : curl_write_func);
 	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0);
 	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60 * 60L);  /* timeout of 60 minutes */
 	curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
 	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
 	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, GLOBAL_CURL_ERRBUF);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorbuff);
 
-	curl_easy_setopt(curl, CURLOPT_URL, url->data);
 	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, stream != NULL ? (void *) stream : (void *) response);
 	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, compressionLevel > 0 ? "" : NULL);
 	curl_easy_setopt(curl, CURLOPT_VERBOSE, zdb_curl_verbose_guc);
 
+	*compressed = NULL;
 	if (postData != NULL && compressionLevel > 0) {
 		uint64 len;
 
-		compressed_data = do_compression(postData, compressionLevel, &len);
+		*compressed = do_compression(postData, compressionLevel, &len);
 
 		headers = curl_slist_append(headers, "Content-Encoding: deflate");
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, compressed_data);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, *compressed);
 	} else {
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, postData ? postData->len : 0);
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postData ? postData->data : NULL);
@@ -425,20 +971,21 @@ StringInfo rest_call(char *method, StringInfo url, StringInfo postData, int comp
 	else
 		curl_easy_setopt(curl, CURLOPT_POST, 0);
 
-	ret = curl_easy_perform(curl);
-
-	/* we might have detected an interrupt in the progress function, so check for sure */
-	CHECK_FOR_INTERRUPTS();
+	return headers;
+}
 
+/*
+ * raise an ERROR if the request didn't work out
+ */
+static void check_response(CURLcode ret, int64 response_code, char *method, char *target, char *errorbuff, StringInfo response) {
 	if (ret != CURLE_OK) {
 		/* curl messed up */
 		ereport(ERROR,
 				(errcode(ERRCODE_IO_ERROR),
 						errmsg("libcurl error-code: %s(%d); message: %s; req=-X%s %s ", curl_easy_strerror(ret), ret,
-							   GLOBAL_CURL_ERRBUF, method, url->data)));
+							   errorbuff, method, target)));
 	}
 
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
 	if (response_code < 200 || (response_code >= 300 && response_code != 404)) {
 		ereport(ERROR,
 				(errcode(ERRCODE_IO_ERROR),
@@ -446,17 +993,389 @@ StringInfo rest_call(char *method, StringInfo url, StringInfo postData, int comp
 							   response_code, response->data)));
 	}
 
+	if (response_code != 404 && strstr(response->data, "{\"error\":") != NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_IO_ERROR),
+						errmsg("%s", response->data)));
+}
+
+/*
+ * Make a request and wait for it to finish.  Unless 'stream' is given, the response is collected
+ * and returned.  Otherwise it's handed to the stream's consumer as it arrives, and what's
+ * returned is just its beginning
+ */
+static StringInfo do_rest_call(char *method, StringInfo url, StringInfo postData, int compressionLevel, StreamingResponse *stream) {
+	char              *compressed_data;
+	StringInfo        response         = stream != NULL ? stream->prefix : makeStringInfo();
+	CURLcode          ret;
+	int64             response_code    = 0;
+	CURL              *curl            = GLOBAL_CURL_INSTANCE;
+	struct curl_slist *headers;
+	char              *target          = rest_nodes_route(url->data);
+	char              *failover;
+	double            seconds;
+
+	headers = setup_request(curl, method, postData, compressionLevel, GLOBAL_CURL_ERRBUF, stream, response,
+							&compressed_data);
+
+	while (true) {
+		curl_easy_setopt(curl, CURLOPT_URL, target);
+
+		rest_nodes_request_started(target);
+		ret = curl_easy_perform(curl);
+
+		seconds = 0;
+		curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &seconds);
+		rest_nodes_request_finished(target, seconds);
+
+		/* we might have detected an interrupt in the progress function, so check for sure */
+		CHECK_FOR_INTERRUPTS();
+
+		/* if we couldn't reach the node, try another one of the cluster's nodes */
+		if (ret == CURLE_OK || (failover = rest_nodes_failover(target, ret)) == NULL)
+			break;
+
+		resetStringInfo(response);
+		target = failover;
+	}
+
+	if (ret == CURLE_OK)
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+	check_response(ret, response_code, method, target, GLOBAL_CURL_ERRBUF, response);
+
 	if (compressed_data != NULL)
 		pfree(compressed_data);
 
 	if (headers != NULL)
 		curl_slist_free_all(headers);
 
-	if (response_code != 404 && strstr(response->data, "{\"error\":") != NULL)
+	return response;
+}
+
+StringInfo rest_call(char *method, StringInfo url, StringInfo postData, int compressionLevel) {
+	return do_rest_call(method, url, postData, compressionLevel, NULL);
+}
+
+/*
+ * Like rest_call(), except the response body is given to 'consumer' as it comes off the wire
+ * rather than being collected.  Only its first REST_RESPONSE_PREFIX_SIZE bytes are kept, and
+ * returned, for error messages
+ */
+StringInfo rest_call_streaming(char *method, StringInfo url, StringInfo postData, int compressionLevel, RestResponseConsumer consumer, void *consumerArg) {
+	StreamingResponse stream;
+
+	stream.prefix      = makeStringInfo();
+	stream.consumer    = consumer;
+	stream.consumerArg = consumerArg;
+
+	return do_rest_call(method, url, postData, compressionLevel, &stream);
+}
+
+
+/*
+ * A request started by rest_async_call() that's yet to be collected by rest_await().  Everything
+ * it, and curl, refers to while it's in flight lives in its own memory context
+ */
+struct RestFuture {
+	MemoryContext     memcxt;
+	SubTransactionId  subxid;       /* the subtransaction that started it */
+	CURL              *curl;
+	struct curl_slist *headers;
+	StringInfo        postData;     /* our own copy, as the caller needn't keep theirs */
+	char              *compressed;
+	char              *method;
+	char              *target;      /* the url it was sent to */
+	StringInfo        response;     /* or just its beginning, if it's streamed */
+	StreamingResponse *stream;
+	char              errorbuff[CURL_ERROR_SIZE];
+	bool              done;
+	bool              abandoned;    /* its subtransaction aborted before anyone waited for it */
+	CURLcode          result;
+};
+
+/*
+ * All asynchronous requests are driven by one multi handle that lives as long as the backend.
+ * 'asyncFutures' are those whose handle hasn't been released yet, and is kept in TopMemoryContext
+ */
+static CURLM *asyncMultiHandle = NULL;
+static List  *asyncFutures     = NIL;
+
+static void send_async(RestFuture *future) {
+	MemoryContext oldContext;
+	CURLMcode     mc;
+
+	curl_easy_setopt(future->curl, CURLOPT_URL, future->target);
+	future->done = false;
+
+	if ((mc = curl_multi_add_handle(asyncMultiHandle, future->curl)) != CURLM_OK)
+		elog(ERROR, "curl_multi_add_handle failed.  code=%d", mc);
+	rest_nodes_request_started(future->target);
+
+	if (!list_member_ptr(asyncFutures, future)) {
+		oldContext   = MemoryContextSwitchTo(TopMemoryContext);
+		asyncFutures = lappend(asyncFutures, future);
+		MemoryContextSwitchTo(oldContext);
+	}
+}
+
+/*
+ * Let every outstanding asynchronous request make whatever progress it can without waiting,
+ * and note those that have finished
+ */
+static int drive_async(void) {
+	CURLMsg   *msg;
+	CURLMcode mc;
+	int       still_running;
+	int       msgs_left;
+
+	while ((mc = curl_multi_perform(asyncMultiHandle, &still_running)) == CURLM_CALL_MULTI_PERFORM)
+		CHECK_FOR_INTERRUPTS();
+
+	if (mc != CURLM_OK)
+		elog(ERROR, "curl_multi_perform failed.  code=%d", mc);
+
+	while ((msg = curl_multi_info_read(asyncMultiHandle, &msgs_left)) != NULL) {
+		if (msg->msg == CURLMSG_DONE) {
+			CURL       *handle = msg->easy_handle;
+			RestFuture *future = NULL;
+
+			curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **) &future);
+			future->result = msg->data.result;
+			future->done   = true;
+
+			curl_multi_remove_handle(asyncMultiHandle, handle);
+		}
+	}
+
+	return still_running;
+}
+
+/*
+ * Start a request, whose response is either collected or, if 'consumer' is given, streamed
+ * to it.  The future's memory context is a child of the transaction's, so rest_async_cleanup()
+ * can still see it if nobody waits for it
+ */
+static RestFuture *start_async(char *method, StringInfo url, StringInfo postData, int compressionLevel, RestResponseConsumer consumer, void *consumerArg) {
+	MemoryContext memcxt = AllocSetContextCreate(TopTransactionContext, "RestFuture", ALLOCSET_DEFAULT_SIZES);
+	MemoryContext oldContext;
+	RestFuture    *future;
+
+	if (asyncMultiHandle == NULL) {
+		asyncMultiHandle = curl_multi_init();
+		if (asyncMultiHandle == NULL)
+			elog(ERROR, "unable to initialize curl multi handle");
+	}
+
+	oldContext = MemoryContextSwitchTo(memcxt);
+
+	future = palloc0(sizeof(RestFuture));
+	future->memcxt = memcxt;
+	future->subxid = GetCurrentSubTransactionId();
+
+	if (postData != NULL) {
+		future->postData = makeStringInfo();
+		appendBinaryStringInfo(future->postData, postData->data, postData->len);
+	}
+
+	if (consumer != NULL) {
+		future->stream              = palloc(sizeof(StreamingResponse));
+		future->stream->prefix      = makeStringInfo();
+		future->stream->consumer    = consumer;
+		future->stream->consumerArg = consumerArg;
+	}
+
+	future->curl     = curl_checkout_easy_handle(false);
+	future->method   = pstrdup(method);
+	future->target   = pstrdup(rest_nodes_route(url->data));
+	future->response = future->stream != NULL ? future->stream->prefix : makeStringInfo();
+	future->headers  = setup_request(future->curl, method, future->postData, compressionLevel, future->errorbuff,
+									 future->stream, future->response, &future->compressed);
+	curl_easy_setopt(future->curl, CURLOPT_PRIVATE, future);
+
+	MemoryContextSwitchTo(oldContext);
+
+	send_async(future);
+
+	/* get it on its way */
+	drive_async();
+	return future;
+}
+
+/*
+ * Start a request without waiting for it to finish.  Its response is collected with
+ * rest_await(), which is also when any error it had is raised.  Any number of these can be
+ * in flight at once, and they all make progress whenever any one of them is waited on
+ */
+RestFuture *rest_async_call(char *method, StringInfo url, StringInfo postData, int compressionLevel) {
+	return start_async(method, url, postData, compressionLevel, NULL, NULL);
+}
+
+/*
+ * rest_async_call() for a response that's given to 'consumer' as it arrives, as
+ * with rest_call_streaming()
+ */
+RestFuture *rest_async_call_streaming(char *method, StringInfo url, StringInfo postData, int compressionLevel, RestResponseConsumer consumer, void *consumerArg) {
+	return start_async(method, url, postData, compressionLevel, consumer, consumerArg);
+}
+
+/*
+ * Give up the future's handle, and everything else curl was using for it.  If 'reuse' the
+ * handle goes back to the pool, otherwise it's destroyed along with its connection
+ */
+static void release_future(RestFuture *future, bool reuse) {
+	asyncFutures = list_delete_ptr(asyncFutures, future);
+
+	if (reuse)
+		curl_return_easy_handle(future->curl);
+	else
+		curl_easy_cleanup(future->curl);
+	future->curl = NULL;
+
+	if (future->headers != NULL)
+		curl_slist_free_all(future->headers);
+	future->headers = NULL;
+}
+
+/*
+ * Stop curl from doing anything more with the future.  Whoever started it still owns it,
+ * and can wait for it or cancel it
+ */
+static void abandon_future(RestFuture *future) {
+	if (!future->done) {
+		curl_multi_remove_handle(asyncMultiHandle, future->curl);
+		rest_nodes_request_finished(future->target, 0);
+
+		/* the connection is in an unknown state, so don't let anyone else use it */
+		release_future(future, false);
+	} else {
+		release_future(future, true);
+	}
+
+	future->done      = true;
+	future->abandoned = true;
+}
+
+/*
+ * Wait for a request from rest_async_call() to finish and return its response, just as
+ * rest_call() would have.  The future is freed
+ */
+StringInfo rest_await(RestFuture *future) {
+	StringInfo response;
+	int64      response_code = 0;
+	double     seconds;
+	char       *failover;
+
+	if (future->abandoned)
 		ereport(ERROR,
-				(errcode(ERRCODE_IO_ERROR),
-						errmsg("%s", response->data)));
+				(errcode(ERRCODE_INTERNAL_ERROR),
+						errmsg("[zombodb] the request to %s was abandoned when its subtransaction aborted",
+							   future->target)));
+
+	while (true) {
+		while (!future->done) {
+			CURLMcode mc;
+			int       numfds;
+
+			if (drive_async() == 0 || future->done)
+				continue;
+
+			CHECK_FOR_INTERRUPTS();
+			if ((mc = curl_multi_wait(asyncMultiHandle, NULL, 0, 1000, &numfds)) != CURLM_OK)
+				elog(ERROR, "curl_multi_wait failed.  code=%d", mc);
+		}
+
+		seconds = 0;
+		curl_easy_getinfo(future->curl, CURLINFO_TOTAL_TIME, &seconds);
+		rest_nodes_request_finished(future->target, seconds);
+
+		/* we might have detected an interrupt in the progress function, so check for sure */
+		CHECK_FOR_INTERRUPTS();
+
+		/* if we couldn't reach the node, try another one of the cluster's nodes */
+		if (future->result == CURLE_OK || (failover = rest_nodes_failover(future->target, future->result)) == NULL)
+			break;
 
+		resetStringInfo(future->response);
+		future->target = MemoryContextStrdup(future->memcxt, failover);
+		send_async(future);
+	}
+
+	if (future->result == CURLE_OK)
+		curl_easy_getinfo(future->curl, CURLINFO_RESPONSE_CODE, &response_code);
+	release_future(future, true);
+
+	check_response(future->result, response_code, future->method, future->target, future->errorbuff,
+				   future->response);
+
+	/* the response outlives the future, in the caller's context */
+	response = makeStringInfo();
+	appendBinaryStringInfo(response, future->response->data, future->response->len);
+	MemoryContextDelete(future->memcxt);
 	return response;
 }
 
+/*
+ * Let every asynchronous request make whatever progress it can without waiting, for
+ * callers with other work to do while theirs are in flight
+ */
+void rest_async_progress(void) {
+	if (asyncMultiHandle != NULL && asyncFutures != NIL)
+		drive_async();
+}
+
+/*
+ * We no longer want the response to this request.  If it's still running it's abandoned
+ */
+void rest_async_cancel(RestFuture *future) {
+	if (!future->abandoned)
+		abandon_future(future);
+
+	MemoryContextDelete(future->memcxt);
+}
+
+/*
+ * Called when a subtransaction ends.  If it aborted, the requests it started are abandoned, as
+ * whatever their responses were being streamed to is about to go away with it.  If it committed,
+ * they belong to its parent now
+ */
+void rest_async_subxact_cleanup(SubTransactionId mySubid, SubTransactionId parentSubid, bool isCommit) {
+	List     *futures = list_copy(asyncFutures);
+	ListCell *lc;
+
+	foreach (lc, futures) {
+		RestFuture *future = lfirst(lc);
+
+		if (future->subxid != mySubid)
+			continue;
+
+		if (isCommit)
+			future->subxid = parentSubid;
+		else
+			abandon_future(future);
+	}
+
+	list_free(futures);
+}
+
+/*
+ * Called when the transaction ends, to abandon any asynchronous requests nobody waited on.
+ * Their memory is about to go away with the transaction's
+ */
+void rest_async_cleanup(void) {
+	ListCell *lc;
+
+	foreach (lc, asyncFutures) {
+		RestFuture *future = lfirst(lc);
+
+		if (!future->done) {
+			curl_multi_remove_handle(asyncMultiHandle, future->curl);
+			rest_nodes_request_finished(future->target, 0);
+		}
+		curl_easy_cleanup(future->curl);
+		if (future->headers != NULL)
+			curl_slist_free_all(future->headers);
+	}
+
+	list_free(asyncFutures);
+	asyncFutures = NIL;
+}
@@ -19,7 +19,26 @@
 
 #include "curl_support.h"
 
+/* receives a response body, piece by piece, as it arrives */
+typedef void (*RestResponseConsumer)(void *arg, const char *data, size_t len);
+
 StringInfo rest_call(char *method, StringInfo url, StringInfo postData, int compressionLevel);
+StringInfo rest_call_streaming(char *method, StringInfo url, StringInfo postData, int compressionLevel, RestResponseConsumer consumer, void *consumerArg);
+
+/* a request that's been started but not yet waited for */
+typedef struct RestFuture RestFuture;
+
+RestFuture *rest_async_call(char *method, StringInfo url, StringInfo postData, int compressionLevel);
+RestFuture *rest_async_call_streaming(char *method, StringInfo url, StringInfo postData, int compressionLevel, RestResponseConsumer consumer, void *consumerArg);
+StringInfo rest_await(RestFuture *future);
+void rest_async_progress(void);
+void rest_async_cancel(RestFuture *future);
+void rest_async_subxact_cleanup(SubTransactionId mySubid, SubTransactionId parentSubid, bool isCommit);
+void rest_async_cleanup(void);
+
+PostDataEntry *rest_postdata_create(int pool_idx, int compressionLevel);
+void rest_postdata_compress(PostDataEntry *entry);
+void rest_postdata_reset(PostDataEntry *entry);
 
 MultiRestState *rest_multi_init(int nhandles, bool ignore_version_conflicts);
 int rest_multi_perform(MultiRestState *state);
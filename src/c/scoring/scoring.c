@@ -122,6 +122,14 @@ Datum zdb_score(PG_FUNCTION_ARGS) {
 			Var           *var          = (Var *) firstArg;
 			QueryDesc     *currentQuery = linitial(currentQueryStack);
 			RangeTblEntry *rentry       = rt_fetch(var->varnoold, currentQuery->plannedstmt->rtable);
+			ItemPointerData root;
+
+			if (fcinfo->flinfo->fn_extra == NULL)
+				fcinfo->flinfo->fn_extra = create_hot_root_cache(fcinfo->flinfo->fn_mcxt);
+
+			/* scores are known by the root ctid of HOT chains */
+			if (find_hot_root_cached(fcinfo->flinfo->fn_extra, rentry->relid, ctid, &root))
+				ctid = &root;
 
 			PG_RETURN_FLOAT4(scoring_lookup_score(rentry->relid, ctid));
 		} else {
@@ -35,59 +35,209 @@ PG_FUNCTION_INFO_V1(zdbquery_to_jsonb);
 
 PG_FUNCTION_INFO_V1(zdb_set_query_property);
 
-static bool zdbquery_string_is_zdb(char *query) {
-	void *json;
-	bool is_zdb;
+#define ZDBQUERY_WANTS_SCORE 0x01
 
-	if (!is_json(query))
-		return false;
+/*
+ * The properties of a zdbquery, which follow ZDBQUERY_BINARY_MAGIC.  After them comes the sort
+ * json and then the query dsl, each null-terminated, if they have a length.  The header isn't
+ * necessarily aligned, so it's always copied out before it's used
+ */
+typedef struct ZDBQueryHeader {
+	uint64 limit;
+	uint64 offset;
+	uint64 rowEstimate;   /* as it was given, or zero */
+	float8 minScore;
+	uint32 sortLen;
+	uint32 queryLen;
+	uint8  flags;
+} ZDBQueryHeader;
+
+/*
+ * A zdbquery's properties, with its sort json and query dsl, which point into the zdbquery
+ * itself unless it's in the old json format
+ */
+typedef struct ZDBQueryProperties {
+	ZDBQueryHeader header;
+	char           *sortJson;
+	char           *queryDsl;
+} ZDBQueryProperties;
+
+static char *write_json_palloc(void *json) {
+	char *written = write_json(json);   /* which is malloc'd */
+	char *rc      = pstrdup(written);
+
+	free(written);
+	return rc;
+}
 
-	json = parse_json_object_from_string(query, CurrentMemoryContext);
-	is_zdb = get_json_object_object(json, "query_dsl", true) != NULL;
+/*
+ * json text, minified the same way no matter how it was written
+ */
+static char *normalize_json(char *input) {
+	void *json = parse_json_object_from_string(input, CurrentMemoryContext);
+	char *rc   = write_json_palloc(json);
 
 	pfree(json);
-	return is_zdb;
+	return rc;
+}
+
+static char *json_property(void *json, char *key) {
+	void *value = get_json_object_object(json, key, true);
+
+	return value != NULL ? write_json_palloc(value) : NULL;
+}
+
+static void properties_from_json(void *json, ZDBQueryProperties *props) {
+	memset(props, 0, sizeof(ZDBQueryProperties));
+
+	props->header.limit       = get_json_object_uint64(json, "limit", true);
+	props->header.offset      = get_json_object_uint64(json, "offset", true);
+	props->header.rowEstimate = get_json_object_uint64(json, "row_estimate", true);
+	props->header.minScore    = get_json_object_real(json, "min_score");
+	if (get_json_object_bool(json, "wants_score", true))
+		props->header.flags |= ZDBQUERY_WANTS_SCORE;
+
+	props->sortJson = json_property(json, "sort_json");
+	props->queryDsl = json_property(json, "query_dsl");
+}
+
+/*
+ * Get at the properties of the zdbquery, which only needs parsing if it's in the old json format
+ */
+static void zdbquery_get_properties(ZDBQueryType *query, ZDBQueryProperties *props) {
+	if (query->data[0] == ZDBQUERY_BINARY_MAGIC) {
+		char *strings = query->data + 1 + sizeof(ZDBQueryHeader);
+
+		memcpy(&props->header, query->data + 1, sizeof(ZDBQueryHeader));
+		props->sortJson = props->header.sortLen > 0 ? strings : NULL;
+		props->queryDsl = props->header.queryLen > 0 ?
+						  strings + (props->header.sortLen > 0 ? props->header.sortLen + 1 : 0) : NULL;
+	} else {
+		void *json = parse_json_object_from_string(query->data, CurrentMemoryContext);
+
+		properties_from_json(json, props);
+		pfree(json);
+	}
+}
+
+static ZDBQueryType *zdbquery_build(ZDBQueryProperties *props) {
+	ZDBQueryHeader header = props->header;
+	ZDBQueryType   *result;
+	Size           size;
+	char           *ptr;
+
+	header.sortLen  = props->sortJson != NULL ? (uint32) strlen(props->sortJson) : 0;
+	header.queryLen = props->queryDsl != NULL ? (uint32) strlen(props->queryDsl) : 0;
+
+	size = VARHDRSZ + 1 + sizeof(ZDBQueryHeader);
+	if (header.sortLen > 0)
+		size += header.sortLen + 1;
+	if (header.queryLen > 0)
+		size += header.queryLen + 1;
+
+	result = palloc0(size);
+	SET_VARSIZE(result, size);
+
+	result->data[0] = ZDBQUERY_BINARY_MAGIC;
+	memcpy(result->data + 1, &header, sizeof(ZDBQueryHeader));
+
+	ptr = result->data + 1 + sizeof(ZDBQueryHeader);
+	if (header.sortLen > 0) {
+		memcpy(ptr, props->sortJson, header.sortLen + 1);
+		ptr += header.sortLen + 1;
+	}
+	if (header.queryLen > 0)
+		memcpy(ptr, props->queryDsl, header.queryLen + 1);
+
+	return result;
+}
+
+/*
+ * The json text of all the properties, as they've always been written
+ */
+static char *zdbquery_properties_to_json(ZDBQueryProperties *props) {
+	StringInfo query = makeStringInfo();
+
+	appendStringInfoChar(query, '{');
+	if (props->header.limit > 0) {
+		appendStringInfo(query, "\"limit\":%lu", props->header.limit);
+	}
+	if (props->header.offset > 0) {
+		if (query->len > 1)
+			appendStringInfoChar(query, ',');
+		appendStringInfo(query, "\"offset\":%lu", props->header.offset);
+	}
+	if (props->header.minScore > 0.0) {
+		if (query->len > 1)
+			appendStringInfoChar(query, ',');
+		appendStringInfo(query, "\"min_score\":%f", props->header.minScore);
+	}
+	if (props->sortJson != NULL) {
+		if (query->len > 1)
+			appendStringInfoChar(query, ',');
+		appendStringInfo(query, "\"sort_json\":%s", props->sortJson);
+	}
+	if (props->header.rowEstimate > 0) {
+		if (query->len > 1)
+			appendStringInfoChar(query, ',');
+		appendStringInfo(query, "\"row_estimate\":%lu", props->header.rowEstimate);
+	}
+	if (props->queryDsl != NULL) {
+		if (query->len > 1)
+			appendStringInfoChar(query, ',');
+		appendStringInfo(query, "\"query_dsl\":%s", props->queryDsl);
+	}
+	if (props->header.flags & ZDBQUERY_WANTS_SCORE) {
+		if (query->len > 1)
+			appendStringInfoChar(query, ',');
+		appendStringInfo(query, "\"wants_score\":true");
+	}
+	appendStringInfoChar(query, '}');
+
+	return query->data;
 }
 
-static bool zdbquery_has_no_options(ZDBQueryType *query) {
-	return zdbquery_get_limit(query) == 0 &&
-		   zdbquery_get_offset(query) == 0 &&
-		   zdbquery_get_min_score(query) == 0.0 &&
-		   zdbquery_get_row_estimate(query) == zdb_default_row_estimation_guc &&
-		   zdbquery_get_sort_json(query) == NULL &&
-		   zdbquery_get_wants_score(query) == false;
+static bool zdbquery_has_no_options(ZDBQueryProperties *props) {
+	return props->header.limit == 0 &&
+		   props->header.offset == 0 &&
+		   props->header.minScore == 0.0 &&
+		   (props->header.rowEstimate == 0 || props->header.rowEstimate == (uint64) zdb_default_row_estimation_guc) &&
+		   props->sortJson == NULL &&
+		   (props->header.flags & ZDBQUERY_WANTS_SCORE) == 0;
 }
 
 static char *zdbquery_to_minimal_json(ZDBQueryType *query) {
+	ZDBQueryProperties props;
+
+	zdbquery_get_properties(query, &props);
+
 	/*
 	 * for brevity, especially in EXPLAIN output, output only the actual ES query if the query
 	 * has no other ZDB-specific options
 	 */
-	if (zdbquery_has_no_options(query))
-		return zdbquery_get_query(query);
+	if (zdbquery_has_no_options(&props))
+		return pstrdup(props.queryDsl);
 	else
-		return query->json;
+		return zdbquery_properties_to_json(&props);
 }
 
 ZDBQueryType *zdbquery_in_direct(char *input) {
-	size_t       len;
-	ZDBQueryType *result;
-	char         *json;
+	ZDBQueryProperties props;
+	void               *json = is_json(input) ? parse_json_object_from_string(input, CurrentMemoryContext) : NULL;
 
-	if (zdbquery_string_is_zdb(input)) {
+	if (json != NULL && get_json_object_object(json, "query_dsl", true) != NULL) {
 		/* it's already in the format we expect */
-		json = input;
+		properties_from_json(json, &props);
 	} else {
-		/* we need to build it ourself */
-		json = psprintf("{\"query_dsl\":%s}", convert_to_query_dsl_not_wrapped(input));
+		/* it's just the query, so we need to build the rest ourself */
+		memset(&props, 0, sizeof(ZDBQueryProperties));
+		props.queryDsl = normalize_json(convert_to_query_dsl_not_wrapped(input));
 	}
 
-	len    = strlen(json);
-	result = palloc0(sizeof(ZDBQueryType) + len + 1);
+	if (json != NULL)
+		pfree(json);
 
-	memcpy(result->json, json, len + 1);
-	SET_VARSIZE(result, sizeof(ZDBQueryType) + len + 1);
-	return result;
+	return zdbquery_build(&props);
 }
 
 Datum zdbquery_in(PG_FUNCTION_ARGS) {
@@ -109,7 +259,7 @@ Datum zdbquery_out(PG_FUNCTION_ARGS) {
 	}
 
 	pfree(json);
-	PG_RETURN_CSTRING(pstrdup(queryJson));
+	PG_RETURN_CSTRING(queryJson);
 }
 
 Datum zdbquery_recv(PG_FUNCTION_ARGS) {
@@ -119,11 +269,15 @@ Datum zdbquery_recv(PG_FUNCTION_ARGS) {
 }
 
 Datum zdbquery_send(PG_FUNCTION_ARGS) {
-	ZDBQueryType   *zdbquery = (ZDBQueryType *) PG_GETARG_POINTER(0);
-	StringInfoData msg;
+	ZDBQueryType       *zdbquery = (ZDBQueryType *) PG_GETARG_VARLENA_P(0);
+	ZDBQueryProperties props;
+	StringInfoData     msg;
+
+	/* the binary format of the type, to clients, is still the json of its properties */
+	zdbquery_get_properties(zdbquery, &props);
 
 	pq_begintypsend(&msg);
-	pq_sendstring(&msg, zdbquery->json);
+	pq_sendstring(&msg, zdbquery_properties_to_json(&props));
 	PG_RETURN_BYTEA_P(pq_endtypsend(&msg));
 }
 
@@ -151,216 +305,103 @@ Datum zdbquery_to_jsonb(PG_FUNCTION_ARGS) {
 	PG_RETURN_DATUM(DirectFunctionCall1(jsonb_in, CStringGetDatum(zdbquery_to_minimal_json(query))));
 }
 
-static uint64 zdbquery_get_raw_row_estimate(ZDBQueryType *query) {
-	void   *json    = parse_json_object_from_string(query->json, CurrentMemoryContext);
-	uint64 estimate = get_json_object_uint64(json, "row_estimate", true);
-
-	pfree(json);
-	return estimate;
-}
-
 bool zdbquery_get_wants_score(ZDBQueryType *query) {
-	void   *json    = parse_json_object_from_string(query->json, CurrentMemoryContext);
-	bool wants_score = get_json_object_bool(json, "wants_score", true);
+	ZDBQueryProperties props;
 
-	pfree(json);
-	return wants_score;
+	zdbquery_get_properties(query, &props);
+	return (props.header.flags & ZDBQUERY_WANTS_SCORE) != 0;
 }
 
 uint64 zdbquery_get_row_estimate(ZDBQueryType *query) {
-	void   *json    = parse_json_object_from_string(query->json, CurrentMemoryContext);
-	uint64 estimate = get_json_object_uint64(json, "row_estimate", true);
+	ZDBQueryProperties props;
+	uint64             estimate;
+
+	zdbquery_get_properties(query, &props);
+	estimate = props.header.rowEstimate;
 
 	if (estimate == 0)
-		estimate = get_json_object_uint64(json, "limit", true);
+		estimate = props.header.limit;
 
 	if (estimate == 0)
 		estimate = (uint64) zdb_default_row_estimation_guc;
 
-	pfree(json);
 	return estimate;
 }
 
 double zdbquery_get_min_score(ZDBQueryType *query) {
-	void   *json     = parse_json_object_from_string(query->json, CurrentMemoryContext);
-	float8 min_score = get_json_object_real(json, "min_score");
+	ZDBQueryProperties props;
 
-	pfree(json);
-	return min_score;
+	zdbquery_get_properties(query, &props);
+	return props.header.minScore;
 }
 
 uint64 zdbquery_get_limit(ZDBQueryType *query) {
-	void   *json    = parse_json_object_from_string(query->json, CurrentMemoryContext);
-	uint64 estimate = get_json_object_uint64(json, "limit", true);
+	ZDBQueryProperties props;
 
-	pfree(json);
-	return estimate;
+	zdbquery_get_properties(query, &props);
+	return props.header.limit;
 }
 
 uint64 zdbquery_get_offset(ZDBQueryType *query) {
-	void   *json    = parse_json_object_from_string(query->json, CurrentMemoryContext);
-	uint64 estimate = get_json_object_uint64(json, "offset", true);
+	ZDBQueryProperties props;
 
-	pfree(json);
-	return estimate;
+	zdbquery_get_properties(query, &props);
+	return props.header.offset;
 }
 
 char *zdbquery_get_sort_json(ZDBQueryType *query) {
-	void *json        = parse_json_object_from_string(query->json, CurrentMemoryContext);
-	void *sortObject = (char *) get_json_object_object(json, "sort_json", true);
-	char *sortString = write_json(sortObject);
-
-	if (sortString != NULL)
-		sortString = pstrdup(sortString);
+	ZDBQueryProperties props;
 
-	pfree(json);
-	return sortString;
+	zdbquery_get_properties(query, &props);
+	return props.sortJson != NULL ? pstrdup(props.sortJson) : NULL;
 }
 
 char *zdbquery_get_query(ZDBQueryType *query) {
-	void *json        = parse_json_object_from_string(query->json, CurrentMemoryContext);
-	void *queryObject = (char *) get_json_object_object(json, "query_dsl", true);
-	char *queryString = write_json(queryObject);
+	ZDBQueryProperties props;
 
-	if (queryString != NULL)
-		queryString = pstrdup(queryString);
+	zdbquery_get_properties(query, &props);
+	return props.queryDsl != NULL ? pstrdup(props.queryDsl) : NULL;
+}
 
-	pfree(json);
-	return queryString;
+/*
+ * A copy of the zdbquery, sorted by 'sortJson' instead
+ */
+ZDBQueryType *zdbquery_set_sort_json(ZDBQueryType *query, char *sortJson) {
+	ZDBQueryProperties props;
+
+	zdbquery_get_properties(query, &props);
+	props.sortJson = sortJson;
+	return zdbquery_build(&props);
 }
 
-#define ZDBQUERY_MAX_KEYS 7
-typedef enum zdbquery_properties {
-	zdbquery_limit = 0,
-	zdbquery_offset,
-	zdbquery_min_score,
-	zdbquery_sort_json,
-	zdbquery_row_estimate,
-	zdbquery_query_dsl,
-	zdbquery_wants_score
-} zdbquery_properties;
-
-static zdbquery_properties zdbquery_key_to_propenum(char *key) {
+Datum zdb_set_query_property(PG_FUNCTION_ARGS) {
+	char               *key   = GET_STR(PG_GETARG_TEXT_P(0));
+	char               *value = GET_STR(PG_GETARG_TEXT_P(1));
+	ZDBQueryType       *input = (ZDBQueryType *) PG_GETARG_VARLENA_P(2);
+	ZDBQueryProperties props;
+
+	zdbquery_get_properties(input, &props);
+
 	if (strcmp(key, "limit") == 0) {
-		return zdbquery_limit;
+		props.header.limit = DatumGetUInt64(DirectFunctionCall1(int8in, CStringGetDatum(value)));
 	} else if (strcmp(key, "offset") == 0) {
-		return zdbquery_offset;
+		props.header.offset = DatumGetUInt64(DirectFunctionCall1(int8in, CStringGetDatum(value)));
 	} else if (strcmp(key, "min_score") == 0) {
-		return zdbquery_min_score;
+		props.header.minScore = DatumGetFloat8(DirectFunctionCall1(float8in, CStringGetDatum(value)));
 	} else if (strcmp(key, "sort_json") == 0) {
-		return zdbquery_sort_json;
+		props.sortJson = normalize_json(value);
 	} else if (strcmp(key, "row_estimate") == 0) {
-		return zdbquery_row_estimate;
+		props.header.rowEstimate = DatumGetUInt64(DirectFunctionCall1(int8in, CStringGetDatum(value)));
 	} else if (strcmp(key, "query_dsl") == 0) {
-		return zdbquery_query_dsl;
+		props.queryDsl = normalize_json(value);
 	} else if (strcmp(key, "wants_score") == 0) {
-		return zdbquery_wants_score;
-	}
-
-	elog(ERROR, "unrecognized zdbquery property: %s", key);
-}
-
-Datum zdb_set_query_property(PG_FUNCTION_ARGS) {
-	char                *key   = GET_STR(PG_GETARG_TEXT_P(0));
-	char                *value = GET_STR(PG_GETARG_TEXT_P(1));
-	ZDBQueryType        *input = (ZDBQueryType *) PG_GETARG_VARLENA_P(2);
-	zdbquery_properties prop   = zdbquery_key_to_propenum(key);
-	StringInfo          query  = makeStringInfo();
-	int                 i;
-
-	appendStringInfoChar(query, '{');
-	for (i = 0; i < ZDBQUERY_MAX_KEYS; i++) {
-
-		switch (i) {
-			case zdbquery_limit: {
-				uint64 limit = prop == i ? DatumGetUInt64(DirectFunctionCall1(int8in, CStringGetDatum(value)))
-										 : zdbquery_get_limit(
-								input);
-
-				if (limit > 0) {
-					if (query->len > 1)
-						appendStringInfoChar(query, ',');
-					appendStringInfo(query, "\"limit\":%lu", limit);
-				}
-			}
-				break;
-
-			case zdbquery_offset: {
-				uint64 offset = prop == i ? DatumGetUInt64(DirectFunctionCall1(int8in, CStringGetDatum(value)))
-										  : zdbquery_get_offset(input);
-
-				if (offset > 0) {
-					if (query->len > 1)
-						appendStringInfoChar(query, ',');
-					appendStringInfo(query, "\"offset\":%lu", offset);
-				}
-			}
-				break;
-
-			case zdbquery_min_score: {
-				float8 min_score = prop == i ? DatumGetFloat8(DirectFunctionCall1(float8in, CStringGetDatum(value)))
-											 : zdbquery_get_min_score(input);
-
-				if (min_score > 0.0) {
-					if (query->len > 1)
-						appendStringInfoChar(query, ',');
-					appendStringInfo(query, "\"min_score\":%f", min_score);
-				}
-			}
-				break;
-
-			case zdbquery_sort_json: {
-				char *sort_json = prop == i ? value : zdbquery_get_sort_json(input);
-
-				if (sort_json != NULL) {
-					if (query->len > 1)
-						appendStringInfoChar(query, ',');
-
-					appendStringInfo(query, "\"sort_json\":%s", sort_json);
-				}
-			}
-				break;
-
-			case zdbquery_row_estimate: {
-				uint64 row_estimate = prop == i ? DatumGetUInt64(DirectFunctionCall1(int8in, CStringGetDatum(value)))
-												: zdbquery_get_raw_row_estimate(input);
-
-				if (row_estimate > 0) {
-					if (query->len > 1)
-						appendStringInfoChar(query, ',');
-					appendStringInfo(query, "\"row_estimate\":%lu", row_estimate);
-				}
-			}
-				break;
-
-			case zdbquery_query_dsl: {
-				char *query_dsl = prop == i ? value : zdbquery_get_query(input);
-
-				if (query_dsl != NULL) {
-					if (query->len > 1)
-						appendStringInfoChar(query, ',');
-					appendStringInfo(query, "\"query_dsl\":%s", query_dsl);
-				}
-			}
-				break;
-
-			case zdbquery_wants_score: {
-				bool wants_score = prop == i ? DatumGetBool(DirectFunctionCall1(boolin, CStringGetDatum(value)))
-											 : zdbquery_get_wants_score(input);
-
-				if (wants_score) {
-					if (query->len > 1)
-						appendStringInfoChar(query, ',');
-					appendStringInfo(query, "\"wants_score\":true");
-				}
-			}
-				break;
-
-			default:
-				elog(ERROR, "unexpected property index: %d", i);
-		}
+		if (DatumGetBool(DirectFunctionCall1(boolin, CStringGetDatum(value))))
+			props.header.flags |= ZDBQUERY_WANTS_SCORE;
+		else
+			props.header.flags &= ~ZDBQUERY_WANTS_SCORE;
+	} else {
+		elog(ERROR, "unrecognized zdbquery property: %s", key);
 	}
-	appendStringInfoChar(query, '}');
 
-	PG_RETURN_POINTER(MakeZDBQuery(query->data));
+	PG_RETURN_POINTER(zdbquery_build(&props));
 }
@@ -20,10 +20,16 @@
 #include "postgres.h"
 #include "fmgr.h"
 
+/*
+ * A zdbquery is either the json text of its properties, which is how they used to be stored and
+ * always starts with '{', or ZDBQUERY_BINARY_MAGIC followed by a header of its properties and
+ * then its sort json and query dsl (see zdbquerytype.c)
+ */
+#define ZDBQUERY_BINARY_MAGIC 0x01
+
 typedef struct ZDBQueryType {
 	int32 vl_len_;        /* varlena header (do not touch directly!) */
-	char  json[FLEXIBLE_ARRAY_MEMBER];
-	/* query string follows */
+	char  data[FLEXIBLE_ARRAY_MEMBER];
 } ZDBQueryType;
 
 ZDBQueryType *zdbquery_in_direct(char *input);
@@ -36,6 +42,8 @@ char *zdbquery_get_sort_json(ZDBQueryType *query);
 double zdbquery_get_min_score(ZDBQueryType *query);
 char *zdbquery_get_query(ZDBQueryType *query);
 
+ZDBQueryType *zdbquery_set_sort_json(ZDBQueryType *query, char *sortJson);
+
 #define MakeZDBQuery(cstr) zdbquery_in_direct(cstr)
 
 
@@ -15,14 +15,18 @@
  */
 
 #include "zombodb.h"
+#include "elasticsearch/elasticsearch.h"
 
 #include "access/amapi.h"
+#include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/reloptions.h"
 #include "access/relscan.h"
+#include "access/stratnum.h"
 #include "access/sysattr.h"
 #include "access/xact.h"
 #include "catalog/dependency.h"
+#include "catalog/index.h"
 #include "catalog/indexing.h"
 #include "catalog/objectaccess.h"
 #include "catalog/pg_trigger.h"
@@ -30,7 +34,9 @@
 #include "executor/spi.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
+#include "parser/parse_func.h"
 #include "parser/parsetree.h"
+#include "storage/bufmgr.h"
 #include "utils/lsyscache.h"
 #include "utils/ruleutils.h"
 #include "utils/syscache.h"
@@ -45,6 +51,7 @@ typedef struct LimitInfo {
 	IndexScanDesc desc;
 
 	uint64 limit;
+	char   *sortJson;
 } LimitInfo;
 
 /* defined in zdbam.c.  we use this to detect if we're opening a ZDB index or not */
@@ -182,6 +189,149 @@ Relation find_zombodb_index(Relation heapRel) {
 	elog(ERROR, "Unable to locate zombodb index on '%s'", RelationGetRelationName(heapRel));
 }
 
+/*
+ * Is our index of the whole row of its table, so that the table's column names are also the
+ * names of its fields in Elasticsearch?
+ */
+static bool index_is_of_whole_row(Relation indexRel) {
+	List *expressions = RelationGetIndexExpressions(indexRel);
+	Node *expr;
+
+	if (list_length(expressions) != 1)
+		return false;
+
+	expr = (Node *) linitial(expressions);
+	return IsA(expr, Var) && ((Var *) expr)->varattno == 0;
+}
+
+/*
+ * The types an index maps its table's columns as, by attribute number, kept in the index's
+ * relcache entry (rd_amcache), so that Postgres throws them away whenever the index changes
+ */
+typedef struct ZDBFieldTypeCache {
+	AttrNumber natts;
+	struct {
+		bool known;
+		char type[NAMEDATALEN];    /* empty if the index doesn't map the column */
+	}          fields[FLEXIBLE_ARRAY_MEMBER];
+} ZDBFieldTypeCache;
+
+/*
+ * The type our index maps column 'attno' (named 'attname') of its table as, or NULL
+ */
+static char *get_mapped_field_type(Relation indexRel, AttrNumber attno, char *attname) {
+	ZDBFieldTypeCache *cache = (ZDBFieldTypeCache *) indexRel->rd_amcache;
+
+	if (cache == NULL || attno > cache->natts) {
+		ZDBFieldTypeCache *grown;
+
+		grown = MemoryContextAllocZero(indexRel->rd_indexcxt,
+									   offsetof(ZDBFieldTypeCache, fields) + attno * sizeof(grown->fields[0]));
+		grown->natts = attno;
+		if (cache != NULL) {
+			memcpy(grown->fields, cache->fields, cache->natts * sizeof(cache->fields[0]));
+			pfree(cache);
+		}
+		indexRel->rd_amcache = cache = grown;
+	}
+
+	if (!cache->fields[attno - 1].known) {
+		char *type = ElasticsearchGetFieldType(indexRel, attname);
+
+		if (type != NULL)
+			strlcpy(cache->fields[attno - 1].type, type, NAMEDATALEN);
+		cache->fields[attno - 1].known = true;
+	}
+
+	return cache->fields[attno - 1].type[0] != '\0' ? cache->fields[attno - 1].type : NULL;
+}
+
+/*
+ * Does Elasticsearch order a field it maps as 'esType' the same way Postgres orders 'pgType'?
+ * Timestamps don't, as Elasticsearch dates only keep milliseconds
+ */
+static bool sorts_the_same(Oid pgType, char *esType) {
+	if (esType == NULL)
+		return false;
+
+	switch (pgType) {
+		case BOOLOID:
+			return strcmp(esType, "boolean") == 0;
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+			return strcmp(esType, "long") == 0 || strcmp(esType, "integer") == 0 ||
+				   strcmp(esType, "short") == 0 || strcmp(esType, "byte") == 0;
+		case FLOAT4OID:
+			return strcmp(esType, "float") == 0 || strcmp(esType, "double") == 0;
+		case FLOAT8OID:
+			return strcmp(esType, "double") == 0;
+		case DATEOID:
+			return strcmp(esType, "date") == 0;
+		default:
+			return false;
+	}
+}
+
+/*
+ * The Elasticsearch sort json for a Sort directly above our scan (whose range table index is
+ * 'scanrelid'), or NULL if it sorts by something Elasticsearch can't.  Elasticsearch can sort
+ * by zdb.score() of the scanned row, and by the columns the index maps as types it orders the
+ * same way Postgres does
+ */
+static char *sort_to_sort_json(Sort *sort, Index scanrelid, IndexScanDesc desc) {
+	static Oid arg[] = {TIDOID};
+	StringInfo sortJson  = makeStringInfo();
+	Oid        zdbScore  = ZDBFUNC("zdb", "score", 1, arg);
+	Oid        heapRelId = IndexGetRelation(RelationGetRelid(desc->indexRelation), false);
+	int        i;
+
+	appendStringInfoChar(sortJson, '[');
+	for (i = 0; i < sort->numCols; i++) {
+		TargetEntry *te = get_tle_by_resno(sort->plan.lefttree->targetlist, sort->sortColIdx[i]);
+		Node        *expr;
+		Oid         opfamily;
+		Oid         opcintype;
+		int16       strategy;
+		char        *direction;
+
+		if (te == NULL || !get_ordering_op_properties(sort->sortOperators[i], &opfamily, &opcintype, &strategy))
+			return NULL;
+		direction = strategy == BTGreaterStrategyNumber ? "desc" : "asc";
+		expr      = (Node *) te->expr;
+
+		if (i > 0)
+			appendStringInfoChar(sortJson, ',');
+
+		if (IsA(expr, FuncExpr) && ((FuncExpr *) expr)->funcid == zdbScore) {
+			Node *scoreArg = (Node *) linitial(((FuncExpr *) expr)->args);
+
+			if (!IsA(scoreArg, Var) || ((Var *) scoreArg)->varno != scanrelid)
+				return NULL;
+
+			appendStringInfo(sortJson, "{\"_score\":\"%s\"}", direction);
+		} else if (IsA(expr, Var) && ((Var *) expr)->varno == scanrelid && ((Var *) expr)->varattno > 0) {
+			Var  *var = (Var *) expr;
+			char *attname;
+
+			attname = get_attname(heapRelId, var->varattno);
+			if (attname == NULL || !index_is_of_whole_row(desc->indexRelation))
+				return NULL;
+
+			if (!sorts_the_same(var->vartype, get_mapped_field_type(desc->indexRelation, var->varattno, attname)))
+				return NULL;
+
+			appendStringInfo(sortJson, "{\"%s\":{\"order\":\"%s\",\"missing\":\"%s\"}}", attname, direction,
+							 sort->nullsFirst[i] ? "_first" : "_last");
+		} else {
+			return NULL;
+		}
+	}
+	appendStringInfoChar(sortJson, ']');
+
+	return sortJson->data;
+}
+
 static bool find_limit_for_scan_walker(PlanState *planstate, LimitInfo *context) {
 	Plan *plan;
 
@@ -195,21 +345,46 @@ static bool find_limit_for_scan_walker(PlanState *planstate, LimitInfo *context)
 		LimitState *limitState = (LimitState *) planstate;
 
 		if (limit->limitCount != NULL && limit->limitOffset == NULL && IsA(limit->limitCount, Const)) {
-			Const *lconst = (Const *) limit->limitCount;
+			Const     *lconst   = (Const *) limit->limitCount;
+			PlanState *child    = limitState->ps.lefttree;
+			Sort      *sort     = NULL;
+			char      *sortJson = NULL;
+
+			/*
+			 * a top-N Sort between the Limit and our scan is one that Elasticsearch can do instead,
+			 * so that it only returns the hits that'll make it through the Limit.  That's only so
+			 * if the scan doesn't filter out any of them
+			 */
+			if (child->type == T_SortState && child->lefttree != NULL && child->lefttree->plan->qual == NIL) {
+				sort  = (Sort *) child->plan;
+				child = child->lefttree;
+			}
 
-			if (limitState->ps.lefttree->type == T_IndexScanState) {
-				IndexScanState *indexScanState = (IndexScanState *) limitState->ps.lefttree;
+			if (child->type == T_IndexScanState) {
+				IndexScanState *indexScanState = (IndexScanState *) child;
 
 				if (indexScanState->iss_ScanDesc == context->desc) {
-					context->limit = DatumGetUInt64(lconst->constvalue);
+					if (sort != NULL)
+						sortJson = sort_to_sort_json(sort, ((Scan *) child->plan)->scanrelid, context->desc);
+
+					if (sort == NULL || sortJson != NULL) {
+						context->limit    = DatumGetUInt64(lconst->constvalue);
+						context->sortJson = sortJson;
+					}
 					return true;
 				}
-			} else if (limitState->ps.lefttree->type == T_BitmapHeapScanState) {
-				if (limitState->ps.lefttree->lefttree->type == T_BitmapIndexScanState) {
-					BitmapIndexScanState *indexScanState = (BitmapIndexScanState *) limitState->ps.lefttree->lefttree;
+			} else if (child->type == T_BitmapHeapScanState) {
+				if (child->lefttree->type == T_BitmapIndexScanState) {
+					BitmapIndexScanState *indexScanState = (BitmapIndexScanState *) child->lefttree;
 
 					if (indexScanState->biss_ScanDesc == context->desc) {
-						context->limit = DatumGetUInt64(lconst->constvalue);
+						if (sort != NULL)
+							sortJson = sort_to_sort_json(sort, ((Scan *) child->plan)->scanrelid, context->desc);
+
+						if (sort == NULL || sortJson != NULL) {
+							context->limit    = DatumGetUInt64(lconst->constvalue);
+							context->sortJson = sortJson;
+						}
 						return true;
 					}
 				}
@@ -220,14 +395,20 @@ static bool find_limit_for_scan_walker(PlanState *planstate, LimitInfo *context)
 	return planstate_tree_walker(planstate, find_limit_for_scan_walker, context);
 }
 
-uint64 find_limit_for_scan(IndexScanDesc scan) {
+/*
+ * The LIMIT that applies directly to our scan, if any.  If it's the LIMIT of a Sort that
+ * Elasticsearch can do instead, 'sortJson' is set to the Elasticsearch sort
+ */
+uint64 find_limit_for_scan(IndexScanDesc scan, char **sortJson) {
 	QueryDesc *currentQuery = linitial(currentQueryStack);
 	LimitInfo li;
 
-	li.limit = 0;
-	li.desc  = scan;
+	li.limit    = 0;
+	li.sortJson = NULL;
+	li.desc     = scan;
 
 	find_limit_for_scan_walker(currentQuery->planstate, &li);
+	*sortJson = li.sortJson;
 	return li.limit;
 }
 
@@ -252,6 +433,92 @@ uint64 convert_xid(TransactionId xid) {
 	return (epoch << 32) | xid;
 }
 
+/*
+ * ZomboDB indexes the members of a HOT chain under the ctid of the chain's root, so
+ * if the tuple at 'ctid' is a heap-only tuple, find that root.  Returns false if 'ctid'
+ * is its own root (or doesn't point at a tuple at all)
+ */
+bool find_hot_root(Relation heapRel, ItemPointer ctid, ItemPointer root) {
+	BlockNumber  blkno  = ItemPointerGetBlockNumber(ctid);
+	OffsetNumber offnum = ItemPointerGetOffsetNumber(ctid);
+	OffsetNumber roots[MaxHeapTuplesPerPage];
+	Buffer       buffer;
+	Page         page;
+	bool         found  = false;
+
+	buffer = ReadBuffer(heapRel, blkno);
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buffer);
+
+	if (offnum >= FirstOffsetNumber && offnum <= PageGetMaxOffsetNumber(page)) {
+		ItemId lp = PageGetItemId(page, offnum);
+
+		if (ItemIdIsNormal(lp) && HeapTupleHeaderIsHeapOnly((HeapTupleHeader) PageGetItem(page, lp))) {
+			heap_get_root_tuples(page, roots);
+
+			if (roots[offnum - 1] != InvalidOffsetNumber) {
+				ItemPointerSet(root, blkno, roots[offnum - 1]);
+				found = true;
+			}
+		}
+	}
+
+	UnlockReleaseBuffer(buffer);
+	return found;
+}
+
+HotRootCache *create_hot_root_cache(MemoryContext memoryContext) {
+	HotRootCache *cache = MemoryContextAlloc(memoryContext, sizeof(HotRootCache));
+
+	cache->heapRelid = InvalidOid;
+	cache->blkno     = InvalidBlockNumber;
+	cache->maxoff    = InvalidOffsetNumber;
+	return cache;
+}
+
+/*
+ * Like find_hot_root(), but for callers that look up lots of ctids, most of which aren't
+ * heap-only tuples.  The roots of every HOT chain on a page are worked out the first time
+ * one of its ctids is looked up, so that each page is only read once no matter how many
+ * of its tuples we're asked about
+ */
+bool find_hot_root_cached(HotRootCache *cache, Oid heapRelid, ItemPointer ctid, ItemPointer root) {
+	BlockNumber  blkno  = ItemPointerGetBlockNumber(ctid);
+	OffsetNumber offnum = ItemPointerGetOffsetNumber(ctid);
+
+	if (cache->heapRelid != heapRelid || cache->blkno != blkno || offnum > cache->maxoff) {
+		Relation     heapRel = RelationIdGetRelation(heapRelid);
+		Buffer       buffer;
+		Page         page;
+		OffsetNumber i;
+
+		buffer = ReadBuffer(heapRel, blkno);
+		LockBuffer(buffer, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buffer);
+
+		cache->maxoff = PageGetMaxOffsetNumber(page);
+		heap_get_root_tuples(page, cache->roots);
+		for (i = FirstOffsetNumber; i <= cache->maxoff; i++) {
+			ItemId lp = PageGetItemId(page, i);
+
+			if (!ItemIdIsNormal(lp) || !HeapTupleHeaderIsHeapOnly((HeapTupleHeader) PageGetItem(page, lp)))
+				cache->roots[i - 1] = InvalidOffsetNumber;
+		}
+
+		UnlockReleaseBuffer(buffer);
+		RelationClose(heapRel);
+
+		cache->heapRelid = heapRelid;
+		cache->blkno     = blkno;
+	}
+
+	if (offnum < FirstOffsetNumber || offnum > cache->maxoff || cache->roots[offnum - 1] == InvalidOffsetNumber)
+		return false;
+
+	ItemPointerSet(root, blkno, cache->roots[offnum - 1]);
+	return true;
+}
+
 char **array_to_strings(ArrayType *array, int *many) {
 	char  **result;
 	Datum *elements;
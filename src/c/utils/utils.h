@@ -19,6 +19,7 @@
 
 #include "postgres.h"
 #include "access/genam.h"
+#include "access/htup_details.h"
 #include "access/tupdesc.h"
 #include "lib/stringinfo.h"
 #include "nodes/execnodes.h"
@@ -45,6 +46,16 @@ static inline Oid *oids3(Oid a, Oid b, Oid c) {
 	return rc;
 }
 
+/*
+ * The roots of the HOT chains on the heap page find_hot_root_cached() last looked at
+ */
+typedef struct HotRootCache {
+	Oid          heapRelid;
+	BlockNumber  blkno;
+	OffsetNumber maxoff;
+	OffsetNumber roots[MaxHeapTuplesPerPage];  /* InvalidOffsetNumber for tuples that aren't heap-only */
+} HotRootCache;
+
 void freeStringInfo(StringInfo si);
 Oid get_base_type_oid(Oid typeOid);
 TupleDesc lookup_composite_tupdesc(Datum composite);
@@ -54,8 +65,11 @@ char *text_to_cstring_maybe_no_copy(const text *t, int *len, text **possible_cop
 void replace_line_breaks(char *str, int len, char with_char);
 char *strip_json_ending(char *str, int len);
 Relation find_zombodb_index(Relation heapRel);
-uint64 find_limit_for_scan(IndexScanDesc scan);
+uint64 find_limit_for_scan(IndexScanDesc scan, char **sortJson);
 uint64 convert_xid(TransactionId xid);
+bool find_hot_root(Relation heapRel, ItemPointer ctid, ItemPointer root);
+HotRootCache *create_hot_root_cache(MemoryContext memoryContext);
+bool find_hot_root_cached(HotRootCache *cache, Oid heapRelid, ItemPointer ctid, ItemPointer root);
 char **array_to_strings(ArrayType *array, int *many);
 ZDBQueryType **array_to_zdbqueries(ArrayType *array, int *many);
 char *lookup_zdb_namespace(void);
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 #include "zombodb.h"
+#include "elasticsearch/group_commit.h"
+#include "elasticsearch/refresh_coordinator.h"
 #include "highlighting/highlighting.h"
 #include "rest/curl_support.h"
 #include "scoring/scoring.h"
@@ -39,6 +41,8 @@ void _PG_init(void) {
 	json_support_init();
 	scoring_support_init();
 	highlight_support_init();
+	group_commit_init();
+	refresh_coordinator_init();
 
 	/* callbacks registered here should always be the first to run, so it's the last one we initialize */
 	zdb_aminit();
@@ -0,0 +1,28 @@
+--
+-- support for indexes created WITH (async=true)
+--
+
+--
+-- the ctids of rows changed in async indexes, waiting to be sent to Elasticsearch by the async indexing worker
+--
+CREATE TABLE async_queue (
+  indexrelid oid NOT NULL,
+  heap_ctid tid NOT NULL,
+  queued timestamptz NOT NULL DEFAULT now()
+);
+CREATE INDEX idxasync_queue_indexrelid_queued ON async_queue (indexrelid, queued);
+
+--
+-- how far behind Postgres each async index is
+--
+CREATE OR REPLACE VIEW async_lag AS
+  SELECT
+    indexrelid::regclass AS index,
+    count(*)             AS pending,
+    min(queued)          AS oldest,
+    now() - min(queued)  AS lag
+  FROM zdb.async_queue
+  GROUP BY indexrelid;
+
+GRANT SELECT ON async_queue TO PUBLIC;
+GRANT SELECT ON async_lag TO PUBLIC;
@@ -1,10 +1,19 @@
+CREATE OR REPLACE FUNCTION zdb.aborted_xids_doc_ids() RETURNS text[] PARALLEL SAFE IMMUTABLE STRICT LANGUAGE c AS 'MODULE_PATHNAME', 'zdb_aborted_xids_doc_ids';
+
+CREATE OR REPLACE FUNCTION zdb.aborted_xids_lookup(field text, index regclass, type text) RETURNS zdbquery PARALLEL SAFE STABLE STRICT LANGUAGE sql AS $$
+/*
+ * a terms lookup against every document holding the index's aborted xids
+ */
+    SELECT dsl.or(VARIADIC (SELECT array_agg(dsl.terms_lookup(field, zdb.index_name(index), type, 'zdb_aborted_xids', id)) FROM unnest(zdb.aborted_xids_doc_ids()) id));
+$$;
+
 CREATE OR REPLACE FUNCTION zdb.vac_by_xmin(index regclass, type text, xmin bigint) RETURNS zdbquery PARALLEL SAFE STABLE STRICT LANGUAGE sql AS $$
 /*
  * docs with aborted xmins
  */
     SELECT dsl.and(
         dsl.range(field=>'zdb_xmin', lt=>xmin),
-        dsl.terms_lookup('zdb_xmin', zdb.index_name(index), type, 'zdb_aborted_xids', 'zdb_aborted_xids')
+        zdb.aborted_xids_lookup('zdb_xmin', index, type)
     );
 $$;
 
@@ -14,7 +23,7 @@ CREATE OR REPLACE FUNCTION zdb.vac_by_xmax(index regclass, type text, xmax bigin
  */
     SELECT dsl.and(
         dsl.range(field=>'zdb_xmax', lt=>xmax),
-        dsl.noteq(dsl.terms_lookup('zdb_xmax', zdb.index_name(index), type, 'zdb_aborted_xids', 'zdb_aborted_xids'))
+        dsl.noteq(zdb.aborted_xids_lookup('zdb_xmax', index, type))
     );
 $$;
 
@@ -24,7 +33,7 @@ CREATE OR REPLACE FUNCTION zdb.vac_aborted_xmax(index regclass, type text, xmax
  */
     SELECT dsl.and(
         dsl.range(field=>'zdb_xmax', lt=>xmax),
-        dsl.terms_lookup('zdb_xmax', zdb.index_name(index), type, 'zdb_aborted_xids', 'zdb_aborted_xids')
+        zdb.aborted_xids_lookup('zdb_xmax', index, type)
     );
 $$;
 
@@ -1,3 +1,12 @@
+--
+-- the in-progress/aborted xids an index knows about, across all the documents holding them
+--
+CREATE OR REPLACE FUNCTION zdb.aborted_xids(index regclass) RETURNS SETOF bigint PARALLEL SAFE STABLE STRICT LANGUAGE sql AS $$
+    SELECT xid::bigint
+      FROM json_array_elements((zdb.request(index, 'doc/_mget', 'POST', json_build_object('ids', zdb.aborted_xids_doc_ids())::text)::json)->'docs') doc,
+           json_array_elements_text(doc->'_source'->'zdb_aborted_xids') xid;
+$$;
+
 --
 -- a view to get quick stats about all indexes
 --
@@ -27,5 +36,5 @@ CREATE OR REPLACE VIEW index_stats AS
     stats -> '_shards' -> 'total'                                                           AS shards,
     settings -> index_name -> 'settings' -> 'index' ->> 'number_of_replicas'                AS replicas,
     (zdb.request(indexrelid, 'doc/_count', 'GET') :: JSON) -> 'count'                      AS doc_count,
-    coalesce(json_array_length((zdb.request(indexrelid, 'doc/zdb_aborted_xids', 'GET') :: JSON) -> '_source'->'zdb_aborted_xids'), 0) AS aborted_xids
+    (SELECT count(*)::int FROM zdb.aborted_xids(indexrelid))                                AS aborted_xids
   FROM stats;
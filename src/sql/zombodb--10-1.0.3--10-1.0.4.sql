@@ -0,0 +1,108 @@
+--
+-- support for indexes created WITH (async=true)
+--
+
+--
+-- the ctids of rows changed in async indexes, waiting to be sent to Elasticsearch by the async indexing worker
+--
+CREATE TABLE async_queue (
+  indexrelid oid NOT NULL,
+  heap_ctid tid NOT NULL,
+  queued timestamptz NOT NULL DEFAULT now()
+);
+CREATE INDEX idxasync_queue_indexrelid_queued ON async_queue (indexrelid, queued);
+
+--
+-- how far behind Postgres each async index is
+--
+CREATE OR REPLACE VIEW async_lag AS
+  SELECT
+    indexrelid::regclass AS index,
+    count(*)             AS pending,
+    min(queued)          AS oldest,
+    now() - min(queued)  AS lag
+  FROM zdb.async_queue
+  GROUP BY indexrelid;
+
+GRANT SELECT ON async_queue TO PUBLIC;
+GRANT SELECT ON async_lag TO PUBLIC;
+
+CREATE OR REPLACE FUNCTION zdb.aborted_xids_doc_ids() RETURNS text[] PARALLEL SAFE IMMUTABLE STRICT LANGUAGE c AS 'MODULE_PATHNAME', 'zdb_aborted_xids_doc_ids';
+
+CREATE OR REPLACE FUNCTION zdb.aborted_xids_lookup(field text, index regclass, type text) RETURNS zdbquery PARALLEL SAFE STABLE STRICT LANGUAGE sql AS $$
+/*
+ * a terms lookup against every document holding the index's aborted xids
+ */
+    SELECT dsl.or(VARIADIC (SELECT array_agg(dsl.terms_lookup(field, zdb.index_name(index), type, 'zdb_aborted_xids', id)) FROM unnest(zdb.aborted_xids_doc_ids()) id));
+$$;
+
+CREATE OR REPLACE FUNCTION zdb.vac_by_xmin(index regclass, type text, xmin bigint) RETURNS zdbquery PARALLEL SAFE STABLE STRICT LANGUAGE sql AS $$
+/*
+ * docs with aborted xmins
+ */
+    SELECT dsl.and(
+        dsl.range(field=>'zdb_xmin', lt=>xmin),
+        zdb.aborted_xids_lookup('zdb_xmin', index, type)
+    );
+$$;
+
+CREATE OR REPLACE FUNCTION zdb.vac_by_xmax(index regclass, type text, xmax bigint) RETURNS zdbquery PARALLEL SAFE STABLE STRICT LANGUAGE sql AS $$
+/*
+ * docs with committed xmax
+ */
+    SELECT dsl.and(
+        dsl.range(field=>'zdb_xmax', lt=>xmax),
+        dsl.noteq(zdb.aborted_xids_lookup('zdb_xmax', index, type))
+    );
+$$;
+
+CREATE OR REPLACE FUNCTION zdb.vac_aborted_xmax(index regclass, type text, xmax bigint) RETURNS zdbquery PARALLEL SAFE STABLE STRICT LANGUAGE sql AS $$
+/*
+ * docs with aborted xmax
+ */
+    SELECT dsl.and(
+        dsl.range(field=>'zdb_xmax', lt=>xmax),
+        zdb.aborted_xids_lookup('zdb_xmax', index, type)
+    );
+$$;
+
+--
+-- the in-progress/aborted xids an index knows about, across all the documents holding them
+--
+CREATE OR REPLACE FUNCTION zdb.aborted_xids(index regclass) RETURNS SETOF bigint PARALLEL SAFE STABLE STRICT LANGUAGE sql AS $$
+    SELECT xid::bigint
+      FROM json_array_elements((zdb.request(index, 'doc/_mget', 'POST', json_build_object('ids', zdb.aborted_xids_doc_ids())::text)::json)->'docs') doc,
+           json_array_elements_text(doc->'_source'->'zdb_aborted_xids') xid;
+$$;
+
+--
+-- a view to get quick stats about all indexes
+--
+CREATE OR REPLACE VIEW index_stats AS
+  WITH stats AS (
+      SELECT
+        indrelid :: REGCLASS                                                                 table_name,
+        indexrelid::regclass                                                                 ,
+        zdb.index_name(indexrelid)                                                          index_name,
+        zdb.index_url(indexrelid)                                                           url,
+        zdb.request(indexrelid, '_stats', 'GET')::json                                      stats,
+        zdb.request(indexrelid, '_settings', 'GET')::json                                   settings
+      FROM pg_index, pg_class
+      where pg_class.oid = pg_index.indexrelid and relam = (select oid from pg_am where amname = 'zombodb')
+  )
+  SELECT
+    (select array_to_string(array_agg(alias), ',') from zdb.cat_aliases where index = index_name) as alias,
+    index_name,
+    url,
+    table_name,
+    stats -> '_all' -> 'primaries' -> 'docs' -> 'count'                                     AS es_docs,
+    pg_size_pretty((stats -> '_all' -> 'primaries' -> 'store' ->> 'size_in_bytes') :: INT8) AS es_size,
+    (stats -> '_all' -> 'primaries' -> 'store' ->> 'size_in_bytes') :: INT8                 AS es_size_bytes,
+    (SELECT reltuples::int8 FROM pg_class WHERE oid = table_name)                           AS pg_docs_estimate,
+    pg_size_pretty(pg_total_relation_size(table_name))                                      AS pg_size,
+    pg_total_relation_size(table_name)                                                      AS pg_size_bytes,
+    stats -> '_shards' -> 'total'                                                           AS shards,
+    settings -> index_name -> 'settings' -> 'index' ->> 'number_of_replicas'                AS replicas,
+    (zdb.request(indexrelid, 'doc/_count', 'GET') :: JSON) -> 'count'                      AS doc_count,
+    (SELECT count(*)::int FROM zdb.aborted_xids(indexrelid))                                AS aborted_xids
+  FROM stats;
@@ -28,9 +28,9 @@ commit;
 select * from issue273 order by id;
 select * from zdb.terms('idxissue273', 'id', dsl.match_all(), 1000, 'term');
 
-SELECT jsonb_array_length((zdb.request('idxissue273', 'doc/zdb_aborted_xids?pretty')::jsonb)->'_source'->'zdb_aborted_xids');
+SELECT count(*) FROM zdb.aborted_xids('idxissue273');
 VACUUM issue273;
-SELECT jsonb_array_length((zdb.request('idxissue273', 'doc/zdb_aborted_xids?pretty')::jsonb)->'_source'->'zdb_aborted_xids');
+SELECT count(*) FROM zdb.aborted_xids('idxissue273');
 
 
 DROP TABLE issue273;
@@ -0,0 +1,22 @@
+CREATE TABLE hot AS SELECT * FROM events WHERE id = 1;
+UPDATE hot SET id = id WHERE id = 1;
+CREATE INDEX idxhot ON hot USING zombodb ((hot.*));
+SELECT zdb.count('idxhot', match_all());
+SELECT id FROM hot WHERE hot ==> 'id:1';
+DROP TABLE hot CASCADE;
+
+-- rows can only be HOT updated when the index doesn't include the changed columns
+CREATE TYPE hot_index_type AS (id bigint);
+CREATE TABLE hot (id bigint, note text);
+CREATE INDEX idxhot ON hot USING zombodb ((ROW(id)::hot_index_type));
+INSERT INTO hot VALUES (1, 'one'), (2, 'two');
+UPDATE hot SET note = 'uno' WHERE id = 1;
+UPDATE hot SET note = 'eins' WHERE id = 1;
+SELECT id, note FROM hot WHERE hot ==> 'id:1';
+SELECT zdb.count('idxhot', match_all());
+DELETE FROM hot WHERE id = 1;
+SELECT id, note FROM hot WHERE hot ==> match_all() ORDER BY id;
+SELECT zdb.count('idxhot', match_all());
+
+DROP TABLE hot CASCADE;
+DROP TYPE hot_index_type;
@@ -0,0 +1,30 @@
+CREATE TABLE async_indexing (
+  id SERIAL8 NOT NULL PRIMARY KEY,
+  title text
+);
+CREATE INDEX idxasync_indexing ON async_indexing USING zombodb ((async_indexing)) WITH (async=true);
+
+INSERT INTO async_indexing (title) VALUES ('one'), ('two'), ('three');
+
+BEGIN;
+INSERT INTO async_indexing (title) VALUES ('aborted');
+ABORT;
+
+UPDATE async_indexing SET title = 'deux' WHERE title = 'two';
+DELETE FROM async_indexing WHERE title = 'three';
+
+-- wait for the worker to ship everything
+DO LANGUAGE plpgsql $$
+BEGIN
+    FOR i IN 1..600 LOOP
+        EXIT WHEN NOT EXISTS (SELECT 1 FROM zdb.async_queue WHERE indexrelid = 'idxasync_indexing'::regclass);
+        PERFORM pg_sleep(0.1);
+    END LOOP;
+END;
+$$;
+
+SELECT count(*) FROM zdb.async_lag WHERE index = 'idxasync_indexing'::regclass;
+SELECT id, title FROM async_indexing WHERE async_indexing ==> match_all() ORDER BY id;
+SELECT zdb.count('idxasync_indexing', match_all());
+
+DROP TABLE async_indexing CASCADE;
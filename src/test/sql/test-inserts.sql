@@ -20,9 +20,9 @@ VACUUM events;
 
 
 -- MVCC count should match raw count
---   NB:  zdb.raw_count() always returns 1 more doc than we expect because of the 'zdb.aborted_xids' doc
+--   NB:  zdb.raw_count() always returns 1 more doc than we expect for each of the 'zdb_aborted_xids' docs
 SELECT zdb.count('idxevents', match_all()),
        zdb.raw_count('idxevents', match_all()),
-       zdb.count('idxevents', match_all())+1 = zdb.raw_count('idxevents', match_all());
+       zdb.count('idxevents', match_all())+array_length(zdb.aborted_xids_doc_ids(), 1) = zdb.raw_count('idxevents', match_all());
 
 ALTER TABLE events SET (autovacuum_enabled = true);
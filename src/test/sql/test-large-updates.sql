@@ -0,0 +1,29 @@
+SELECT count(*), count(*) = 126245, zdb.count('idxevents', match_all()), zdb.count('idxevents', match_all()) = 126245 FROM events;
+ALTER TABLE events SET (autovacuum_enabled = false);
+VACUUM events;
+
+-- enough rows that their xmax is stamped with a single _update_by_query
+SELECT zdb.raw_count('idxevents', dsl.field_exists('zdb_xmax'));
+UPDATE events SET id = id WHERE id <= 10000;
+SELECT zdb.count('idxevents', match_all()), zdb.raw_count('idxevents', dsl.field_exists('zdb_xmax'));
+
+-- the second UPDATE stamps documents the first one indexed, which it has to send and refresh first
+BEGIN;
+UPDATE events SET id = id WHERE id <= 10000;
+UPDATE events SET id = id WHERE id <= 10000;
+SELECT zdb.count('idxevents', match_all()), zdb.raw_count('idxevents', dsl.field_exists('zdb_xmax'));
+ABORT;
+SELECT zdb.count('idxevents', match_all()), zdb.raw_count('idxevents', dsl.field_exists('zdb_xmax'));
+
+ALTER TABLE events SET (autovacuum_enabled = true);
+
+-- after a vacuum we should have no aborted xids
+VACUUM events;
+SELECT count(*) FROM zdb.aborted_xids('idxevents');
+
+-- MVCC count should match raw count
+--   NB:  zdb.raw_count() always returns 1 more doc than we expect for each of the 'zdb_aborted_xids' docs
+SELECT zdb.count('idxevents', match_all()),
+       zdb.raw_count('idxevents', match_all()),
+       zdb.count('idxevents', match_all())+array_length(zdb.aborted_xids_doc_ids(), 1) = zdb.raw_count('idxevents', match_all());
+
@@ -0,0 +1,11 @@
+create table offset_limit_test as select id::bigint, 'row ' || id as title from generate_series(1, 12000) id;
+create index idxoffset_limit_test on offset_limit_test using zombodb ((offset_limit_test.*));
+
+select id, title from offset_limit_test where offset_limit_test ==> dsl.sort('id', 'asc', dsl.offset_limit(3, 4, dsl.match_all())) order by id;
+select id, title from offset_limit_test where offset_limit_test ==> dsl.sort('id', 'desc', dsl.offset_limit(9990, 5, dsl.match_all())) order by id;
+select id, title from offset_limit_test where offset_limit_test ==> dsl.sort('id', 'asc', dsl.offset_limit(10500, 5, dsl.match_all())) order by id;
+select id, title from offset_limit_test where offset_limit_test ==> dsl.sort('id', 'asc', dsl.offset_limit(11998, 5, dsl.match_all())) order by id;
+select count(*) from offset_limit_test where offset_limit_test ==> dsl.offset_limit(500, 11000, dsl.match_all());
+select count(*) from offset_limit_test where offset_limit_test ==> dsl.offset_limit(12000, 5, dsl.match_all());
+
+drop table offset_limit_test;
@@ -0,0 +1,20 @@
+create table parallel_build_test as select id::bigint, 'row ' || id as title from generate_series(1, 300000) id;
+
+-- big enough that the build's chunks of heap blocks are spread across the backend and both workers
+select pg_relation_size('parallel_build_test') / current_setting('block_size')::int > 3 * 256 as splits;
+
+create index idxparallel_build_test on parallel_build_test using zombodb ((parallel_build_test.*)) with (parallel_build_workers=2);
+
+select (select count(*) from parallel_build_test) as heap_count, zdb.count('idxparallel_build_test', dsl.match_all()) as es_count;
+select zdb.sum('idxparallel_build_test', 'id', dsl.match_all()) = (select sum(id) from parallel_build_test) as same_sum;
+select zdb.count('idxparallel_build_test', 'id:1 OR id:150000 OR id:300000');
+
+-- and again when it's rebuilt
+delete from parallel_build_test where id % 3 = 0;
+reindex index idxparallel_build_test;
+
+select (select count(*) from parallel_build_test) as heap_count, zdb.count('idxparallel_build_test', dsl.match_all()) as es_count;
+select zdb.sum('idxparallel_build_test', 'id', dsl.match_all()) = (select sum(id) from parallel_build_test) as same_sum;
+select zdb.count('idxparallel_build_test', 'id:1 OR id:150000 OR id:300000');
+
+drop table parallel_build_test;
@@ -0,0 +1,33 @@
+create table parallel_indexscan_test as select id::bigint, 'row ' || id as title from generate_series(1, 20000) id;
+create index idxparallel_indexscan_test on parallel_indexscan_test using zombodb ((parallel_indexscan_test.*)) with (shards=4);
+analyze parallel_indexscan_test;
+
+set enable_seqscan to off;
+set enable_bitmapscan to off;
+set max_parallel_workers_per_gather to 2;
+set parallel_setup_cost to 0;
+set parallel_tuple_cost to 0;
+set min_parallel_index_scan_size to 0;
+
+-- the scans are planned as Parallel Index Scans under a Gather
+explain (costs off) select sum(id) from parallel_indexscan_test where parallel_indexscan_test ==> 'id:[1 TO 100]';
+explain (costs off) select id from parallel_indexscan_test where parallel_indexscan_test ==> 'id:[1 TO 100]' limit 10;
+
+select count(*), count(distinct id), sum(id) from parallel_indexscan_test where parallel_indexscan_test ==> dsl.match_all();
+select count(*), count(distinct id), sum(id) from parallel_indexscan_test where parallel_indexscan_test ==> 'id:[1 TO 100]';
+select count(*) from parallel_indexscan_test where parallel_indexscan_test ==> dsl.limit(10, dsl.match_all());
+select count(*) from (select id from parallel_indexscan_test where parallel_indexscan_test ==> 'id:[1 TO 100]' limit 10) x;
+
+begin;
+insert into parallel_indexscan_test select id, 'row ' || id from generate_series(20001, 20005) id;
+select count(*), sum(id) from parallel_indexscan_test where parallel_indexscan_test ==> 'id:>20000';
+abort;
+
+reset enable_seqscan;
+reset enable_bitmapscan;
+reset max_parallel_workers_per_gather;
+reset parallel_setup_cost;
+reset parallel_tuple_cost;
+reset min_parallel_index_scan_size;
+
+drop table parallel_indexscan_test;
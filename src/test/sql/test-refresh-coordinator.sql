@@ -0,0 +1,47 @@
+create table refresh_coordinator_test (id bigint primary key, title text, n int);
+create index idxrefresh_coordinator_test on refresh_coordinator_test using zombodb ((refresh_coordinator_test.*));
+
+-- each statement's changes are visible to the next ones in the same transaction
+begin;
+insert into refresh_coordinator_test select id, 'row ' || id, id % 10 from generate_series(1, 1000) id;
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> dsl.match_all();
+update refresh_coordinator_test set n = 100 where id <= 100;
+delete from refresh_coordinator_test where id > 900;
+insert into refresh_coordinator_test select id, 'row ' || id, 200 from generate_series(1001, 1050) id;
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> dsl.match_all();
+select zdb.count('idxrefresh_coordinator_test', dsl.match_all());
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'n:100';
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'n:200';
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'id:>900';
+commit;
+
+-- and to everyone once it commits
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> dsl.match_all();
+select zdb.count('idxrefresh_coordinator_test', dsl.match_all());
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'n:100';
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'n:200';
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'id:>900';
+
+-- but not when it aborts
+begin;
+update refresh_coordinator_test set n = 300 where n = 200;
+delete from refresh_coordinator_test where n = 100;
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'n:300';
+abort;
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'n:300';
+select count(*) from refresh_coordinator_test where refresh_coordinator_test ==> 'n:100';
+select zdb.count('idxrefresh_coordinator_test', dsl.match_all());
+
+-- the same row changed by several statements
+begin;
+insert into refresh_coordinator_test values (2000, 'row 2000', 400);
+update refresh_coordinator_test set n = 401 where id = 2000;
+update refresh_coordinator_test set n = 402 where id = 2000;
+select id, n from refresh_coordinator_test where refresh_coordinator_test ==> 'id:2000';
+select zdb.count('idxrefresh_coordinator_test', 'n:400 OR n:401 OR n:402');
+commit;
+select id, n from refresh_coordinator_test where refresh_coordinator_test ==> 'id:2000';
+select zdb.count('idxrefresh_coordinator_test', 'n:400 OR n:401 OR n:402');
+select zdb.count('idxrefresh_coordinator_test', dsl.match_all());
+
+drop table refresh_coordinator_test;
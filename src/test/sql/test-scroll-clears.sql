@@ -0,0 +1,55 @@
+create table scroll_clears_test as select id::bigint, 'row ' || id as title from generate_series(1, 30000) id;
+create index idxscroll_clears_test on scroll_clears_test using zombodb ((scroll_clears_test.*));
+analyze scroll_clears_test;
+
+set enable_seqscan to off;
+set enable_bitmapscan to off;
+set max_parallel_workers_per_gather to 0;
+
+-- a cursor that's only partly read, past its first page, leaves its scroll to be cleared at commit
+begin;
+declare c cursor for select id from scroll_clears_test where scroll_clears_test ==> dsl.sort('id', 'asc', 'id:[1 TO 25000]');
+fetch 3 from c;
+move forward 12000 in c;
+fetch 2 from c;
+commit;
+
+-- a holdable cursor finishes its scan as the transaction commits, and can still be read after
+begin;
+declare h cursor with hold for select id from scroll_clears_test where scroll_clears_test ==> dsl.sort('id', 'asc', 'id:[1 TO 25000]');
+fetch 2 from h;
+commit;
+fetch 2 from h;
+close h;
+
+-- fetches that are rolled back to a savepoint, and a cursor opened inside one
+begin;
+declare c cursor for select id from scroll_clears_test where scroll_clears_test ==> dsl.sort('id', 'asc', 'id:[1 TO 25000]');
+fetch 2 from c;
+savepoint s1;
+fetch 2 from c;
+move forward 15000 in c;
+rollback to savepoint s1;
+fetch 2 from c;
+savepoint s2;
+declare c2 cursor for select id from scroll_clears_test where scroll_clears_test ==> dsl.sort('id', 'desc', dsl.match_all());
+fetch 2 from c2;
+move forward 12000 in c2;
+rollback to savepoint s2;
+fetch 2 from c;
+close c;
+commit;
+
+-- and the session carries on as usual
+select count(*) from scroll_clears_test where scroll_clears_test ==> 'id:[1 TO 25000]';
+select zdb.count('idxscroll_clears_test', dsl.match_all());
+begin;
+declare c cursor for select id from scroll_clears_test where scroll_clears_test ==> dsl.sort('id', 'desc', dsl.match_all());
+fetch 3 from c;
+commit;
+
+reset max_parallel_workers_per_gather;
+reset enable_bitmapscan;
+reset enable_seqscan;
+
+drop table scroll_clears_test;
@@ -0,0 +1,30 @@
+create table sliced_scroll_test as select id::bigint, 'row ' || id as title, id % 10 as bucket from generate_series(1, 100000) id;
+create index idxsliced_scroll_test on sliced_scroll_test using zombodb ((sliced_scroll_test.*)) with (shards=4);
+analyze sliced_scroll_test;
+
+set enable_seqscan to off;
+set max_parallel_workers_per_gather to 0;
+
+-- an index scan reads a single scroll
+set enable_bitmapscan to off;
+explain (costs off) select count(*) from sliced_scroll_test where sliced_scroll_test ==> 'bucket:3';
+select count(*), count(distinct id), sum(id) from sliced_scroll_test where sliced_scroll_test ==> dsl.match_all();
+select count(*), count(distinct id), sum(id) from sliced_scroll_test where sliced_scroll_test ==> 'bucket:3';
+reset enable_bitmapscan;
+
+-- a bitmap scan splits it into a slice per shard, and must find exactly the same rows
+set enable_indexscan to off;
+explain (costs off) select count(*) from sliced_scroll_test where sliced_scroll_test ==> 'bucket:3';
+select count(*), count(distinct id), sum(id) from sliced_scroll_test where sliced_scroll_test ==> dsl.match_all();
+select count(*), count(distinct id), sum(id) from sliced_scroll_test where sliced_scroll_test ==> 'bucket:3';
+reset enable_indexscan;
+
+-- as does zdb.query_tids()
+select count(*), count(distinct tid) from unnest(zdb.query_tids('idxsliced_scroll_test', dsl.match_all())) tid;
+select count(*), count(distinct tid) from unnest(zdb.query_tids('idxsliced_scroll_test', 'bucket:3')) tid;
+select zdb.count('idxsliced_scroll_test', dsl.match_all()), zdb.count('idxsliced_scroll_test', 'bucket:3');
+
+reset max_parallel_workers_per_gather;
+reset enable_seqscan;
+
+drop table sliced_scroll_test;
@@ -0,0 +1,60 @@
+CREATE TABLE smile_bulk (
+   id     SERIAL8 NOT NULL PRIMARY KEY
+  ,title  TEXT
+  ,body   TEXT
+  ,num    INT4
+  ,big    INT8
+  ,amount NUMERIC
+  ,ratio  FLOAT8
+  ,flag   BOOLEAN
+  ,tags   VARCHAR[]
+);
+CREATE INDEX idxsmile_bulk ON smile_bulk USING zombodb ((smile_bulk)) WITH (bulk_format='smile');
+
+INSERT INTO smile_bulk (title, body, num, big, amount, ratio, flag, tags) VALUES ('plain ascii', 'hello world', 42, 9223372036854775807, 12345.6789, 3.5e-10, true, ARRAY['a', 'b']);
+INSERT INTO smile_bulk (title, body, num, big, amount, ratio, flag, tags) VALUES ('café crème', 'naïve façade', -42, -9223372036854775808, -0.5, -1e300, false, ARRAY['ü', 'ß']);
+INSERT INTO smile_bulk (title, body, num, big, amount, ratio, flag, tags) VALUES ('日本語のテキスト', repeat('lorem ipsum ', 5000), 0, 0, 0, 0, NULL, NULL);
+INSERT INTO smile_bulk (title, body, num, big, amount, ratio, flag, tags) VALUES ('emoji 😀 snowman ☃', repeat('smile ', 20000) || 'needle', 2147483647, -1, 1e-20, 1e308, true, ARRAY['😀']);
+INSERT INTO smile_bulk (title, body, num, big, amount, ratio, flag, tags) VALUES (NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+
+/* every row made it into the index */
+SELECT (SELECT count(*) FROM smile_bulk) AS heap_count, zdb.count('idxsmile_bulk', dsl.match_all()) AS es_count;
+
+/* and each value can be found by what it was indexed as */
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match('title', 'café') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match('body', 'façade') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match_phrase('title', '日本語') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match('title', 'snowman') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match('body', 'ipsum') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match('body', 'needle') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('tags', 'ü') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('tags', '😀') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('num', -42) ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('num', 2147483647) ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('big', 9223372036854775807) ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('big', -9223372036854775808) ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.range(field=>'amount', gt=>12345, lt=>12346) ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.range(field=>'ratio', lt=>0) ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('flag', 'true') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.field_missing('flag') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.field_missing('title') ORDER BY id;
+
+UPDATE smile_bulk SET title = 'mise à jour ✓', num = num + 1, ratio = NULL WHERE id = 2;
+UPDATE smile_bulk SET title = 'no longer null', big = 1 WHERE id = 5;
+DELETE FROM smile_bulk WHERE id = 3;
+
+SELECT (SELECT count(*) FROM smile_bulk) AS heap_count, zdb.count('idxsmile_bulk', dsl.match_all()) AS es_count;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match('title', 'jour') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match('title', 'café') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('num', -41) ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.term('num', -42) ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.field_missing('ratio') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.field_missing('title') ORDER BY id;
+SELECT id FROM smile_bulk WHERE smile_bulk ==> dsl.match('body', 'ipsum') ORDER BY id;
+SELECT id, num, big, amount, ratio, flag, octet_length(title) AS title_bytes, length(body) AS body_length FROM smile_bulk WHERE smile_bulk ==> dsl.match_all() ORDER BY id;
+
+/* cbor can't be used for _bulk requests */
+CREATE INDEX idxsmile_bulk_cbor ON smile_bulk USING zombodb ((smile_bulk)) WITH (bulk_format='cbor');
+ALTER INDEX idxsmile_bulk SET (bulk_format='cbor');
+
+DROP TABLE smile_bulk CASCADE;
@@ -0,0 +1,26 @@
+create table sort_pushdown_test as select id::bigint, 'row ' || id as title, case when id % 10 = 0 then null else id % 7 end as bucket, id % 13 as code, '2018-01-01'::timestamp + id * interval '1 second' as created from generate_series(1, 12000) id;
+select zdb.define_field_mapping('sort_pushdown_test', 'code', '{"type":"keyword"}');
+create index idxsort_pushdown_test on sort_pushdown_test using zombodb ((sort_pushdown_test.*));
+analyze sort_pushdown_test;
+
+set enable_seqscan to off;
+set max_parallel_workers_per_gather to 0;
+set zdb.log_level to notice;
+
+select id from sort_pushdown_test where sort_pushdown_test ==> dsl.match_all() order by id desc limit 5;
+select id from sort_pushdown_test where sort_pushdown_test ==> 'id:[100 TO 200]' order by id limit 3;
+select id from sort_pushdown_test where sort_pushdown_test ==> 'id:1^5 OR id:2^4 OR id:3^3 OR id:4^2 OR id:5' order by zdb.score(ctid) desc limit 3;
+select id, bucket from sort_pushdown_test where sort_pushdown_test ==> 'id:[1 TO 30]' order by bucket desc, id limit 5;
+select id, bucket from sort_pushdown_test where sort_pushdown_test ==> 'id:[1 TO 30]' order by bucket, id desc limit 3;
+select id from sort_pushdown_test where sort_pushdown_test ==> 'id:[1 TO 100]' and id % 2 = 0 order by id desc limit 3;
+select id from sort_pushdown_test where sort_pushdown_test ==> dsl.sort('id', 'asc', dsl.match_all()) order by id desc limit 3;
+select id from sort_pushdown_test where sort_pushdown_test ==> dsl.limit(10, dsl.sort('id', 'asc', dsl.match_all())) order by id desc limit 3;
+select id, code from sort_pushdown_test where sort_pushdown_test ==> 'id:[1 TO 30]' order by code desc, id limit 3;
+select id, created from sort_pushdown_test where sort_pushdown_test ==> 'id:[1 TO 30]' order by created desc limit 3;
+
+reset zdb.log_level;
+reset max_parallel_workers_per_gather;
+reset enable_seqscan;
+
+delete from zdb.mappings where table_name = 'sort_pushdown_test'::regclass;
+drop table sort_pushdown_test;
@@ -13,4 +13,7 @@ SELECT zdb.to_query_dsl('{"terms":{"subject":"beer"}}'::zdbquery);
 SELECT zdb.to_query_dsl('{"limit":42,"query_dsl":{"terms":{"subject":"beer"}}}'::zdbquery);
 SELECT zdb.to_query_dsl('{"query_dsl":{"terms":{"subject":"beer"}}}'::zdbquery);
 
-select dsl.row_estimate(88, dsl.min_score(42, dsl.sort('title', 'asc', dsl.offset_limit(10, 42, 'beer'))));
\ No newline at end of file
+select dsl.row_estimate(88, dsl.min_score(42, dsl.sort('title', 'asc', dsl.offset_limit(10, 42, 'beer'))));
+select dsl.limit(0, dsl.limit(5, 'beer'));
+select zdb.to_query_dsl(dsl.sort('title', 'asc', dsl.limit(5, 'beer')));
+SELECT '{"offset":3, "query_dsl":{"terms":{"subject":"beer"}}}'::zdbquery;
\ No newline at end of file